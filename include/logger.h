@@ -21,6 +21,8 @@
 #ifndef LOGGIN_ON_H
 #define LOGGIN_ON_H
 
+#include <stddef.h>  // size_t
+
 /** log levels */
 #define LOG_ERR    1
 #define LOG_WARN   2
@@ -35,6 +37,13 @@
 /* if you ever need more macros than this... change it :-D */
 #define LOG_MAX_LEVEL 1000000
 
+/* Log messages with a level above LOG_COMPILE_LEVEL are not compiled in
+ * at all, -DLOG_COMPILE_LEVEL=LOG_WARN keeps just errors and warnings.
+ * Custom levels go too if they are compile time constants, see README. */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_MAX_LEVEL
+#endif
+
 /** Display options */
 #define SHOW_NOTHING 0
 #define SHOW_EXACT_LOG_LEVEL 1
@@ -49,20 +58,156 @@ void log_set_level(int display_option, int log_level);
 /** Set the selection picks and the size of the selection array */
 void log_set_level_selection(int selection[], int selection_size);
 
+/** One bit per level below LOG_LEVEL_BITMAP_BITS, set if the display
+ *  option shows that level.  It is rebuilt by log_set_level and
+ *  log_set_level_selection, so call those again if you change the
+ *  selection array later on. */
+#define LOG_LEVEL_BITMAP_BITS 1024
+extern unsigned long long log_level_bitmap[LOG_LEVEL_BITMAP_BITS / 64];
+
+/** Does the display option show this level?  The slow way, for levels
+ *  beyond the bitmap. */
+int log_level_shown(int level);
+
+/** Does the display option show this level?  The macros ask this before
+ *  the arguments of a log message are even evaluated. */
+static inline int log_level_enabled(int level)
+{
+    if ((unsigned)level < LOG_LEVEL_BITMAP_BITS)
+        return (__atomic_load_n(&log_level_bitmap[(unsigned)level / 64], __ATOMIC_RELAXED)
+                >> ((unsigned)level % 64)) & 1;
+    return log_level_shown(level);
+}
+
+/** Timestamp options, or them together */
+#define LOG_TIMESTAMP_NONE 0
+#define LOG_TIMESTAMP_WALL 1       // 2026-10-18 02:47:12.123456, local time
+#define LOG_TIMESTAMP_MONOTONIC 2  // seconds.microseconds since boot
+
+/** Start the prefix of every message with a timestamp */
+void log_set_timestamp(int options);
+
+/** Colour options */
+#define LOG_COLOR_NEVER 0   // messages are written as they are
+#define LOG_COLOR_AUTO 1    // prefixes coloured by level on terminals, files plain
+#define LOG_COLOR_ALWAYS 2  // coloured on stdout and stderr even if not terminals
+
+/** Choose where colour goes, LOG_COLOR_AUTO to start with */
+void log_set_color(int mode);
+
+/** The escape sequence the prefix of a level is coloured with, NULL for none */
+void log_set_level_color(int level, const char *ansi);
+
+/** Output formats */
+#define LOG_FORMAT_TEXT 0  // prefix and message as text, fields as key=value
+#define LOG_FORMAT_JSON 1  // one JSON object per message, see README
+
+/** Choose how messages are rendered */
+void log_set_format(int format);
+
 /** Set the ptr to the log output function */
 void log_set_output_function(void (*function_ptr)(char* prefix, char* contents));
 
 /** The default output function is set to printf for unix */
 void log_default_stdout_func(char *prefix, char *contents);
 
+/** Sinks: more output functions, each with a display option of its own.
+ *  A message is formatted once and handed to every sink that shows its
+ *  level, and to the output function above if log_set_level shows it.
+ *  A message no sink shows goes to the output function in any case.
+ *  log_sink_add returns the sink number, -1 if all are taken. */
+#define LOG_SINKS_MAX 16
+int log_sink_add(void (*output)(char *prefix, char *contents), int display_option, int log_level);
+void log_sink_set_level(int sink, int display_option, int log_level);
+void log_sink_set_selection(int sink, int selection[], int selection_size);
+void log_sink_remove(int sink);
+
+/** Output functions for sinks, besides the file ones */
+void log_print_to_stderr(char *prefix, char *contents);
+
+/** Keep the newest messages in bytes of memory (0: free it) */
+void log_memory_start(size_t bytes);
+void log_print_to_memory(char *prefix, char *contents);
+/** Copy the newest whole messages that fit into out, oldest first.
+ *  Returns the length, out is always terminated. */
+size_t log_memory_read(char *out, size_t room);
+
+/** Send messages to a syslog style datagram socket, socket_path NULL
+ *  means /dev/log.  Returns -1 if it can't be reached. */
+int log_syslog_open(const char *socket_path, const char *ident);
+void log_print_to_syslog(char *prefix, char *contents);
+void log_syslog_close(void);
+
 /* Produce the log message defined by the DEFINE_LOG_MSG macro */
 void __attribute__((nonnull, format(printf,6,7)))
  _log_msg(const char *name, int level, const char* filename, int linenum, 
               const char* function, char *fmt, ...);
 
+/* Typed key/value fields for DEFINE_LOG_KV_MSG */
+#define LOG_KV_TYPE_STRING 1
+#define LOG_KV_TYPE_INT    2
+#define LOG_KV_TYPE_DOUBLE 3
+#define LOG_KV_TYPE_BOOL   4
+
+struct log_kv {
+    const char *key;
+    int type;
+    union {
+        const char *s;
+        long long i;
+        double d;
+    } value;
+};
+
+#define LOG_KV_STR(k, v)    ((struct log_kv){ (k), LOG_KV_TYPE_STRING, { .s = (v) } })
+#define LOG_KV_INT(k, v)    ((struct log_kv){ (k), LOG_KV_TYPE_INT, { .i = (v) } })
+#define LOG_KV_DOUBLE(k, v) ((struct log_kv){ (k), LOG_KV_TYPE_DOUBLE, { .d = (v) } })
+#define LOG_KV_BOOL(k, v)   ((struct log_kv){ (k), LOG_KV_TYPE_BOOL, { .i = !!(v) } })
+
+/* The fields of one message: LOG_KV(LOG_KV_STR("user", name), LOG_KV_INT("id", 7)).
+ * They stay in parentheses until DEFINE_LOG_KV_MSG turns them into an
+ * array and its length with LOG_KV_ARRAY. */
+#define LOG_KV(...) (__VA_ARGS__)
+#define LOG_KV_ARRAY(...)                                                      \
+    (const struct log_kv[]){ __VA_ARGS__ },                                    \
+    (int)(sizeof((struct log_kv[]){ __VA_ARGS__ }) / sizeof(struct log_kv))
+
+/* Produce the log message defined by the DEFINE_LOG_KV_MSG macro */
+void __attribute__((nonnull, format(printf,8,9)))
+ _log_kv_msg(const char *name, int level, const char* filename, int linenum,
+             const char* function, const struct log_kv *fields, int field_count,
+             const char *fmt, ...);
+
+struct log_callsite;
+
+/* Per call site state of the rate limited and sampled macros */
+struct log_limit {
+    unsigned long long state;       /* second << 32 | count, or occurrences */
+    unsigned long long suppressed;  /* since the last summary */
+    unsigned reported;              /* second of the last summary */
+    int level;                      /* of the last message let through */
+    struct log_callsite *site;      /* where the summary comes from */
+    struct log_limit *next;         /* sites that suppressed, for log_flush */
+    int listed;
+};
+
+/* Should this message go out?  Count it as suppressed if not. */
+int log_limit_rate(struct log_limit *limit, unsigned per_second);
+int log_limit_every(struct log_limit *limit, unsigned n);
+int log_limit_sample(struct log_limit *limit, double probability);
+
+/* Produce a message that got past a limit, after a summary of the ones
+ * that didn't, at most once a second.  log_flush() and close_log()
+ * write the summaries that are left. */
+void __attribute__((nonnull, format(printf,7,8)))
+ _log_limit_msg(struct log_limit *limit, const char *name, int level,
+                const char* filename, int linenum, const char* function,
+                const char *fmt, ...);
+
 /* Log file options */
 #define LOG_WRITE_PER_RUN 1
 #define LOG_APPEND 2
+#define LOG_BINARY 4  // or it into the above: write a binary log, see logger_decode
 #define NO_HOSTNAME 0
 #define WITH_HOSTNAME 1
 
@@ -74,28 +219,499 @@ void __attribute__((nonnull, format(printf,6,7)))
 void log_file_init(char *log_dir_name, 
                    char *symlink_dir,  // where to make the current.log symlink
                    int with_hostname,  // is the hostname in the file name?
-                   int log_strategy);  // LOG_WRITE_PER_RUN, LOG_APPEND
+                   int log_strategy);  // LOG_WRITE_PER_RUN, LOG_APPEND [| LOG_BINARY]
 
 /* Call this when done, it let's you know the name if the logfile. */
 void close_log(void);
 
+/* Roll over to a new log file once the current one has grown past
+ * max_bytes (0: no limit) or every interval_secs seconds, counted from
+ * local midnight (0: never).  Only the newest keep_files files of this
+ * program are kept (0: all).  The symlink follows the new file.  The
+ * switch happens in a background thread; log_file_rotation(0, 0, 0)
+ * stops it.
+ */
+void log_file_rotation(size_t max_bytes, int interval_secs, int keep_files);
+
+/* Buffered output to the log file: use log_print_to_file_buffered as the
+ * output function and messages collect in a buffer of buffer_size bytes.
+ * It is written out when it is full, when a message comes in after
+ * flush_interval_ms (0: never), or after a message of flush_level or
+ * more severe (0: never).  close_log() and log_flush() write it out too.
+ */
+void log_file_buffer(size_t buffer_size, int flush_interval_ms, int flush_level);
+void log_print_to_file_buffered(char *prefix, char *contents);
+
+/* Memory mapped output to the log file: use log_print_to_file_mmap as
+ * the output function and messages are copied straight into a mapped
+ * segment of segment_size bytes at the end of the log file, without a
+ * system call.  A full segment moves the log on to a new file, as
+ * log_file_rotation() does.  0 turns the mapping off again.
+ */
+void log_file_mmap(size_t segment_size);
+void log_print_to_file_mmap(char *prefix, char *contents);
+
+/* Sidecar index: next to each log file written by log_print_to_file
+ * lies name.idx, with an entry for every block of about block_bytes of
+ * messages: where it is, when it was written, its levels and source
+ * files.  bin/logger_query reads only the blocks that can hold what it
+ * looks for.  0 turns the index off again.
+ */
+void log_file_index(size_t block_bytes);
+
+#define LOG_INDEX_MAGIC "LOGIDX1"
+#define LOG_INDEX_MIN_BLOCK 4096
+#define LOG_INDEX_MAX_BLOCK (1U << 30)
+
+struct log_index_header {
+    char magic[8];
+    unsigned entry_size;
+    unsigned block_bytes;
+};
+
+struct log_index_entry {
+    unsigned long long offset;   /* where the block starts in the log file */
+    unsigned long long length;   /* in bytes, it ends with a whole message */
+    unsigned long long count;    /* messages in it */
+    long long first_ns;          /* CLOCK_REALTIME of its first and last write */
+    long long last_ns;
+    unsigned long long levels;   /* log_index_level_bit() of each level in it */
+    unsigned long long files;    /* log_index_file_bits() of each source file */
+};
+
+/* The bit of a level, levels from 63 on share the last one */
+unsigned long long log_index_level_bit(int level);
+
+/* Two bits out of 64 for the file name, without its directory */
+unsigned long long log_index_file_bits(const char *filename);
+
+/* Call entry_func for each entry of the index in fd, until it returns
+ * non zero.  Returns the number of entries read, -1 if fd holds no index. */
+long log_index_read(int fd, int (*entry_func)(const struct log_index_entry *entry));
+
+/* Log file output through io_uring: use log_print_to_file_uring as the
+ * output function and messages collect in 'buffers' buffers of
+ * buffer_size bytes, registered with the kernel.  Full buffers are
+ * submitted as linked writes and the kernel writes them in the
+ * background, in order.  A buffer also goes out after a LOG_ERR message,
+ * or when a message comes in flush_interval_ms after the last write
+ * (0: never), and with close_log() and log_flush().  Returns -1 if
+ * io_uring is not available, messages are then written with write().
+ * 0 turns it off again.
+ */
+#define LOG_URING_FSYNC_ON_ERROR 1  // an fdatasync linked behind LOG_ERR messages
+int log_file_uring(size_t buffer_size, int buffers, int flush_interval_ms, int options);
+void log_print_to_file_uring(char *prefix, char *contents);
+
+/* Compressed output to the log file: use log_print_to_file_compressed as
+ * the output function and messages collect in blocks of block_size
+ * bytes.  A background thread compresses each full block and appends it
+ * to the log file as a frame of its own, so rotation and appending work
+ * as usual and a reader can start at any frame.  A block also goes out
+ * flush_interval_ms after its first message (0: only when full), and
+ * with close_log() and log_flush().  0 turns compression off again.
+ */
+void log_file_compress(size_t block_size, int flush_interval_ms);
+void log_print_to_file_compressed(char *prefix, char *contents);
+
+/* A frame of a compressed log file */
+struct log_compressed_frame {
+    long long offset;       /* where it starts in the file */
+    long long start_ns;     /* CLOCK_REALTIME of its first message */
+    unsigned raw_len;
+    unsigned packed_len;
+};
+
+/* Read a compressed log file from the first frame at or after offset
+ * from, calling frame with the text of each one.  Damaged frames are
+ * skipped.  Returns the number of frames read, -1 if there were none.
+ */
+long log_compressed_read(int fd, long long from,
+                         void (*frame)(const struct log_compressed_frame *info,
+                                       const char *text));
+
+/* Write out everything the logger is holding back: the counts of
+ * suppressed messages, the async queue, the file buffer, the compressed
+ * blocks and the binary log buffers. */
+void log_flush(void);
+
+/* The level of the message currently handed to the output function */
+int log_current_level(void);
+
+/* Size of the per thread buffer messages are rendered into, and of a
+ * slot of the async queue.  Longer messages are formatted on the heap. */
+#ifndef LOG_RECORD_SIZE
+#define LOG_RECORD_SIZE 1024
+#endif
+
+/* Async output options: what to do when the queue is full */
+#define LOG_ASYNC_BLOCK 1        // wait for the consumer to make room
+#define LOG_ASYNC_DROP_NEWEST 2  // throw away the message being logged
+#define LOG_ASYNC_DROP_OLDEST 3  // throw away the oldest queued message
+
+/* Hand log messages to a consumer thread instead of calling the output
+ * function in the logging thread.  The queue holds queue_size messages
+ * (rounded up to a power of two) of at most LOG_RECORD_SIZE bytes each,
+ * longer ones are cut short.  close_log() waits for the queue to drain.
+ */
+void log_async_start(int queue_size, int full_policy);  // LOG_ASYNC_BLOCK, ...
+
+/* Write out whatever is still queued and go back to synchronous output */
+void log_async_stop(void);
+
+/* How many messages the full queue policy has thrown away so far */
+unsigned long log_async_dropped(void);
+
+/* Many processes, one log file: a collector (bin/logger_collector, or
+ * the log_collector_ functions) sets up a shared memory segment called
+ * name, e.g. "/logger".  A process joins it with log_shm_start and
+ * uses log_print_to_shm as the output function; its messages go into a
+ * ring of its own, and the collector writes them all in time order.
+ * Returns -1 if there is no collector or no free ring.  full_policy
+ * is LOG_ASYNC_BLOCK or LOG_ASYNC_DROP_NEWEST. */
+int log_shm_start(const char *name, int full_policy);
+void log_print_to_shm(char *prefix, char *contents);
+
+/* Wait for the collector to take what is left and leave the segment.
+ * No other thread may be logging to it meanwhile. */
+void log_shm_stop(void);
+
+/* How many messages this process threw away because its ring was full */
+unsigned long log_shm_dropped(void);
+
+/* The collector side: create the segment with room for 'rings'
+ * processes, each with 'slots' messages of up to record_size bytes */
+int log_collector_create(const char *name, int rings, int slots, int record_size);
+
+/* Take the messages out of the rings and hand those older than lag_ms
+ * to the output function, oldest first, with the process id in front
+ * of the prefix.  Returns how many went out, -1 without a segment. */
+int log_collector_poll(int lag_ms);
+
+/* Messages the processes threw away so far */
+unsigned long log_collector_dropped(void);
+
+/* Write out everything left and remove the segment */
+void log_collector_destroy(void);
+
+/* Everything known about a DEFINE_LOG_BIN_MSG call site.  The macro
+ * fills in the first five fields, the logger the rest on first use. */
+#define LOG_SITE_MAX_ARGS 16
+
+struct log_site {
+    const char *name;
+    const char *filename;
+    int linenum;
+    const char *function;
+    const char *fmt;
+    unsigned id;          /* how the site is known in binary logs */
+    unsigned generation;  /* the binary log the site was last described in */
+    int arg_count;        /* -1 if fmt can't be logged in binary */
+    unsigned char arg_types[LOG_SITE_MAX_ARGS];
+};
+
+/* Produce the log message defined by the DEFINE_LOG_BIN_MSG macro */
+void __attribute__((nonnull, format(printf,3,4)))
+ _log_bin_msg(struct log_site *site, int level, const char *fmt, ...);
+
+/* Turn a LOG_BINARY log file back into text, calling output (for example
+ * log_default_stdout_func) for every message.  Returns how many messages
+ * were found, or -1 if fd is not a binary log. */
+long log_bin_decode(int fd, void (*output)(char *prefix, char *contents));
+
+/* Every log macro call site leaves one of these in the log_callsites
+ * section, so the sites can be found and switched on or off at run
+ * time, see log_site_set. */
+#define LOG_SITE_DEFAULT 0   // shown if log_set_level shows the level
+#define LOG_SITE_ENABLED 1   // always shown
+#define LOG_SITE_DISABLED 2  // never shown
+
+struct log_callsite {
+    const char *name;
+    const char *filename;
+    const char *function;
+    const char *fmt;
+    int linenum;
+    int level;           /* -1 if it is not a compile time constant */
+    int state;           /* LOG_SITE_DEFAULT, ... */
+    int arg_count;       /* for the flight recorder: 0 until fmt is parsed,
+                            then the argument count + 1, or -1 */
+    unsigned char arg_types[LOG_SITE_MAX_ARGS];
+    const char *prefix;  /* LOG_PREFIX_FMT of the site, rendered on first use */
+    int prefix_len;
+} __attribute__((aligned(8)));
+
+/* Is the message at this call site shown?  The level is passed in as well,
+ * so the usual case is the same bit test as log_level_enabled.  The
+ * answer is worked out without branches, the macro branches once on it. */
+static inline int log_callsite_enabled(const struct log_callsite *site, int level)
+{
+    int state = __atomic_load_n(&site->state, __ATOMIC_RELAXED);
+    return ((state == LOG_SITE_DEFAULT) & log_level_enabled(level)) |
+           (state == LOG_SITE_ENABLED);
+}
+
+/* Non zero while every DEFINE_LOG_MSG call site calls into the logger,
+ * shown or not: the flight recorder (log_flight_start) records those
+ * messages, the stats (log_stats_start) count the filtered ones */
+extern int log_sites_wanted;
+
+/* Is the message at this call site shown, recorded or counted? */
+static inline int log_callsite_wanted(const struct log_callsite *site, int level)
+{
+    return log_callsite_enabled(site, level) |
+           (__atomic_load_n(&log_sites_wanted, __ATOMIC_RELAXED) != 0);
+}
+
+/* Log macros expect to be filtered out: the arguments are evaluated
+ * out of line, after a single branch that is predicted not taken */
+#define LOG_UNLIKELY(x) __builtin_expect(!!(x), 0)
+
+/* Set the state of every call site whose file matches file_glob (the
+ * whole path or the file name), whose function matches function_glob and
+ * whose level is level.  NULL and 0 match anything, levels that are not
+ * compile time constants (const int ones) only match 0.  Returns how many
+ * sites were changed.  Sites loaded later on are not affected. */
+int log_site_set(const char *file_glob, const char *function_glob, int level, int state);
+
+// The same from a string such as "file net/*.c func poll_* level 4 +",
+// ending in + (enable), - (disable) or = (back to default).  Returns
+// how many sites were changed, or -1 if spec is not understood.
+int log_site_control(const char *spec);
+
+/* Hand a line per known call site to output: where it is, its level,
+ * its state (+, - or =) and its format string */
+void log_site_list(void (*output)(char *prefix, char *contents));
+
+/* Called for every executable or shared library with call sites in it */
+void log_sites_add(struct log_callsite *start, struct log_callsite *stop);
+
+/* Produce the log message of a DEFINE_LOG_MSG call site */
+void __attribute__((nonnull, format(printf,3,4)))
+ _log_site_msg(struct log_callsite *site, int level, const char *fmt, ...);
+
+/* Flight recorder options, or them together */
+#define LOG_FLIGHT_DUMP_ON_ERROR 1  // dump before every LOG_ERR message
+#define LOG_FLIGHT_DUMP_ON_CRASH 2  // dump on SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT
+
+/* Record every DEFINE_LOG_MSG message, shown or not, in a ring of
+ * ring_bytes per thread: the site and the raw arguments, formatting
+ * only happens in a dump.  A dump shows the last dump_records records
+ * of every thread.  Crash dumps go straight to the log file with
+ * write(), or to stderr if there is no plain text log file. */
+void log_flight_start(size_t ring_bytes, int dump_records, int options);
+void log_flight_stop(void);
+
+/* Dump the last records of every thread through the output function */
+void log_flight_dump(void);
+
+/* Self-metrics: levels below LOG_STATS_LEVELS are counted apiece, the
+ * ones above share the last counter */
+#define LOG_STATS_LEVELS 16
+
+/* Latencies go into log-linear buckets, 8 for each power of two, so a
+ * bucket is within 12.5% of the values in it */
+#define LOG_LATENCY_BUCKETS 496
+
+struct log_latency {
+    unsigned long long count;
+    unsigned long long total_ns;
+    unsigned long long max_ns;
+    unsigned long long buckets[LOG_LATENCY_BUCKETS];
+};
+
+struct log_stats {
+    unsigned long long emitted[LOG_STATS_LEVELS];   // messages that went out
+    unsigned long long filtered[LOG_STATS_LEVELS];  // with LOG_STATS_FILTERED
+    unsigned long long output_bytes;                // to the output function
+    unsigned long long sink_bytes[LOG_SINKS_MAX];
+    unsigned long async_queued;                     // waiting in the async queue
+    unsigned long async_dropped;
+    unsigned long shm_dropped;
+    struct log_latency message;   // in _log_msg, the output included unless async
+    struct log_latency output;    // in the output function and the sinks
+};
+
+/* Count filtered messages as well.  That makes every DEFINE_LOG_MSG
+ * call site call into the logger, as the flight recorder does. */
+#define LOG_STATS_FILTERED 1
+
+/* Start counting messages, bytes and latencies, in per thread shards.
+ * Stopped, the stats cost one test on the way out of a shown message. */
+void log_stats_start(int options);
+void log_stats_stop(void);
+
+/* Add up the shards of all threads into stats */
+void log_get_stats(struct log_stats *stats);
+
+/* The latency below which percent of the messages stayed, 0 to 100 */
+unsigned long long log_latency_percentile(const struct log_latency *latency, double percent);
+
+/* Hand the stats to output as one message, now or every interval_secs
+ * seconds from a thread of their own (0 stops it) */
+void log_stats_dump(void (*output)(char *prefix, char *contents));
+void log_stats_dump_every(int interval_secs, void (*output)(char *prefix, char *contents));
+
 #if LOGGING_ON /* -DLOGGING=1 was passed to gcc */
 
-/* The general log macro */
+/* The linker puts the call sites of an executable or a shared library
+ * between these two, each of them tells the logger about its own. */
+extern struct log_callsite __start_log_callsites[] __attribute__((weak, visibility("hidden")));
+extern struct log_callsite __stop_log_callsites[] __attribute__((weak, visibility("hidden")));
+
+static void __attribute__((constructor, used)) log_sites_add_this_module(void)
+{
+    log_sites_add(__start_log_callsites, __stop_log_callsites);
+}
+
+/* The static descriptor of a call site, in the log_callsites section.
+ * It is only kept if the call is, so a site whose level is compiled out
+ * leaves nothing behind once the compiler optimises. */
+#define LOG_CALLSITE(site_name, site_level, site_fmt)                         \
+    static struct log_callsite _log_callsite                                   \
+        __attribute__((section("log_callsites"), aligned(8))) =                \
+        { .name = site_name, .filename = __FILE__, .function = __FUNCTION__,   \
+          .fmt = site_fmt, .linenum = __LINE__,                                \
+          .level = __builtin_constant_p(site_level) ? (site_level) : -1,       \
+          .state = LOG_SITE_DEFAULT }
+
+/* Like DEFINE_LOG_MSG, but when the log file is a LOG_BINARY one only the
+ * site id and the raw arguments are written, logger_decode formats them
+ * later.  Otherwise the message is formatted as usual.  msg has to be a
+ * string literal, %m and wide strings always go out as text. */
+#define DEFINE_LOG_BIN_MSG(name, level, msg, ...)                              \
+    do {                                                                       \
+        static struct log_site _log_site =                                     \
+            { name, __FILE__, __LINE__, __FUNCTION__, msg, 0, 0, 0, {0} };     \
+        LOG_CALLSITE(name, level, msg);                                        \
+        if (LOG_UNLIKELY((level) <= LOG_COMPILE_LEVEL &&                       \
+                         log_callsite_enabled(&_log_callsite, level)))         \
+            _log_bin_msg(&_log_site, level, msg, __VA_ARGS__);                 \
+    } while (0);
+
+#if LOG_BINARY_ON /* -DLOG_BINARY_ON=1: every log message is a binary one */
+
+#define DEFINE_LOG_MSG(name, level, msg, ...)                                  \
+    DEFINE_LOG_BIN_MSG(name, level, msg, __VA_ARGS__)
+
+#else
+
+/* The general log macro, filtered levels cost a bit test and one branch */
 #define DEFINE_LOG_MSG(name, level, msg, ...)                                  \
-    _log_msg(name, level, __FILE__, __LINE__, __FUNCTION__, msg, __VA_ARGS__);
+    do {                                                                       \
+        LOG_CALLSITE(name, level, msg);                                        \
+        if (LOG_UNLIKELY((level) <= LOG_COMPILE_LEVEL &&                       \
+                         log_callsite_wanted(&_log_callsite, level)))          \
+            _log_site_msg(&_log_callsite, level, msg, __VA_ARGS__);            \
+    } while (0);
+
+#endif /* LOG_BINARY_ON */
+
+/* A log message with key/value fields made by LOG_KV(...) */
+#define DEFINE_LOG_KV_MSG(name, level, fields, msg, ...)                       \
+    do {                                                                       \
+        LOG_CALLSITE(name, level, msg);                                        \
+        if (LOG_UNLIKELY((level) <= LOG_COMPILE_LEVEL &&                       \
+                         log_callsite_enabled(&_log_callsite, level)))         \
+            _log_kv_msg(name, level, __FILE__, __LINE__, __FUNCTION__,         \
+                        LOG_KV_ARRAY fields, msg, __VA_ARGS__);                \
+    } while (0);
+
+/* Like DEFINE_LOG_MSG, but check is one of
+ *     log_limit_rate, per_second:    at most that many a second
+ *     log_limit_every, n:            the 1st, n+1th, 2n+1th, ...
+ *     log_limit_sample, probability: a random share between 0 and 1
+ * applied to this call site alone.  Suppressed messages are counted
+ * and reported in a summary line. */
+#define DEFINE_LOG_LIMITED_MSG(check, arg, name, level, msg, ...)              \
+    do {                                                                       \
+        LOG_CALLSITE(name, level, msg);                                        \
+        static struct log_limit _log_limit = { .site = &_log_callsite };       \
+        if (LOG_UNLIKELY((level) <= LOG_COMPILE_LEVEL &&                       \
+                         log_callsite_enabled(&_log_callsite, level)) &&       \
+            check(&_log_limit, arg))                                           \
+            _log_limit_msg(&_log_limit, name, level, __FILE__, __LINE__,       \
+                           __FUNCTION__, msg, __VA_ARGS__);                    \
+    } while (0);
+
+#define DEFINE_LOG_RATE_MSG(name, level, per_second, msg, ...)                 \
+    DEFINE_LOG_LIMITED_MSG(log_limit_rate, per_second, name, level, msg, __VA_ARGS__)
+#define DEFINE_LOG_EVERY_N_MSG(name, level, n, msg, ...)                       \
+    DEFINE_LOG_LIMITED_MSG(log_limit_every, n, name, level, msg, __VA_ARGS__)
+#define DEFINE_LOG_SAMPLE_MSG(name, level, probability, msg, ...)              \
+    DEFINE_LOG_LIMITED_MSG(log_limit_sample, probability, name, level, msg, __VA_ARGS__)
 
-/* Convenience functions corresponding to the provided log levels */
-#define LOG_ERROR_MSG(msg, ...)   DEFINE_LOG_MSG("ERROR",LOG_ERR, msg, __VA_ARGS__);
-#define LOG_WARNING_MSG(msg, ...) DEFINE_LOG_MSG("WARN",LOG_WARN, msg, __VA_ARGS__);
-#define LOG_NOTICE_MSG(msg, ...)  DEFINE_LOG_MSG("NOTICE",LOG_NOTICE, msg, __VA_ARGS__);
-#define LOG_INFO_MSG(msg, ...)    DEFINE_LOG_MSG("INFO",LOG_INFO, msg, __VA_ARGS__);
-#define LOG_DEBUG_MSG(msg, ...)   DEFINE_LOG_MSG("DEBUG",LOG_DEBUG, msg, __VA_ARGS__);
-#define LOG_TODO_MSG(msg, ...)    DEFINE_LOG_MSG("TODO",LOG_TODO, msg, __VA_ARGS__);
+/* Convenience functions corresponding to the provided log levels,
+ * the ones above LOG_COMPILE_LEVEL compile to nothing */
+#if LOG_COMPILE_LEVEL >= LOG_ERR
+#define LOG_ERROR_MSG(msg, ...)       DEFINE_LOG_MSG("ERROR",LOG_ERR, msg, __VA_ARGS__);
+#define LOG_ERROR_BIN_MSG(msg, ...)   DEFINE_LOG_BIN_MSG("ERROR",LOG_ERR, msg, __VA_ARGS__);
+#define LOG_ERROR_KV_MSG(f, msg, ...) DEFINE_LOG_KV_MSG("ERROR",LOG_ERR, f, msg, __VA_ARGS__);
+#else
+#define LOG_ERROR_MSG(msg, ...)
+#define LOG_ERROR_BIN_MSG(msg, ...)
+#define LOG_ERROR_KV_MSG(f, msg, ...)
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_WARN
+#define LOG_WARNING_MSG(msg, ...)     DEFINE_LOG_MSG("WARN",LOG_WARN, msg, __VA_ARGS__);
+#define LOG_WARNING_BIN_MSG(msg, ...) DEFINE_LOG_BIN_MSG("WARN",LOG_WARN, msg, __VA_ARGS__);
+#define LOG_WARNING_KV_MSG(f, msg, ...)DEFINE_LOG_KV_MSG("WARN",LOG_WARN, f, msg, __VA_ARGS__);
+#else
+#define LOG_WARNING_MSG(msg, ...)
+#define LOG_WARNING_BIN_MSG(msg, ...)
+#define LOG_WARNING_KV_MSG(f, msg, ...)
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_NOTICE
+#define LOG_NOTICE_MSG(msg, ...)      DEFINE_LOG_MSG("NOTICE",LOG_NOTICE, msg, __VA_ARGS__);
+#define LOG_NOTICE_BIN_MSG(msg, ...)  DEFINE_LOG_BIN_MSG("NOTICE",LOG_NOTICE, msg, __VA_ARGS__);
+#define LOG_NOTICE_KV_MSG(f, msg, ...)DEFINE_LOG_KV_MSG("NOTICE",LOG_NOTICE, f, msg, __VA_ARGS__);
+#else
+#define LOG_NOTICE_MSG(msg, ...)
+#define LOG_NOTICE_BIN_MSG(msg, ...)
+#define LOG_NOTICE_KV_MSG(f, msg, ...)
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_DEBUG
+#define LOG_DEBUG_MSG(msg, ...)       DEFINE_LOG_MSG("DEBUG",LOG_DEBUG, msg, __VA_ARGS__);
+#define LOG_DEBUG_BIN_MSG(msg, ...)   DEFINE_LOG_BIN_MSG("DEBUG",LOG_DEBUG, msg, __VA_ARGS__);
+#define LOG_DEBUG_KV_MSG(f, msg, ...) DEFINE_LOG_KV_MSG("DEBUG",LOG_DEBUG, f, msg, __VA_ARGS__);
+#else
+#define LOG_DEBUG_MSG(msg, ...)
+#define LOG_DEBUG_BIN_MSG(msg, ...)
+#define LOG_DEBUG_KV_MSG(f, msg, ...)
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_INFO
+#define LOG_INFO_MSG(msg, ...)        DEFINE_LOG_MSG("INFO",LOG_INFO, msg, __VA_ARGS__);
+#define LOG_INFO_BIN_MSG(msg, ...)    DEFINE_LOG_BIN_MSG("INFO",LOG_INFO, msg, __VA_ARGS__);
+#define LOG_INFO_KV_MSG(f, msg, ...)  DEFINE_LOG_KV_MSG("INFO",LOG_INFO, f, msg, __VA_ARGS__);
+#else
+#define LOG_INFO_MSG(msg, ...)
+#define LOG_INFO_BIN_MSG(msg, ...)
+#define LOG_INFO_KV_MSG(f, msg, ...)
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_TODO
+#define LOG_TODO_MSG(msg, ...)        DEFINE_LOG_MSG("TODO",LOG_TODO, msg, __VA_ARGS__);
+#define LOG_TODO_BIN_MSG(msg, ...)    DEFINE_LOG_BIN_MSG("TODO",LOG_TODO, msg, __VA_ARGS__);
+#define LOG_TODO_KV_MSG(f, msg, ...)  DEFINE_LOG_KV_MSG("TODO",LOG_TODO, f, msg, __VA_ARGS__);
+#else
+#define LOG_TODO_MSG(msg, ...)
+#define LOG_TODO_BIN_MSG(msg, ...)
+#define LOG_TODO_KV_MSG(f, msg, ...)
+#endif
 
 #else
 
 #define DEFINE_LOG_MSG(name, level, msg, ...) 
+#define DEFINE_LOG_BIN_MSG(name, level, msg, ...)
+#define DEFINE_LOG_KV_MSG(name, level, fields, msg, ...)
+#define DEFINE_LOG_LIMITED_MSG(check, arg, name, level, msg, ...)
+#define DEFINE_LOG_RATE_MSG(name, level, per_second, msg, ...)
+#define DEFINE_LOG_EVERY_N_MSG(name, level, n, msg, ...)
+#define DEFINE_LOG_SAMPLE_MSG(name, level, probability, msg, ...)
 
 #define LOG_ERROR_MSG(msg, ...)   
 #define LOG_WARNING_MSG(msg, ...) 
@@ -103,5 +719,19 @@ void close_log(void);
 #define LOG_INFO_MSG(msg, ...)    
 #define LOG_DEBUG_MSG(msg, ...)   
 #define LOG_TODO_MSG(msg, ...)
+
+#define LOG_ERROR_BIN_MSG(msg, ...)
+#define LOG_WARNING_BIN_MSG(msg, ...)
+#define LOG_NOTICE_BIN_MSG(msg, ...)
+#define LOG_INFO_BIN_MSG(msg, ...)
+#define LOG_DEBUG_BIN_MSG(msg, ...)
+#define LOG_TODO_BIN_MSG(msg, ...)
+
+#define LOG_ERROR_KV_MSG(f, msg, ...)
+#define LOG_WARNING_KV_MSG(f, msg, ...)
+#define LOG_NOTICE_KV_MSG(f, msg, ...)
+#define LOG_INFO_KV_MSG(f, msg, ...)
+#define LOG_DEBUG_KV_MSG(f, msg, ...)
+#define LOG_TODO_KV_MSG(f, msg, ...)
 #endif /* LOGGGIN_ON */
 #endif /* LOGGING_ON_H */
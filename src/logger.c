@@ -16,10 +16,15 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <pthread.h>   //  config and file mutexes
 #include <stdarg.h>    //  va_args
-#include <stdio.h>     //  asprinf,vasprintf
+#include <stdio.h>     //  asprinf,vasprintf,snprintf
 #include <malloc.h>    //  free
+#include <string.h>    //  memcpy
+#include <time.h>      //  clock_gettime, localtime_r
+#include <unistd.h>    //  STDOUT_FILENO
 #include "logger.h"
+#include "logger_internal.h"
 
 /* The currently selected log level */
 int log_level_currently = 0;
@@ -33,77 +38,468 @@ int *log_level_selection;
 /* Size of the selection array */
 int log_level_selection_size = 0;
 
+unsigned long long log_level_bitmap[LOG_LEVEL_BITMAP_BITS / 64];
+
+/* Serialises changes to the display option.  Logging threads only read
+ * the bitmap, which is updated a word at a time with atomic stores. */
+static pthread_mutex_t log_config_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int log_level_shown_locked(int level);
+
+/* What the display option shows, for the main output function only */
+static unsigned long long log_main_bitmap[LOG_LEVEL_BITMAP_BITS / 64];
+
+/* Work out the bitmaps for the current display option and the sinks */
+static void log_level_bitmap_rebuild(void)
+{
+    unsigned long long bitmap[LOG_LEVEL_BITMAP_BITS / 64] = { 0 };
+
+    for (int level = 0; level < LOG_LEVEL_BITMAP_BITS; level++)
+        if (log_level_shown_locked(level))
+            bitmap[level / 64] |= 1ULL << (level % 64);
+    for (int i = 0; i < LOG_LEVEL_BITMAP_BITS / 64; i++)
+        __atomic_store_n(&log_main_bitmap[i], bitmap[i], __ATOMIC_RELAXED);
+    log_sinks_union(bitmap);
+    for (int i = 0; i < LOG_LEVEL_BITMAP_BITS / 64; i++)
+        __atomic_store_n(&log_level_bitmap[i], bitmap[i], __ATOMIC_RELAXED);
+}
+
+void log_level_bitmap_update(void)
+{
+    pthread_mutex_lock(&log_config_mutex);
+    log_level_bitmap_rebuild();
+    pthread_mutex_unlock(&log_config_mutex);
+}
+
 void log_set_level(int scope, int level)
 {
+    pthread_mutex_lock(&log_config_mutex);
     log_level_currently = level;
     log_level_scope = scope;
+    log_level_bitmap_rebuild();
+    pthread_mutex_unlock(&log_config_mutex);
 }
 
 void log_default_stdout_func(char *prefix, char *contents)
 {
-    printf("%s %s\n", prefix, contents);
+    log_print_terminal(STDOUT_FILENO, prefix, contents);
 }
 
 void (*log_output_ptr)(char* prefix, char* contents) = &log_default_stdout_func;
 
 void log_set_output_function(void (*function_ptr)(char* prefix, char* contents))
 {
-    log_output_ptr = function_ptr;
+    __atomic_store_n(&log_output_ptr, function_ptr, __ATOMIC_RELEASE);
 }
 
 void log_set_level_selection(int selection[], int size)
 {
+    pthread_mutex_lock(&log_config_mutex);
     log_level_selection = selection;
     log_level_selection_size = size;
+    log_level_bitmap_rebuild();
+    pthread_mutex_unlock(&log_config_mutex);
 }
 
-void __attribute__((nonnull, format(printf,6,7)))
-_log_msg(const char *name, int level, const char* filename, int linenum, 
-              const char* function, char *fmt, ...) 
+__thread int log_output_level = 0;
+
+int log_current_level(void)
+{
+    return log_output_level;
+}
+
+/* Does the display option show this level to the main output function? */
+static int log_main_shows(int level)
+{
+    if ((unsigned)level < LOG_LEVEL_BITMAP_BITS)
+        return (__atomic_load_n(&log_main_bitmap[(unsigned)level / 64], __ATOMIC_RELAXED)
+                >> ((unsigned)level % 64)) & 1;
+    pthread_mutex_lock(&log_config_mutex);
+    int shown = log_level_shown_locked(level);
+    pthread_mutex_unlock(&log_config_mutex);
+    return shown;
+}
+
+void log_output(int level, char *prefix, char *contents)
+{
+    int outer = log_output_level;
+    log_output_level = level;
+
+    unsigned long long start = 0;
+    size_t bytes = 0;
+    if (LOG_UNLIKELY(__atomic_load_n(&log_stats_active, __ATOMIC_RELAXED))) {
+        start = log_stats_clock();
+        bytes = (prefix ? strlen(prefix) : 0) + (contents ? strlen(contents) : 0) + 2;
+    }
+
+    /* what no sink takes, a call site switched on by hand for example,
+     * goes to the main output function */
+    if (!log_sinks_deliver(level, prefix, contents, bytes) || log_main_shows(level)) {
+        __atomic_load_n(&log_output_ptr, __ATOMIC_ACQUIRE)(prefix, contents);
+        if (bytes)
+            log_stats_wrote(0, bytes);
+    }
+    if (start)
+        log_stats_output(log_stats_clock() - start);
+    log_output_level = outer;
+}
+
+void log_deliver(int level, char *prefix, char *contents)
+{
+    if (level == LOG_ERR && __atomic_load_n(&log_flight_active, __ATOMIC_RELAXED))
+        log_flight_error();
+
+    if (__atomic_load_n(&log_async_running, __ATOMIC_ACQUIRE))
+        log_async_push(level, prefix, contents);
+    else
+        log_output(level, prefix, contents);
+}
+
+/* The prefix may use up to half of the record buffer */
+#define LOG_PREFIX_MAX (LOG_RECORD_SIZE / 2)
+
+/* Per thread buffer every message is rendered into, so the usual path
+ * through _log_msg does not allocate.  It is busy while the output
+ * function runs, messages logged from in there use the heap instead. */
+static __thread char log_record[LOG_RECORD_SIZE];
+static __thread int log_record_in_use = 0;
+
+/****  timestamps ****/
+
+int log_timestamp_options = LOG_TIMESTAMP_NONE;
+
+/* The date and time up to the second, rendered when the second changes.
+ * Text prefixes and JSON records each have their own. */
+struct log_clock_cache {
+    time_t second;
+    int len;
+    char text[40];
+    int zone_len;
+    char zone[8];    /* +0200, for JSON */
+};
+
+static __thread struct log_clock_cache log_text_clock = { -1, 0, "", 0, "" };
+static __thread struct log_clock_cache log_json_clock = { -1, 0, "", 0, "" };
+
+void log_set_timestamp(int options)
+{
+    __atomic_store_n(&log_timestamp_options, options, __ATOMIC_RELAXED);
+}
+
+/* Write 'n' as exactly 'digits' decimal digits */
+static char *log_put_digits(char *p, unsigned long n, int digits)
+{
+    for (int i = digits - 1; i >= 0; i--) {
+        p[i] = '0' + n % 10;
+        n /= 10;
+    }
+    return p + digits;
+}
+
+/* Write 'n' with as many digits as it takes */
+static char *log_put_number(char *p, unsigned long n)
+{
+    int digits = 1;
+    for (unsigned long rest = n / 10; rest; rest /= 10)
+        digits++;
+    return log_put_digits(p, n, digits);
+}
+
+char *log_put_wall(char *p, const struct timespec *ts, int json)
+{
+    struct log_clock_cache *cache = json ? &log_json_clock : &log_text_clock;
+
+    if (ts->tv_sec != cache->second) {
+        struct tm tm_tmp;
+        cache->len = cache->zone_len = 0;
+        if (localtime_r(&ts->tv_sec, &tm_tmp)) {
+            cache->len = strftime(cache->text, sizeof(cache->text),
+                                  json ? "%Y-%m-%dT%H:%M:%S" : "%Y-%m-%d %H:%M:%S",
+                                  &tm_tmp);
+            if (json)
+                cache->zone_len = strftime(cache->zone, sizeof(cache->zone), "%z", &tm_tmp);
+        }
+        cache->second = ts->tv_sec;
+    }
+    memcpy(p, cache->text, cache->len);
+    p += cache->len;
+    *p++ = '.';
+    p = log_put_digits(p, ts->tv_nsec / 1000, 6);
+    memcpy(p, cache->zone, cache->zone_len);
+    return p + cache->zone_len;
+}
+
+char *log_put_seconds(char *p, const struct timespec *ts)
+{
+    p = log_put_number(p, ts->tv_sec);
+    *p++ = '.';
+    return log_put_digits(p, ts->tv_nsec / 1000, 6);
+}
+
+int log_timestamp(char *out, size_t room)
+{
+    int options = __atomic_load_n(&log_timestamp_options, __ATOMIC_RELAXED);
+    char buf[80], *p = buf;
+    struct timespec ts;
+
+    if (!options || !room)
+        return 0;
+
+    if (options & LOG_TIMESTAMP_WALL) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        p = log_put_wall(p, &ts, 0);
+        *p++ = ' ';
+    }
+    if (options & LOG_TIMESTAMP_MONOTONIC) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        p = log_put_seconds(p, &ts);
+        *p++ = ' ';
+    }
+
+    size_t len = p - buf;
+    if (len >= room)
+        len = room - 1;
+    memcpy(out, buf, len);
+    out[len] = '\0';
+    return len;
+}
 
+int log_filter_shows(int scope, int current, const int *selection, int selection_size,
+                     int level)
 {
-    switch (log_level_scope) {
-        case(SHOW_NOTHING): return;
+    switch (scope) {
+        case(SHOW_NOTHING): return 0;
         case(SHOW_LOG_LEVEL_INCLUDING): {
-            if (level > log_level_currently)
-                return;
+            if (level > current)
+                return 0;
             break;
         }
         case(SHOW_EXACT_LOG_LEVEL): {
-            if (level != log_level_currently)
-                return;
+            if (level != current)
+                return 0;
             break;
         }
         default: { /* SHOW_SELECT_LOG_LEVELS */
             int ok = 0;
-            for (int i = 0; i < log_level_selection_size; i++) {
-                if (level > log_level_currently)
+            for (int i = 0; i < selection_size; i++) {
+                if (level > current)
                     break;
-                if (level == log_level_selection[i]) {
+                if (level == selection[i]) {
                     ok = 1;
                     break;
                 }
             }
             if (!ok) {
-                return;
+                return 0;
             }
         }
     }
+    return 1;
+}
 
-    char *prefix, *contents;
-    va_list argp;
+/* Called with log_config_mutex held */
+static int log_level_shown_locked(int level)
+{
+    return log_filter_shows(log_level_scope, log_level_currently, log_level_selection,
+                            log_level_selection_size, level);
+}
+
+int log_level_shown(int level)
+{
+    pthread_mutex_lock(&log_config_mutex);
+    int shown = log_level_shown_locked(level);
+    pthread_mutex_unlock(&log_config_mutex);
+    return shown || log_sinks_show(level);
+}
+
+/* Put the fields behind the message in 'contents', which has room for
+ * 'room' bytes, or else in a bigger copy on the heap that replaces
+ * *spill.  Returns where the contents are now. */
+static char *log_add_fields(char *contents, size_t room, char **spill,
+                            const struct log_kv *fields, int field_count)
+{
+    size_t len = strlen(contents);
+    size_t need = log_kv_text(contents + len, room > len ? room - len : 0,
+                              fields, field_count);
+
+    if (len + need < room)
+        return contents;
+    char *bigger = malloc(len + need + 1);
+    if (!bigger)
+        return contents;   /* cut short */
+    memcpy(bigger, contents, len);
+    log_kv_text(bigger + len, need + 1, fields, field_count);
+    free(*spill);
+    *spill = bigger;
+    return bigger;
+}
+
+/* Render a JSON record into record, of LOG_RECORD_SIZE bytes, and
+ * deliver it.  The message is formatted into the back half, or onto the
+ * heap if it is longer. */
+static void log_json_deliver(char *record, const char *name, int level,
+                             const char *filename, int linenum, const char *function,
+                             const struct log_kv *fields, int field_count,
+                             const char *fmt, va_list argp)
+{
+    va_list again;
+    char *message = record + LOG_PREFIX_MAX, *spill = NULL, *rendered = record;
+    int room = LOG_RECORD_SIZE - LOG_PREFIX_MAX;
+
+    va_copy(again, argp);
+    int len = vsnprintf(message, room, fmt, argp);
+    if (len < 0)
+        message[0] = '\0';
+    else if (len >= room) {
+        /* truncated if that fails */
+        if (-1 != vasprintf(&spill, fmt, again))
+            message = spill;
+        else
+            spill = NULL;
+    }
+    va_end(again);
+
+    char *contents = log_json_render(&rendered, LOG_RECORD_SIZE, name, level, filename,
+                                     linenum, function, message, fields, field_count);
+    log_deliver(level, rendered, contents);
+    if (rendered != record)
+        free(rendered);
+    free(spill);
+}
+
+static void log_vmsg_body(const char *name, int level, const char* filename, int linenum,
+                          const char* function, struct log_callsite *site,
+                          const struct log_kv *fields, int field_count,
+                          const char *fmt, va_list argp)
+{
+    va_list again;
+    int json = __atomic_load_n(&log_output_format, __ATOMIC_RELAXED) == LOG_FORMAT_JSON;
 
-    if (-1 == asprintf(&prefix, "%-10s %s:%d %s() \n          ", 
-                       name, filename, linenum, function))
-        prefix = NULL;
+    if (log_record_in_use) {  /* an output function is logging itself */
+        char *prefix, *contents, stamp[80];
 
+        if (json) {
+            char *record = malloc(LOG_RECORD_SIZE);
+            if (!record)
+                return;
+            log_json_deliver(record, name, level, filename, linenum, function,
+                             fields, field_count, fmt, argp);
+            free(record);
+            return;
+        }
+
+        log_timestamp(stamp, sizeof(stamp));
+        if (-1 == asprintf(&prefix, "%s" LOG_PREFIX_FMT, stamp, name, filename, linenum, function))
+            prefix = NULL;
+
+        if (-1 == vasprintf(&contents, fmt, argp))
+            contents = NULL;
+        if (contents && field_count > 0)
+            log_add_fields(contents, strlen(contents) + 1, &contents, fields, field_count);
+        log_deliver(level, prefix, contents);
+        free(prefix);
+        free(contents);
+        return;
+    }
+    log_record_in_use = 1;
+
+    if (json) {
+        log_json_deliver(log_record, name, level, filename, linenum, function,
+                         fields, field_count, fmt, argp);
+        log_record_in_use = 0;
+        return;
+    }
+
+    char *prefix = log_record, *contents, *spill = NULL;
+    int stamp_len = log_timestamp(prefix, LOG_PREFIX_MAX);
+    int prefix_len;
+    /* a call site renders its prefix once, then it is copied */
+    const char *site_prefix = site ? log_site_prefix(site, &prefix_len) : NULL;
+    if (site_prefix && stamp_len + prefix_len < LOG_PREFIX_MAX)
+        memcpy(prefix + stamp_len, site_prefix, prefix_len + 1);
+    else
+        prefix_len = snprintf(prefix + stamp_len, LOG_PREFIX_MAX - stamp_len, LOG_PREFIX_FMT,
+                              name, filename, linenum, function);
+    if (prefix_len < 0) {
+        prefix[stamp_len] = '\0';
+        prefix_len = 0;
+    }
+    prefix_len += stamp_len;
+    if (prefix_len >= LOG_PREFIX_MAX) {
+        prefix_len = LOG_PREFIX_MAX - 1;
+    }
+
+    contents = prefix + prefix_len + 1;
+    int room = LOG_RECORD_SIZE - prefix_len - 1;
+
+    va_copy(again, argp);
+    int contents_len = vsnprintf(contents, room, fmt, argp);
+
+    if (contents_len < 0) {
+        contents[0] = '\0';
+    }
+    else if (contents_len >= room) {
+        /* doesn't fit, this one goes on the heap (truncated if that fails) */
+        if (-1 != vasprintf(&spill, fmt, again))
+            contents = spill;
+        else
+            spill = NULL;
+    }
+    va_end(again);
+    if (field_count > 0)
+        contents = log_add_fields(contents, spill ? (size_t)contents_len + 1 : (size_t)room,
+                                  &spill, fields, field_count);
+    log_deliver(level, prefix, contents);
+    free(spill);
+    log_record_in_use = 0;
+}
+
+void log_vmsg(const char *name, int level, const char* filename, int linenum,
+              const char* function, struct log_callsite *site,
+              const struct log_kv *fields, int field_count,
+              const char *fmt, va_list argp)
+{
+    const char *outer = log_output_file;
+    log_output_file = filename;
+    if (LOG_UNLIKELY(__atomic_load_n(&log_stats_active, __ATOMIC_RELAXED))) {
+        unsigned long long start = log_stats_clock();
+        log_vmsg_body(name, level, filename, linenum, function, site, fields, field_count,
+                      fmt, argp);
+        log_stats_message(level, log_stats_clock() - start);
+    }
+    else
+        log_vmsg_body(name, level, filename, linenum, function, site, fields, field_count,
+                      fmt, argp);
+    log_output_file = outer;
+}
+
+void __attribute__((nonnull, format(printf,6,7)))
+_log_msg(const char *name, int level, const char* filename, int linenum, 
+              const char* function, char *fmt, ...) 
+
+{
+    if (!log_level_enabled(level)) {
+        if (__atomic_load_n(&log_stats_filtering, __ATOMIC_RELAXED))
+            log_stats_filtered(level);
+        return;
+    }
+
+    va_list argp;
     va_start(argp, fmt); 
-    if (-1 == vasprintf(&contents, fmt, argp))
-        contents = NULL;
+    log_vmsg(name, level, filename, linenum, function, NULL, NULL, 0, fmt, argp);
     va_end(argp); 
-    log_output_ptr(prefix, contents);
-    free(prefix);
-    free(contents);
+}
+
+void __attribute__((nonnull, format(printf,8,9)))
+_log_kv_msg(const char *name, int level, const char* filename, int linenum,
+            const char* function, const struct log_kv *fields, int field_count,
+            const char *fmt, ...)
+{
+    /* the macro checked the level and the call site */
+    va_list argp;
+    va_start(argp, fmt);
+    log_vmsg(name, level, filename, linenum, function, NULL, fields, field_count, fmt, argp);
+    va_end(argp);
 }
 
 // TODO:  add file service for windows
@@ -115,6 +511,8 @@ _log_msg(const char *name, int level, const char* filename, int linenum,
 #define _XOPEN_SOURCE 700
 #include <assert.h>    // assert in log_msg()
 #include <libgen.h>    // 'basename'
+#include <ctype.h>     // isdigit
+#include <errno.h>
 #include <stdarg.h>    //  va_args
 #include <stdio.h>
 #include <stdlib.h>    // abort() and basename
@@ -123,6 +521,7 @@ _log_msg(const char *name, int level, const char* filename, int linenum,
 #include <unistd.h>    //  for unlink
 #include <dirent.h>    // dir operations
 #include <sys/stat.h>  // req for lstat
+#include <sys/uio.h>   // writev
 #include <fcntl.h>     // needed for file ops
 
 // fix function name
@@ -137,13 +536,310 @@ char logging_dir[filename_len];
 char log_symlink[filename_len];
 
 int log_file_initialised = 0;
+static int log_file_with_hostname = NO_HOSTNAME;
+
+/* log_file_init, close_log and the rotation take turns, logging
+ * threads don't lock */
+static pthread_mutex_t log_file_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Rotation settings, see log_file_rotation() */
+static size_t log_rotate_max_bytes = 0;
+static int log_rotate_interval = 0;
+static int log_rotate_keep = 0;
+
+/* Bytes in the current file, and whether the rotation thread is due */
+static size_t log_file_bytes = 0;
+static int log_rotate_pending = 0;
+
+static int log_rotate_running = 0;
+static int log_rotate_stopping = 0;
+static time_t log_rotate_due = 0;
+static pthread_t log_rotate_thread;
+static pthread_mutex_t log_rotate_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_rotate_cond = PTHREAD_COND_INITIALIZER;
+
+/* Wake the rotation thread, once per file */
+static void log_rotate_request(void)
+{
+    if (__atomic_exchange_n(&log_rotate_pending, 1, __ATOMIC_ACQ_REL))
+        return;
+    pthread_mutex_lock(&log_rotate_mutex);
+    pthread_cond_signal(&log_rotate_cond);
+    pthread_mutex_unlock(&log_rotate_mutex);
+}
 
-void close_log(void) 
+void log_file_wrote(long bytes)
+{
+    size_t max_bytes = __atomic_load_n(&log_rotate_max_bytes, __ATOMIC_RELAXED);
+
+    if (!max_bytes || bytes <= 0)
+        return;
+    if (__atomic_add_fetch(&log_file_bytes, bytes, __ATOMIC_RELAXED) >= max_bytes)
+        log_rotate_request();
+}
+
+/* "progname.hostname." or "progname.", the start of our file names */
+static void log_file_stem(char *stem, size_t len)
+{
+    char hostname_buf[80];
+    char* progname = getenv("_") ? basename(getenv("_")) : "log";
+
+    if (log_file_with_hostname == WITH_HOSTNAME) {
+        gethostname(hostname_buf, sizeof(hostname_buf));
+        hostname_buf[sizeof(hostname_buf) - 1] = '\0';
+        snprintf(stem, len, "%s.%s.", progname, hostname_buf);
+    }
+    else {
+        snprintf(stem, len, "%s.", progname);
+    }
+}
+
+/* Files made in the same second get .1, .2, ... up to this */
+#define LOG_FILE_MAX_SEQ 10000
+
+/* Create a new file in logging_dir, named after the program, host and
+ * time.  Files made in the same second get .1, .2, ... on the end.
+ * Returns -1 with errno set if that fails, ENAMETOOLONG if the name
+ * doesn't fit into filename_len. */
+static int log_file_create(char *name)
+{
+    char stem[filename_len];
+    char time_buf[16];
+    struct tm tm_tmp;
+    time_t t = time(NULL);
+
+    if (NULL == localtime_r(&t, &tm_tmp)) 
+        abort();
+    strftime(time_buf, sizeof(time_buf), "%Y%m%d-%H%M%S", &tm_tmp);
+    log_file_stem(stem, sizeof(stem));
+
+    for (int seq = 0; seq <= LOG_FILE_MAX_SEQ; seq++) {
+        int len;
+        if (seq == 0)
+            len = snprintf(name, filename_len, "%s%s%s", logging_dir, stem, time_buf);
+        else
+            len = snprintf(name, filename_len, "%s%s%s.%d", logging_dir, stem, time_buf, seq);
+        if (len < 0 || len >= filename_len) {
+            /* cut short, every seq would give the same name */
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        int fd = open(name, 
+                      O_CREAT | O_EXCL | O_WRONLY | O_APPEND, 
+                      S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (fd != -1 || errno != EEXIST)
+            return fd;
+    }
+    return -1;   /* errno is EEXIST */
+}
+
+/* Point the symlink at log_filename.  The new link is renamed over the
+ * old one, so the symlink never goes missing. */
+static void log_file_link(void)
+{
+    char tmp_link[filename_len + 8];
+
+    snprintf(tmp_link, sizeof(tmp_link), "%s.tmp", log_symlink);
+    unlink(tmp_link);
+    if (symlink(log_filename, tmp_link) == 0 && rename(tmp_link, log_symlink) != 0)
+        unlink(tmp_link);
+}
+
+static char log_prune_stem[filename_len];
+
+/* scandir filter: stem, then %Y%m%d-%H%M%S and maybe .N */
+static int log_file_is_ours(const struct dirent *entry)
+{
+    const char *p = entry->d_name;
+    size_t stem_len = strlen(log_prune_stem);
+
+    if (strncmp(p, log_prune_stem, stem_len))
+        return 0;
+    p += stem_len;
+    for (int i = 0; i < 15; i++, p++)
+        if (i == 8 ? *p != '-' : !isdigit((unsigned char)*p))
+            return 0;
+    if (*p == '.') {
+        if (!isdigit((unsigned char)*++p))
+            return 0;
+        while (isdigit((unsigned char)*p))
+            p++;
+    }
+    return *p == '\0';
+}
+
+/* Delete all but the newest log_rotate_keep files, under log_file_mutex */
+static void log_file_prune(void)
+{
+    int keep = __atomic_load_n(&log_rotate_keep, __ATOMIC_RELAXED);
+    struct dirent **names;
+    char path[2 * filename_len];
+
+    if (keep <= 0)
+        return;
+    log_file_stem(log_prune_stem, sizeof(log_prune_stem));
+    /* versionsort puts name.1 before name.10 */
+    int count = scandir(logging_dir, &names, log_file_is_ours, versionsort);
+    if (count < 0)
+        return;
+    for (int i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s%s", logging_dir, names[i]->d_name);
+        if (i < count - keep && strcmp(path, log_filename)) {
+            unlink(path);
+            strncat(path, ".idx", sizeof(path) - strlen(path) - 1);
+            unlink(path);   /* its index, if it has one */
+        }
+        free(names[i]);
+    }
+    free(names);
+}
+
+/* Switch to a new file, under log_file_mutex.  Threads keep writing to
+ * log_file_fd while the new file is dup2()ed onto it, the old file is
+ * closed by that. */
+static int log_file_next_locked(void)
+{
+    char name[filename_len];
+    int fd = log_file_create(name);
+
+    if (fd == -1) {
+        fprintf(stderr, "Couldn't rotate the log file to %s\n", name);
+        return -1;
+    }
+    if (log_bin_is_active()) {
+        log_bin_rotate(fd);
+    }
+    else {
+        log_buffer_flush();
+        log_uring_flush();
+        log_compress_flush();
+        log_index_close();
+        dup2(fd, log_file_fd);
+        log_index_open(name, log_file_fd);
+    }
+    close(fd);
+    memcpy(log_filename, name, sizeof(log_filename));
+    log_file_link();
+    log_file_prune();
+    return 0;
+}
+
+static void log_file_rotate(void)
+{
+    if (log_mmap_is_active()) {
+        /* the mapping moves on to a segment in the next file */
+        log_mmap_roll();
+    }
+    else {
+        pthread_mutex_lock(&log_file_mutex);
+        if (log_file_initialised)
+            log_file_next_locked();
+        pthread_mutex_unlock(&log_file_mutex);
+    }
+    __atomic_store_n(&log_file_bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&log_rotate_pending, 0, __ATOMIC_RELEASE);
+}
+
+int log_file_reopen(int next)
+{
+    int fd = -1;
+
+    pthread_mutex_lock(&log_file_mutex);
+    if (log_file_initialised && (!next || log_file_next_locked() == 0))
+        fd = open(log_filename, O_RDWR);
+    pthread_mutex_unlock(&log_file_mutex);
+    return fd;
+}
+
+/* The next multiple of log_rotate_interval, counted from local midnight */
+static time_t log_rotate_next(time_t now)
+{
+    struct tm tm_tmp;
+    long local = now;
+
+    if (localtime_r(&now, &tm_tmp))
+        local += tm_tmp.tm_gmtoff;
+    return now - local % log_rotate_interval + log_rotate_interval;
+}
+
+static void *log_rotate_main(void *unused)
+{
+    (void)unused;
+    pthread_mutex_lock(&log_rotate_mutex);
+    while (!log_rotate_stopping) {
+        if (log_rotate_interval > 0 && time(NULL) >= log_rotate_due)
+            __atomic_store_n(&log_rotate_pending, 1, __ATOMIC_RELEASE);
+
+        if (__atomic_load_n(&log_rotate_pending, __ATOMIC_ACQUIRE)) {
+            pthread_mutex_unlock(&log_rotate_mutex);
+            log_file_rotate();
+            pthread_mutex_lock(&log_rotate_mutex);
+            if (log_rotate_interval > 0)
+                log_rotate_due = log_rotate_next(time(NULL));
+        }
+        else if (log_rotate_interval > 0) {
+            struct timespec until = { log_rotate_due, 0 };
+            pthread_cond_timedwait(&log_rotate_cond, &log_rotate_mutex, &until);
+        }
+        else {
+            pthread_cond_wait(&log_rotate_cond, &log_rotate_mutex);
+        }
+    }
+    pthread_mutex_unlock(&log_rotate_mutex);
+    return NULL;
+}
+
+void log_file_rotation(size_t max_bytes, int interval_secs, int keep_files)
+{
+    pthread_mutex_lock(&log_rotate_mutex);
+    __atomic_store_n(&log_rotate_max_bytes, max_bytes, __ATOMIC_RELAXED);
+    log_rotate_interval = interval_secs > 0 ? interval_secs : 0;
+    __atomic_store_n(&log_rotate_keep, keep_files, __ATOMIC_RELAXED);
+    if (log_rotate_interval > 0)
+        log_rotate_due = log_rotate_next(time(NULL));
+
+    int running = log_rotate_running;
+    int wanted = max_bytes > 0 || log_rotate_interval > 0;
+    if (running && !wanted)
+        log_rotate_stopping = 1;
+    pthread_cond_signal(&log_rotate_cond);
+    pthread_mutex_unlock(&log_rotate_mutex);
+
+    if (running && !wanted) {
+        pthread_join(log_rotate_thread, NULL);
+        log_rotate_running = 0;
+        log_rotate_stopping = 0;
+    }
+    else if (!running && wanted) {
+        if (pthread_create(&log_rotate_thread, NULL, log_rotate_main, NULL)) {
+            fprintf(stderr, "Couldn't start the log rotation thread.\n");
+            __atomic_store_n(&log_rotate_max_bytes, 0, __ATOMIC_RELAXED);
+            return;
+        }
+        log_rotate_running = 1;
+    }
+
+    /* the file may be too big already */
+    if (max_bytes && __atomic_load_n(&log_file_bytes, __ATOMIC_RELAXED) >= max_bytes)
+        log_rotate_request();
+}
+
+/* Finish the current log file.  If another one follows, the descriptor
+ * stays open so threads still writing to it never see it closed, or
+ * worse, reused: log_file_init dup2()s the next file onto it. */
+static void log_file_finish(int keep_fd)
 {
     if (!log_file_initialised) 
         return;
     
-    close(log_file_fd);
+    log_async_flush();
+    log_buffer_flush();
+    log_uring_flush();
+    log_compress_flush();
+    log_index_close();
+    log_bin_stop();
+    if (!keep_fd)
+        close(log_file_fd);
     if (log_file_initialised == LOG_APPEND)
         printf("Logfile appended to %s\nSee %s to view it\n", log_filename, log_symlink);
     else
@@ -151,9 +847,63 @@ void close_log(void)
     log_file_initialised = 0;
 }
 
+int log_file_name(char *out, size_t room)
+{
+    int found = -1;
+
+    pthread_mutex_lock(&log_file_mutex);
+    if (log_file_initialised) {
+        snprintf(out, room, "%s", log_filename);
+        found = 0;
+    }
+    pthread_mutex_unlock(&log_file_mutex);
+    return found;
+}
+
+int log_file_text_fd(void)
+{
+    if (!__atomic_load_n(&log_file_initialised, __ATOMIC_ACQUIRE) ||
+        log_bin_is_active() || log_mmap_is_active())
+        return -1;
+    return __atomic_load_n(&log_file_fd, __ATOMIC_ACQUIRE);
+}
+
+void close_log(void) 
+{
+    log_limit_flush();
+    log_async_flush();
+    log_mmap_stop();
+    pthread_mutex_lock(&log_file_mutex);
+    log_file_finish(0);
+    pthread_mutex_unlock(&log_file_mutex);
+}
+
 void log_print_to_file(char *prefix, char *contents)
 {
-    dprintf(log_file_fd, "%s %s\n", prefix, contents);
+    if (log_bin_is_active()) {
+        log_bin_text(prefix, contents);
+        return;
+    }
+
+    /* one writev per message: lines of different threads never mix */
+    if (!prefix)
+        prefix = "(null)";
+    if (!contents)
+        contents = "(null)";
+    char plain[LOG_RECORD_SIZE];
+    char *spill = log_color_plain(&prefix, &contents, plain, sizeof(plain));
+    struct iovec iov[4] = {
+        { prefix, strlen(prefix) },
+        { " ", 1 },
+        { contents, strlen(contents) },
+        { "\n", 1 }
+    };
+    int fd = __atomic_load_n(&log_file_fd, __ATOMIC_ACQUIRE);
+    if (LOG_UNLIKELY(__atomic_load_n(&log_index_active, __ATOMIC_ACQUIRE)))
+        log_file_wrote(log_index_writev(fd, iov, 4));
+    else
+        log_file_wrote(writev(fd, iov, 4));
+    free(spill);
 }
 
 void log_file_init(char *log_dir_name, 
@@ -172,11 +922,21 @@ void log_file_init(char *log_dir_name,
         return;
     }
  
+    log_async_flush();
+    log_mmap_stop();
+    pthread_mutex_lock(&log_file_mutex);
+
+    int reuse_fd = log_file_initialised;
     if(log_file_initialised) 
-        close_log();
+        log_file_finish(1);
 
-    memset(log_filename, 0, sizeof(filename_len));
+    log_file_with_hostname = with_hostname;
+    int binary = log_strategy & LOG_BINARY;
+    log_strategy &= ~LOG_BINARY;
+
+    memset(log_filename, 0, sizeof(log_filename));
     int file_exists = 1;
+    int fd = -1;
 
     if (log_strategy == LOG_APPEND) {
         snprintf(log_symlink, filename_len, "%sappended_current.log", symlink_dir);
@@ -188,9 +948,9 @@ void log_file_init(char *log_dir_name,
                 file_exists = 0;
             }
             else {
-                log_file_fd = open(log_filename, 
-                                   O_APPEND | O_WRONLY, 
-                                   S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+                fd = open(log_filename, 
+                          O_APPEND | O_WRONLY, 
+                          S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
             }
         }
     }
@@ -199,59 +959,42 @@ void log_file_init(char *log_dir_name,
         if (log_strategy == LOG_WRITE_PER_RUN)
             snprintf(log_symlink, filename_len, "%scurrent.log", symlink_dir);
 
-        struct stat statbuf;
-        if (-1 != lstat(log_symlink, &statbuf)) 
-            unlink(log_symlink);
-
-        int hostname_len = 80;
-        char hostname_buf[hostname_len];
-        
-        if (with_hostname == WITH_HOSTNAME) 
-            gethostname((char*)hostname_buf, hostname_len);
-        else 
-            hostname_buf[0] = '\0';
-        
-        char* progname = basename(getenv("_"));
-
-        int time_buf_len = 16;
-        char *time_buf = malloc(time_buf_len);
-        memset(time_buf, 0, time_buf_len);
-
-        time_t t;
-        struct tm *tm_tmp;
-        t = time(NULL);
-
-        // should this be threadsafe?
-        tm_tmp = localtime(&t);
-
-        // is this needed
-        if (NULL == tm_tmp) 
-            abort();
-
-        strftime(time_buf, time_buf_len, "%Y%m%d-%H%M%S", tm_tmp);
-
-        time_buf_len = strlen(time_buf);
-
-        if (with_hostname == WITH_HOSTNAME)
-            snprintf(log_filename, filename_len, "%s%s.%s.%s",
-                     logging_dir, progname, hostname_buf, time_buf);
-        else
-            snprintf(log_filename, filename_len, "%s%s.%s",
-                     logging_dir, progname, time_buf);
-
-        free(time_buf);
-        log_file_fd = open(log_filename, 
-                           O_CREAT | O_TRUNC | O_WRONLY, 
-                           S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        fd = log_file_create(log_filename);
     }
 
-    if (log_file_fd == -1) {
+    if (fd == -1) {
         fprintf(stderr, "FATAL: couldn't open file descriptor: >>> %s <<<\n",log_filename);
         abort();
     }
+
+    if (reuse_fd) {
+        dup2(fd, log_file_fd);
+        close(fd);
+    }
+    else {
+        __atomic_store_n(&log_file_fd, fd, __ATOMIC_RELEASE);
+    }
     
     /* make the symlink */
-    symlink(log_filename, log_symlink);
-    
+    log_file_link();
+
+    struct stat statbuf;
+    __atomic_store_n(&log_file_bytes, 
+                     fstat(log_file_fd, &statbuf) == 0 ? (size_t)statbuf.st_size : 0,
+                     __ATOMIC_RELAXED);
+
+    if (binary)
+        log_bin_start();
+    else
+        log_index_open(log_filename, log_file_fd);
+
     log_file_initialised = log_strategy;
+    pthread_mutex_unlock(&log_file_mutex);
+
+    log_mmap_resume();
+
+    /* an appended file may be too big already */
+    size_t max_bytes = __atomic_load_n(&log_rotate_max_bytes, __ATOMIC_RELAXED);
+    if (max_bytes && __atomic_load_n(&log_file_bytes, __ATOMIC_RELAXED) >= max_bytes)
+        log_rotate_request();
 }
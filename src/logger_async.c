@@ -0,0 +1,280 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/****  async output: _log_msg queues, a consumer thread writes ****/
+
+#include <pthread.h>
+#include <sched.h>     // sched_yield
+#include <stdio.h>
+#include <stdlib.h>    // posix_memalign, atexit
+#include <string.h>
+#include "logger.h"
+#include "logger_internal.h"
+
+/* What a queued message looks like inside a ring slot */
+struct log_async_record {
+    int level;
+    int prefix_len;   /* contents start at text + prefix_len + 1 */
+    const char *file; /* the source file, for the index */
+    char *spill;      /* a message too long for the slot, on the heap */
+    char text[];
+};
+
+/* Room for everything that fits into the _log_msg record buffer,
+ * longer messages are spilled to the heap */
+#define LOG_ASYNC_TEXT_SIZE LOG_RECORD_SIZE
+#define LOG_ASYNC_SLOT_SIZE (sizeof(struct log_async_record) + LOG_ASYNC_TEXT_SIZE)
+
+int log_async_running = 0;
+
+static struct log_ring *log_async_ring = NULL;
+static uint64_t log_async_ring_slots = 0;
+static int log_async_policy = LOG_ASYNC_BLOCK;
+static int log_async_stopping = 0;
+static int log_async_busy = 0;
+static unsigned long log_async_dropped_before = 0;
+static pthread_t log_async_thread;
+
+/* The consumer sleeps on log_async_wakeup when the queue is empty and
+ * producers only signal it if it says so in log_async_sleeping; flushes
+ * wait on log_async_drained */
+static int log_async_sleeping = 0;
+static pthread_mutex_t log_async_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_async_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t log_async_drained = PTHREAD_COND_INITIALIZER;
+
+static void log_async_write(struct log_async_record *rec)
+{
+    char *text = rec->spill ? rec->spill : rec->text;
+
+    log_output_file = rec->file;
+    log_output(rec->level, text, text + rec->prefix_len + 1);
+    log_output_file = NULL;
+    free(rec->spill);
+}
+
+static int log_async_empty(void)
+{
+    return __atomic_load_n(&log_async_ring->tail, __ATOMIC_SEQ_CST) ==
+           __atomic_load_n(&log_async_ring->head, __ATOMIC_SEQ_CST);
+}
+
+/* Sleep until there is something in the queue, or until stopping */
+static void log_async_idle(void)
+{
+    pthread_mutex_lock(&log_async_mutex);
+    pthread_cond_broadcast(&log_async_drained);
+    __atomic_store_n(&log_async_sleeping, 1, __ATOMIC_SEQ_CST);
+    while (log_async_empty() && !__atomic_load_n(&log_async_stopping, __ATOMIC_ACQUIRE))
+        pthread_cond_wait(&log_async_wakeup, &log_async_mutex);
+    __atomic_store_n(&log_async_sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&log_async_mutex);
+}
+
+/* After a commit: wake the consumer if it is asleep.  The fence pairs
+ * with the one in setting log_async_sleeping, either the consumer sees
+ * the message or the producer sees it sleeping. */
+static void log_async_wake(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&log_async_sleeping, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&log_async_mutex);
+        pthread_cond_signal(&log_async_wakeup);
+        pthread_mutex_unlock(&log_async_mutex);
+    }
+}
+
+static void *log_async_consumer(void *unused)
+{
+    int written = 0;
+
+    (void)unused;
+    for (;;) {
+        uint64_t pos;
+        __atomic_store_n(&log_async_busy, 1, __ATOMIC_SEQ_CST);
+        struct log_async_record *rec = log_ring_claim(log_async_ring, &pos);
+        if (rec) {
+            log_async_write(rec);
+            log_ring_release(log_async_ring, pos);
+            written = 1;
+            continue;
+        }
+        /* nothing to do, a good moment to empty the file buffer */
+        if (written) {
+            log_buffer_flush();
+            log_uring_submit();
+            written = 0;
+        }
+        __atomic_store_n(&log_async_busy, 0, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&log_async_stopping, __ATOMIC_ACQUIRE))
+            break;
+        log_async_idle();
+    }
+    pthread_mutex_lock(&log_async_mutex);
+    pthread_cond_broadcast(&log_async_drained);
+    pthread_mutex_unlock(&log_async_mutex);
+    return NULL;
+}
+
+/* Copy at most 'room' - 1 bytes of 'src' and terminate, returns the length */
+static size_t log_async_copy(char *dst, const char *src, size_t room)
+{
+    size_t len = src ? strlen(src) : 0;
+    if (len >= room)
+        len = room - 1;
+    memcpy(dst, src ? src : "", len);
+    dst[len] = '\0';
+    return len;
+}
+
+void log_async_push(int level, const char *prefix, const char *contents)
+{
+    struct log_ring *ring = log_async_ring;
+    struct log_async_record *rec;
+    uint64_t pos;
+
+    while (NULL == (rec = log_ring_reserve(ring, &pos))) {
+        switch (log_async_policy) {
+            case(LOG_ASYNC_DROP_NEWEST): {
+                __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+                return;
+            }
+            case(LOG_ASYNC_DROP_OLDEST): {
+                struct log_async_record *oldest;
+                uint64_t old;
+                if ((oldest = log_ring_claim(ring, &old))) {
+                    free(oldest->spill);
+                    log_ring_release(ring, old);
+                    __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+                }
+                break;
+            }
+            default: /* LOG_ASYNC_BLOCK */
+                sched_yield();
+        }
+    }
+
+    rec->level = level;
+    rec->file = log_output_file;
+    rec->spill = NULL;
+    size_t prefix_len = prefix ? strlen(prefix) : 0;
+    size_t contents_len = contents ? strlen(contents) : 0;
+    if (prefix_len + contents_len + 2 > LOG_ASYNC_TEXT_SIZE &&
+        (rec->spill = malloc(prefix_len + contents_len + 2))) {
+        rec->prefix_len = log_async_copy(rec->spill, prefix, prefix_len + 1);
+        log_async_copy(rec->spill + prefix_len + 1, contents, contents_len + 1);
+    }
+    else {  /* fits, or cut short if there was no memory for it */
+        rec->prefix_len = log_async_copy(rec->text, prefix, LOG_ASYNC_TEXT_SIZE - 1);
+        log_async_copy(rec->text + rec->prefix_len + 1, contents,
+                       LOG_ASYNC_TEXT_SIZE - rec->prefix_len - 1);
+    }
+    log_ring_commit(ring, pos);
+    log_async_wake();
+}
+
+void log_async_flush(void)
+{
+    if (!__atomic_load_n(&log_async_running, __ATOMIC_ACQUIRE))
+        return;
+    pthread_mutex_lock(&log_async_mutex);
+    while ((!log_async_empty() || __atomic_load_n(&log_async_busy, __ATOMIC_SEQ_CST)) &&
+           __atomic_load_n(&log_async_running, __ATOMIC_ACQUIRE))
+        pthread_cond_wait(&log_async_drained, &log_async_mutex);
+    pthread_mutex_unlock(&log_async_mutex);
+}
+
+void log_async_start(int queue_size, int full_policy)
+{
+    static int registered_atexit = 0;
+
+    if (log_async_running) {
+        printf("Async logging is already running.\n");
+        return;
+    }
+
+    uint64_t slots = 2;
+    while (slots < (uint64_t)queue_size)
+        slots <<= 1;
+
+    /* Rings are never freed: a thread that saw log_async_running just
+     * before log_async_stop() may still be writing into the old one. */
+    if (!log_async_ring || log_async_ring_slots != slots) {
+        void *mem;
+        if (posix_memalign(&mem, 64, log_ring_size(slots, LOG_ASYNC_SLOT_SIZE))) {
+            fprintf(stderr, "Couldn't allocate the async log queue, logging stays synchronous.\n");
+            return;
+        }
+        if (log_async_ring)
+            log_async_dropped_before += log_async_ring->dropped;
+        log_ring_init(mem, slots, LOG_ASYNC_SLOT_SIZE);
+        log_async_ring = mem;
+        log_async_ring_slots = slots;
+    }
+
+    log_async_policy = full_policy;
+    log_async_stopping = 0;
+
+    if (pthread_create(&log_async_thread, NULL, log_async_consumer, NULL)) {
+        fprintf(stderr, "Couldn't start the async log thread, logging stays synchronous.\n");
+        return;
+    }
+    if (!registered_atexit) {
+        atexit(log_async_stop);
+        registered_atexit = 1;
+    }
+    __atomic_store_n(&log_async_running, 1, __ATOMIC_RELEASE);
+}
+
+void log_async_stop(void)
+{
+    if (!__atomic_load_n(&log_async_running, __ATOMIC_ACQUIRE))
+        return;
+
+    __atomic_store_n(&log_async_running, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&log_async_mutex);
+    __atomic_store_n(&log_async_stopping, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&log_async_wakeup);
+    pthread_mutex_unlock(&log_async_mutex);
+    pthread_join(log_async_thread, NULL);
+
+    /* catch anything pushed while the consumer was shutting down */
+    uint64_t pos;
+    struct log_async_record *rec;
+    while (NULL != (rec = log_ring_claim(log_async_ring, &pos))) {
+        log_async_write(rec);
+        log_ring_release(log_async_ring, pos);
+    }
+}
+
+unsigned long log_async_queued(void)
+{
+    struct log_ring *ring = __atomic_load_n(&log_async_ring, __ATOMIC_ACQUIRE);
+    if (!ring || !__atomic_load_n(&log_async_running, __ATOMIC_ACQUIRE))
+        return 0;
+    return __atomic_load_n(&ring->head, __ATOMIC_RELAXED) -
+           __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+}
+
+unsigned long log_async_dropped(void)
+{
+    unsigned long dropped = log_async_dropped_before;
+    if (log_async_ring)
+        dropped += __atomic_load_n(&log_async_ring->dropped, __ATOMIC_RELAXED);
+    return dropped;
+}
@@ -0,0 +1,731 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/****  binary log files: site ids and raw arguments, formatted later ****/
+
+/* A LOG_BINARY log file is the magic LOG_BIN_MAGIC followed by frames.
+ * Every frame starts with a struct log_bin_frame, the payload is
+ *
+ *   LOG_BIN_SITE  u32 id, i32 linenum, then name, filename, function
+ *                 and fmt as NUL terminated strings
+ *   LOG_BIN_MSG   u32 id, i32 level, then the arguments in fmt order:
+ *                 4 bytes per int, 8 per long/pointer/double,
+ *                 sizeof(long double), or u32 length + NUL terminated
+ *                 bytes for a string
+ *   LOG_BIN_TEXT  prefix and contents as NUL terminated strings
+ *
+ * all in host byte order.  A site is described once per file before its
+ * first message, appending to a file starts with the magic again.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>    // write, read
+#include "logger.h"
+#include "logger_internal.h"
+
+#define LOG_BIN_MAGIC "LOGBIN01"
+#define LOG_BIN_MAGIC_LEN 8
+
+#define LOG_BIN_SITE 1
+#define LOG_BIN_MSG  2
+#define LOG_BIN_TEXT 3
+
+struct log_bin_frame {
+    uint16_t type;
+    uint16_t unused;
+    uint32_t len;     /* payload bytes after this header */
+};
+
+/* Each thread collects its frames in one of these.  All of them are
+ * written out when a message comes in LOG_BIN_FLUSH_MS after the last
+ * time, so a quiet thread doesn't sit on its messages. */
+#define LOG_BIN_BUFFER_SIZE (64 * 1024)
+#define LOG_BIN_FLUSH_MS 1000
+
+struct log_bin_buffer {
+    int lock;
+    int owned;                    /* a live thread writes into it */
+    size_t used;
+    struct log_bin_buffer *next;
+    char data[LOG_BIN_BUFFER_SIZE];
+};
+
+/* Non zero while log_file_fd is a binary log, counts up per file */
+static int log_bin_active = 0;
+static unsigned log_bin_generation = 0;
+
+static unsigned log_bin_next_id = 0;
+static struct log_bin_buffer *log_bin_buffers = NULL;
+static pthread_mutex_t log_bin_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t log_bin_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_bin_key;
+static __thread struct log_bin_buffer *log_bin_mine = NULL;
+static long long log_bin_last_flush_ms = 0;
+
+/****  format strings ****/
+
+const char *log_fmt_spec(const char *p, int *type, int *stars)
+{
+    int longs = 0, big = 0;
+
+    *stars = 0;
+    while (*p && strchr("-+ #0'I", *p))
+        p++;
+    if (*p == '*') {
+        (*stars)++;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9')
+        p++;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            (*stars)++;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9')
+            p++;
+    }
+    for (;; p++) {
+        if (*p == 'h')
+            continue;
+        if (*p == 'l' || *p == 'q' || *p == 'j' || *p == 'z' || *p == 'Z' || *p == 't')
+            longs++;
+        else if (*p == 'L')
+            big = 1;
+        else
+            break;
+    }
+
+    switch (*p) {
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+            *type = longs ? LOG_ARG_LONG : LOG_ARG_INT;
+            break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            *type = big ? LOG_ARG_LDOUBLE : LOG_ARG_DOUBLE;
+            break;
+        case 's':
+            *type = longs ? -1 : LOG_ARG_STRING;  /* no wide strings */
+            break;
+        case 'p':
+            *type = LOG_ARG_POINTER;
+            break;
+        case 'n':
+            *type = LOG_ARG_NONE;
+            break;
+        case 'm':
+            *type = -2;  /* glibc's strerror(errno), takes no argument */
+            break;
+        default:
+            *type = -1;
+            return *p ? p + 1 : p;
+    }
+    return p + 1;
+}
+
+int log_fmt_args(const char *fmt, unsigned char *types, int max)
+{
+    int count = 0;
+
+    for (const char *p = fmt; *p; ) {
+        if (*p++ != '%')
+            continue;
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+        int type, stars;
+        p = log_fmt_spec(p, &type, &stars);
+        if (type == -1 || type == -2)
+            return -1;
+        if (count + stars + 1 > max)
+            return -1;
+        while (stars--)
+            types[count++] = LOG_ARG_INT;
+        types[count++] = type;
+    }
+    return count;
+}
+
+/****  writing ****/
+
+static void log_bin_write(const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t done = write(__atomic_load_n(&log_file_fd, __ATOMIC_ACQUIRE), data, len);
+        if (done <= 0)
+            return;
+        log_file_wrote(done);
+        data += done;
+        len -= done;
+    }
+}
+
+static long long log_bin_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* Is it time to write out every buffer?  Only one thread gets a yes. */
+static int log_bin_flush_due(void)
+{
+    long long now = log_bin_now_ms();
+    long long last = __atomic_load_n(&log_bin_last_flush_ms, __ATOMIC_RELAXED);
+
+    return now - last >= LOG_BIN_FLUSH_MS &&
+           __atomic_compare_exchange_n(&log_bin_last_flush_ms, &last, now, 0,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static void log_bin_lock(struct log_bin_buffer *buf)
+{
+    while (__atomic_test_and_set(&buf->lock, __ATOMIC_ACQUIRE))
+        ;
+}
+
+static void log_bin_unlock(struct log_bin_buffer *buf)
+{
+    __atomic_clear(&buf->lock, __ATOMIC_RELEASE);
+}
+
+/* Called with the buffer locked */
+static void log_bin_flush_buffer(struct log_bin_buffer *buf)
+{
+    if (buf->used)
+        log_bin_write(buf->data, buf->used);
+    buf->used = 0;
+}
+
+static void log_bin_thread_exit(void *mine)
+{
+    struct log_bin_buffer *buf = mine;
+    log_bin_lock(buf);
+    log_bin_flush_buffer(buf);
+    log_bin_unlock(buf);
+    __atomic_store_n(&buf->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void log_bin_make_key(void)
+{
+    pthread_key_create(&log_bin_key, log_bin_thread_exit);
+}
+
+static struct log_bin_buffer *log_bin_buffer(void)
+{
+    if (log_bin_mine)
+        return log_bin_mine;
+
+    pthread_once(&log_bin_once, log_bin_make_key);
+    pthread_mutex_lock(&log_bin_mutex);
+    struct log_bin_buffer *buf = log_bin_buffers;
+    while (buf && buf->owned)   /* reuse the buffer of a finished thread */
+        buf = buf->next;
+    if (!buf) {
+        buf = calloc(1, sizeof(struct log_bin_buffer));
+        if (!buf) {
+            pthread_mutex_unlock(&log_bin_mutex);
+            return NULL;
+        }
+        buf->next = log_bin_buffers;
+        log_bin_buffers = buf;
+    }
+    buf->owned = 1;
+    pthread_mutex_unlock(&log_bin_mutex);
+
+    pthread_setspecific(log_bin_key, buf);
+    log_bin_mine = buf;
+    return buf;
+}
+
+/* Make sure the current file knows the site, 0 if it has to go as text */
+static int log_bin_describe(struct log_site *site, unsigned generation)
+{
+    pthread_mutex_lock(&log_bin_mutex);
+
+    if (!site->id) {
+        site->arg_count = log_fmt_args(site->fmt, site->arg_types, LOG_SITE_MAX_ARGS);
+        site->id = ++log_bin_next_id;
+    }
+    if (site->arg_count >= 0 && site->generation != generation) {
+        size_t name_len = strlen(site->name) + 1;
+        size_t filename_len = strlen(site->filename) + 1;
+        size_t function_len = strlen(site->function) + 1;
+        size_t fmt_len = strlen(site->fmt) + 1;
+        struct log_bin_frame frame = { LOG_BIN_SITE, 0,
+            8 + name_len + filename_len + function_len + fmt_len };
+        uint32_t id = site->id;
+        int32_t linenum = site->linenum;
+
+        char *out = malloc(sizeof(frame) + frame.len);
+        if (out) {
+            char *p = out;
+            memcpy(p, &frame, sizeof(frame));   p += sizeof(frame);
+            memcpy(p, &id, 4);                  p += 4;
+            memcpy(p, &linenum, 4);             p += 4;
+            memcpy(p, site->name, name_len);         p += name_len;
+            memcpy(p, site->filename, filename_len); p += filename_len;
+            memcpy(p, site->function, function_len); p += function_len;
+            memcpy(p, site->fmt, fmt_len);
+            log_bin_write(out, sizeof(frame) + frame.len);
+            free(out);
+            __atomic_store_n(&site->generation, generation, __ATOMIC_RELEASE);
+        }
+    }
+
+    int ok = site->arg_count >= 0 && site->generation == generation;
+    pthread_mutex_unlock(&log_bin_mutex);
+    return ok;
+}
+
+char *log_args_encode(char *p, char *end, const unsigned char *types, int count,
+                      va_list *argp)
+{
+    for (int i = 0; i < count; i++) {
+        /* the largest fixed size argument, and a string's length */
+        if (end - p < 16)
+            return NULL;
+        switch (types[i]) {
+            case(LOG_ARG_INT): {
+                int v = va_arg(*argp, int);
+                memcpy(p, &v, 4);  p += 4;
+                break;
+            }
+            case(LOG_ARG_LONG): {
+                long long v = va_arg(*argp, long long);
+                memcpy(p, &v, 8);  p += 8;
+                break;
+            }
+            case(LOG_ARG_DOUBLE): {
+                double v = va_arg(*argp, double);
+                memcpy(p, &v, 8);  p += 8;
+                break;
+            }
+            case(LOG_ARG_LDOUBLE): {
+                long double v = va_arg(*argp, long double);
+                memcpy(p, &v, sizeof(v));  p += sizeof(v);
+                break;
+            }
+            case(LOG_ARG_POINTER): {
+                uint64_t v = (uintptr_t)va_arg(*argp, void *);
+                memcpy(p, &v, 8);  p += 8;
+                break;
+            }
+            case(LOG_ARG_STRING): {
+                const char *s = va_arg(*argp, const char *);
+                if (!s)
+                    s = "(null)";
+                /* leave room for the fixed size arguments after this one */
+                long room = (end - p) - 4 - 16 * (count - i - 1);
+                uint32_t len = strlen(s);
+                if (room < 1)
+                    room = 1;
+                if ((long)len >= room)
+                    len = room - 1;
+                len++;
+                memcpy(p, &len, 4);  p += 4;
+                memcpy(p, s, len - 1);
+                p[len - 1] = '\0';
+                p += len;
+                break;
+            }
+            default: /* LOG_ARG_NONE */
+                (void)va_arg(*argp, void *);
+        }
+    }
+    return p;
+}
+
+/* Serialise one message into the buffer, which has LOG_RECORD_SIZE bytes
+ * free unless the buffer is smaller than that.  Returns 0 if it doesn't
+ * fit, the message then goes out as text. */
+static int log_bin_encode(struct log_bin_buffer *buf, struct log_site *site,
+                          int level, va_list argp)
+{
+    char *start = buf->data + buf->used;
+    char *end = LOG_BIN_BUFFER_SIZE - buf->used < LOG_RECORD_SIZE ?
+                buf->data + LOG_BIN_BUFFER_SIZE : start + LOG_RECORD_SIZE;
+    char *p = start + sizeof(struct log_bin_frame);
+    uint32_t id = site->id;
+    int32_t lvl = level;
+    va_list args;
+
+    if (end - p < 8)
+        return 0;
+    memcpy(p, &id, 4);   p += 4;
+    memcpy(p, &lvl, 4);  p += 4;
+
+    va_copy(args, argp);
+    p = log_args_encode(p, end, site->arg_types, site->arg_count, &args);
+    va_end(args);
+    if (!p)
+        return 0;
+
+    struct log_bin_frame frame = { LOG_BIN_MSG, 0, p - start - sizeof(frame) };
+    memcpy(start, &frame, sizeof(frame));
+    buf->used += p - start;
+    return 1;
+}
+
+void __attribute__((nonnull, format(printf,3,4)))
+_log_bin_msg(struct log_site *site, int level, const char *fmt, ...)
+{
+    /* the macro checked the level and the call site */
+    va_list argp;
+    va_start(argp, fmt);
+
+    unsigned generation = __atomic_load_n(&log_bin_generation, __ATOMIC_ACQUIRE);
+    struct log_bin_buffer *buf = NULL;
+
+    if (__atomic_load_n(&log_bin_active, __ATOMIC_ACQUIRE) &&
+        (__atomic_load_n(&site->generation, __ATOMIC_ACQUIRE) == generation ||
+         log_bin_describe(site, generation)))
+        buf = log_bin_buffer();
+
+    int written = 0;
+    if (buf) {
+        log_bin_lock(buf);
+        /* the file may have been closed or swapped in the meantime */
+        if (__atomic_load_n(&log_bin_active, __ATOMIC_SEQ_CST) &&
+            __atomic_load_n(&log_bin_generation, __ATOMIC_SEQ_CST) == generation) {
+            if (LOG_BIN_BUFFER_SIZE - buf->used < LOG_RECORD_SIZE)
+                log_bin_flush_buffer(buf);
+            written = log_bin_encode(buf, site, level, argp);
+            if (level == LOG_ERR)
+                log_bin_flush_buffer(buf);
+        }
+        log_bin_unlock(buf);
+        if (written && log_bin_flush_due())
+            log_bin_flush();
+    }
+
+    if (!written)
+        log_vmsg(site->name, level, site->filename, site->linenum,
+                 site->function, NULL, NULL, 0, fmt, argp);
+    else if (LOG_UNLIKELY(__atomic_load_n(&log_stats_active, __ATOMIC_RELAXED)))
+        log_stats_message(level, 0);   /* counted, not timed */
+    va_end(argp);
+}
+
+void log_bin_text(const char *prefix, const char *contents)
+{
+    struct log_bin_buffer *buf = log_bin_buffer();
+    size_t prefix_len = strlen(prefix ? prefix : "") + 1;
+    size_t contents_len = strlen(contents ? contents : "") + 1;
+    struct log_bin_frame frame = { LOG_BIN_TEXT, 0, prefix_len + contents_len };
+
+    if (!buf)
+        return;
+    log_bin_lock(buf);
+    if (LOG_BIN_BUFFER_SIZE - buf->used < sizeof(frame) + frame.len)
+        log_bin_flush_buffer(buf);
+
+    if (LOG_BIN_BUFFER_SIZE - buf->used < sizeof(frame) + frame.len) {
+        /* bigger than the whole buffer, straight out it goes */
+        log_bin_write((char *)&frame, sizeof(frame));
+        log_bin_write(prefix ? prefix : "", prefix_len);
+        log_bin_write(contents ? contents : "", contents_len);
+    }
+    else {
+        char *p = buf->data + buf->used;
+        memcpy(p, &frame, sizeof(frame));                  p += sizeof(frame);
+        memcpy(p, prefix ? prefix : "", prefix_len);       p += prefix_len;
+        memcpy(p, contents ? contents : "", contents_len);
+        buf->used += sizeof(frame) + frame.len;
+    }
+    log_bin_unlock(buf);
+}
+
+int log_bin_is_active(void)
+{
+    return __atomic_load_n(&log_bin_active, __ATOMIC_ACQUIRE);
+}
+
+void log_bin_start(void)
+{
+    log_bin_write(LOG_BIN_MAGIC, LOG_BIN_MAGIC_LEN);
+    __atomic_store_n(&log_bin_last_flush_ms, log_bin_now_ms(), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&log_bin_generation, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&log_bin_active, 1, __ATOMIC_SEQ_CST);
+}
+
+void log_bin_flush(void)
+{
+    pthread_mutex_lock(&log_bin_mutex);
+    for (struct log_bin_buffer *buf = log_bin_buffers; buf; buf = buf->next) {
+        log_bin_lock(buf);
+        log_bin_flush_buffer(buf);
+        log_bin_unlock(buf);
+    }
+    pthread_mutex_unlock(&log_bin_mutex);
+}
+
+void log_bin_rotate(int fd)
+{
+    /* hold every buffer, so nobody writes half a batch into each file */
+    pthread_mutex_lock(&log_bin_mutex);
+    for (struct log_bin_buffer *buf = log_bin_buffers; buf; buf = buf->next) {
+        log_bin_lock(buf);
+        log_bin_flush_buffer(buf);
+    }
+    dup2(fd, log_file_fd);
+    log_bin_write(LOG_BIN_MAGIC, LOG_BIN_MAGIC_LEN);
+    /* sites describe themselves again in the new file */
+    __atomic_add_fetch(&log_bin_generation, 1, __ATOMIC_SEQ_CST);
+    for (struct log_bin_buffer *buf = log_bin_buffers; buf; buf = buf->next)
+        log_bin_unlock(buf);
+    pthread_mutex_unlock(&log_bin_mutex);
+}
+
+void log_bin_stop(void)
+{
+    if (!__atomic_load_n(&log_bin_active, __ATOMIC_ACQUIRE))
+        return;
+    __atomic_store_n(&log_bin_active, 0, __ATOMIC_SEQ_CST);
+    log_bin_flush();
+}
+
+/****  reading ****/
+
+/* A site as read back from a file */
+struct log_bin_site {
+    char *data;   /* the strings below point into this copy of the frame */
+    char *name, *filename, *function, *fmt;
+    int linenum;
+    int arg_count;
+    unsigned char arg_types[LOG_SITE_MAX_ARGS];
+};
+
+/* Format one argument with printf conversion 'spec' */
+#define LOG_BIN_PRINT(out, room, spec, stars, star, value)                    \
+    ((stars) == 0 ? snprintf(out, room, spec, value) :                         \
+     (stars) == 1 ? snprintf(out, room, spec, star[0], value) :                \
+                    snprintf(out, room, spec, star[0], star[1], value))
+
+/* Render fmt with the raw arguments in args, returns 0 if they run short */
+static int log_bin_render(const struct log_bin_site *site, const char *args,
+                          size_t len, char *out, size_t room)
+{
+    const char *end = args + len;
+    size_t pos = 0;
+
+#define LOG_BIN_TAKE(var, size)                                                \
+    do {                                                                       \
+        if (args + (size) > end)                                               \
+            return 0;                                                          \
+        memcpy(&(var), args, size);                                            \
+        args += (size);                                                        \
+    } while (0)
+
+    for (const char *p = site->fmt; *p && pos < room - 1; ) {
+        if (*p != '%' || p[1] == '%') {
+            out[pos++] = *p;
+            p += (*p == '%') ? 2 : 1;
+            continue;
+        }
+
+        int type, stars, star[2] = { 0, 0 };
+        const char *spec_end = log_fmt_spec(p + 1, &type, &stars);
+        char spec[64];
+        size_t spec_len = spec_end - p;
+
+        if (spec_len >= sizeof(spec))
+            spec_len = sizeof(spec) - 1;
+        memcpy(spec, p, spec_len);
+        spec[spec_len] = '\0';
+        p = spec_end;
+
+        for (int i = 0; i < stars; i++)
+            LOG_BIN_TAKE(star[i], 4);
+
+        int n = 0;
+        switch (type) {
+            case(LOG_ARG_INT): {
+                int v;
+                LOG_BIN_TAKE(v, 4);
+                n = LOG_BIN_PRINT(out + pos, room - pos, spec, stars, star, v);
+                break;
+            }
+            case(LOG_ARG_LONG): {
+                long long v;
+                LOG_BIN_TAKE(v, 8);
+                n = LOG_BIN_PRINT(out + pos, room - pos, spec, stars, star, v);
+                break;
+            }
+            case(LOG_ARG_DOUBLE): {
+                double v;
+                LOG_BIN_TAKE(v, 8);
+                n = LOG_BIN_PRINT(out + pos, room - pos, spec, stars, star, v);
+                break;
+            }
+            case(LOG_ARG_LDOUBLE): {
+                long double v;
+                LOG_BIN_TAKE(v, sizeof(v));
+                n = LOG_BIN_PRINT(out + pos, room - pos, spec, stars, star, v);
+                break;
+            }
+            case(LOG_ARG_POINTER): {
+                uint64_t v;
+                LOG_BIN_TAKE(v, 8);
+                n = LOG_BIN_PRINT(out + pos, room - pos, spec, stars, star,
+                                  (void *)(uintptr_t)v);
+                break;
+            }
+            case(LOG_ARG_STRING): {
+                uint32_t slen;
+                LOG_BIN_TAKE(slen, 4);
+                if (slen == 0 || args + slen > end || args[slen - 1] != '\0')
+                    return 0;
+                n = LOG_BIN_PRINT(out + pos, room - pos, spec, stars, star, args);
+                args += slen;
+                break;
+            }
+            default: /* %n writes nothing */
+                break;
+        }
+        if (n > 0)
+            pos += n;
+        if (pos >= room)
+            pos = room - 1;
+    }
+#undef LOG_BIN_TAKE
+    out[pos] = '\0';
+    return 1;
+}
+
+/* Read exactly len bytes, returns 0 at the end of the file */
+static int log_bin_read(int fd, void *into, size_t len)
+{
+    char *p = into;
+    while (len > 0) {
+        ssize_t got = read(fd, p, len);
+        if (got <= 0)
+            return 0;
+        p += got;
+        len -= got;
+    }
+    return 1;
+}
+
+long log_bin_decode(int fd, void (*output)(char *prefix, char *contents))
+{
+    struct log_bin_site *sites = NULL;
+    size_t sites_size = 0;
+    char *payload = NULL;
+    size_t payload_size = 0;
+    char prefix[LOG_RECORD_SIZE], contents[LOG_RECORD_SIZE];
+    long count = 0;
+    struct log_bin_frame frame;
+
+    char magic[LOG_BIN_MAGIC_LEN];
+    if (!log_bin_read(fd, magic, LOG_BIN_MAGIC_LEN) ||
+        memcmp(magic, LOG_BIN_MAGIC, LOG_BIN_MAGIC_LEN))
+        return -1;
+
+    while (log_bin_read(fd, &frame, sizeof(frame))) {
+        if (!memcmp(&frame, LOG_BIN_MAGIC, LOG_BIN_MAGIC_LEN))
+            continue;  /* appended by a later run */
+
+        if (frame.len > payload_size) {
+            char *bigger = realloc(payload, frame.len);
+            if (!bigger)
+                break;
+            payload = bigger;
+            payload_size = frame.len;
+        }
+        if (!log_bin_read(fd, payload, frame.len))
+            break;
+
+        if (frame.type == LOG_BIN_SITE && frame.len > 8) {
+            uint32_t id;
+            int32_t linenum;
+            memcpy(&id, payload, 4);
+            memcpy(&linenum, payload + 4, 4);
+            if (id >= sites_size) {
+                size_t size = sites_size ? sites_size : 64;
+                while (size <= id)
+                    size *= 2;
+                struct log_bin_site *more = realloc(sites, size * sizeof(*sites));
+                if (!more)
+                    break;
+                memset(more + sites_size, 0, (size - sites_size) * sizeof(*sites));
+                sites = more;
+                sites_size = size;
+            }
+            struct log_bin_site *site = &sites[id];
+            char *strings[4];
+            char *p = payload + 8, *end = payload + frame.len;
+            int i;
+            for (i = 0; i < 4 && p < end; i++) {
+                strings[i] = p;
+                p = memchr(p, '\0', end - p);
+                if (!p)
+                    break;
+                p++;
+            }
+            if (i < 4)
+                continue;  /* damaged site */
+            free(site->data);
+            site->data = malloc(frame.len);
+            if (!site->data) {
+                site->name = NULL;
+                break;
+            }
+            memcpy(site->data, payload, frame.len);
+            site->name = site->data + (strings[0] - payload);
+            site->filename = site->data + (strings[1] - payload);
+            site->function = site->data + (strings[2] - payload);
+            site->fmt = site->data + (strings[3] - payload);
+            site->linenum = linenum;
+            site->arg_count = log_fmt_args(site->fmt, site->arg_types, LOG_SITE_MAX_ARGS);
+        }
+        else if (frame.type == LOG_BIN_MSG && frame.len >= 8) {
+            uint32_t id;
+            int32_t level;
+            memcpy(&id, payload, 4);
+            memcpy(&level, payload + 4, 4);
+            if (id >= sites_size || !sites[id].name)
+                continue;  /* never described */
+            struct log_bin_site *site = &sites[id];
+            snprintf(prefix, sizeof(prefix), LOG_PREFIX_FMT,
+                     site->name, site->filename, site->linenum, site->function);
+            if (!log_bin_render(site, payload + 8, frame.len - 8, contents, sizeof(contents)))
+                snprintf(contents, sizeof(contents), "(damaged record for: %s)", site->fmt);
+            output(prefix, contents);
+            count++;
+        }
+        else if (frame.type == LOG_BIN_TEXT) {
+            char *split = memchr(payload, '\0', frame.len);
+            if (!split || payload[frame.len - 1] != '\0')
+                continue;
+            output(payload, split + 1);
+            count++;
+        }
+    }
+
+    for (size_t i = 0; i < sites_size; i++)
+        free(sites[i].data);
+    free(sites);
+    free(payload);
+    return count;
+}
@@ -0,0 +1,196 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/****  buffered output to the log file ****/
+
+/* Messages are copied into the active buffer.  A flush swaps in the
+ * spare buffer and writes the full one outside of the buffer lock, so
+ * logging threads only wait for the copy, not for the disk. */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>   // writev
+#include "logger.h"
+#include "logger_internal.h"
+
+struct log_buffer {
+    char *data;
+    size_t used;
+};
+
+static struct log_buffer log_buffers[2];
+static struct log_buffer *log_buffer_active = &log_buffers[0];
+static struct log_buffer *log_buffer_spare = &log_buffers[1];
+static size_t log_buffer_size = 0;
+static int log_buffer_interval_ms = 0;
+static int log_buffer_flush_level = LOG_ERR;
+static long long log_buffer_last_flush_ms = 0;
+
+/* log_buffer_mutex guards the active buffer, log_buffer_write_mutex
+ * keeps the flushes in order and owns the spare buffer */
+static pthread_mutex_t log_buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t log_buffer_write_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static long long log_buffer_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* Write everything in iov, however many calls it takes */
+static void log_buffer_writev(struct iovec *iov, int count)
+{
+    int fd = __atomic_load_n(&log_file_fd, __ATOMIC_ACQUIRE);
+
+    while (count > 0) {
+        ssize_t done = writev(fd, iov, count);
+        if (done <= 0)
+            return;
+        log_file_wrote(done);
+        while (count > 0 && (size_t)done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+}
+
+/* Swap the buffers and write out the full one, together with the
+ * pieces in 'extra' if there are any */
+static void log_buffer_flush_with(struct iovec *extra, int extra_count)
+{
+    struct iovec iov[8];
+
+    pthread_mutex_lock(&log_buffer_write_mutex);
+
+    pthread_mutex_lock(&log_buffer_mutex);
+    struct log_buffer *full = log_buffer_active;
+    log_buffer_active = log_buffer_spare;
+    log_buffer_spare = full;
+    __atomic_store_n(&log_buffer_last_flush_ms, log_buffer_now_ms(), __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&log_buffer_mutex);
+
+    iov[0].iov_base = full->data;
+    iov[0].iov_len = full->used;
+    for (int i = 0; i < extra_count; i++)
+        iov[i + 1] = extra[i];
+    log_buffer_writev(iov, extra_count + 1);
+    full->used = 0;
+
+    pthread_mutex_unlock(&log_buffer_write_mutex);
+}
+
+void log_buffer_flush(void)
+{
+    if (log_buffer_size)
+        log_buffer_flush_with(NULL, 0);
+}
+
+void log_file_buffer(size_t buffer_size, int flush_interval_ms, int flush_level)
+{
+    log_buffer_flush();
+
+    pthread_mutex_lock(&log_buffer_write_mutex);
+    pthread_mutex_lock(&log_buffer_mutex);
+    for (int i = 0; i < 2; i++) {
+        if (!buffer_size) {   /* back to unbuffered output */
+            free(log_buffers[i].data);
+            log_buffers[i].data = NULL;
+            continue;
+        }
+        char *data = realloc(log_buffers[i].data, buffer_size);
+        if (!data) {
+            buffer_size = 0;
+            break;
+        }
+        log_buffers[i].data = data;
+    }
+    log_buffer_size = buffer_size;
+    log_buffer_interval_ms = flush_interval_ms;
+    log_buffer_flush_level = flush_level;
+    log_buffer_last_flush_ms = log_buffer_now_ms();
+    pthread_mutex_unlock(&log_buffer_mutex);
+    pthread_mutex_unlock(&log_buffer_write_mutex);
+}
+
+void log_print_to_file_buffered(char *prefix, char *contents)
+{
+    if (!log_buffer_size || log_bin_is_active()) {
+        log_print_to_file(prefix, contents);
+        return;
+    }
+
+    if (!prefix)
+        prefix = "(null)";
+    if (!contents)
+        contents = "(null)";
+    char plain[LOG_RECORD_SIZE];
+    char *spill = log_color_plain(&prefix, &contents, plain, sizeof(plain));
+    size_t prefix_len = strlen(prefix);
+    size_t contents_len = strlen(contents);
+    size_t len = prefix_len + 1 + contents_len + 1;
+    int level = log_current_level();
+
+    pthread_mutex_lock(&log_buffer_mutex);
+    struct log_buffer *buf = log_buffer_active;
+    int fits = log_buffer_size - buf->used >= len;
+    if (fits) {
+        char *p = buf->data + buf->used;
+        memcpy(p, prefix, prefix_len);      p += prefix_len;
+        *p++ = ' ';
+        memcpy(p, contents, contents_len);  p += contents_len;
+        *p = '\n';
+        buf->used += len;
+    }
+    pthread_mutex_unlock(&log_buffer_mutex);
+
+    if (!fits) {
+        /* out goes the buffer, with this message straight behind it */
+        struct iovec extra[4] = {
+            { prefix, prefix_len },
+            { " ", 1 },
+            { contents, contents_len },
+            { "\n", 1 }
+        };
+        log_buffer_flush_with(extra, 4);
+    }
+    else if ((level > 0 && level <= log_buffer_flush_level) ||
+             (log_buffer_interval_ms > 0 &&
+              log_buffer_now_ms() - __atomic_load_n(&log_buffer_last_flush_ms, __ATOMIC_RELAXED)
+                  >= log_buffer_interval_ms)) {
+        log_buffer_flush_with(NULL, 0);
+    }
+    free(spill);
+}
+
+void log_flush(void)
+{
+    log_limit_flush();
+    log_async_flush();
+    log_buffer_flush();
+    log_uring_flush();
+    log_compress_flush();
+    log_bin_flush();
+}
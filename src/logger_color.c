@@ -0,0 +1,151 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/****  colours: on terminals, and kept out of files ****/
+
+/* Each level has its escape sequence worked out ahead of time, the
+ * terminal outputs put it in front of the prefix.  Whether stdout and
+ * stderr are terminals is asked once.  The file outputs take escape
+ * sequences out of the text in one pass, and only copy it when there
+ * is an escape character in it at all.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "logger.h"
+#include "logger_internal.h"
+
+static const char *log_level_colors[LOG_LEVEL_BITMAP_BITS] = {
+    [LOG_ERR]    = "\x1b[01;31m",
+    [LOG_WARN]   = "\x1b[01;33m",
+    [LOG_NOTICE] = "\x1b[01;36m",
+    [LOG_DEBUG]  = "\x1b[36m",
+    [LOG_INFO]   = "\x1b[32m",
+};
+
+static int log_color_mode = LOG_COLOR_AUTO;
+
+/* isatty() of stdout and stderr, -1 until asked */
+static int log_color_tty[3] = { -1, -1, -1 };
+
+void log_set_color(int mode)
+{
+    __atomic_store_n(&log_color_mode, mode, __ATOMIC_RELAXED);
+}
+
+void log_set_level_color(int level, const char *ansi)
+{
+    if ((unsigned)level < LOG_LEVEL_BITMAP_BITS)
+        __atomic_store_n(&log_level_colors[level], ansi, __ATOMIC_RELEASE);
+}
+
+static int log_color_is_tty(int fd)
+{
+    int tty = __atomic_load_n(&log_color_tty[fd], __ATOMIC_RELAXED);
+
+    if (tty == -1) {
+        tty = isatty(fd);
+        __atomic_store_n(&log_color_tty[fd], tty, __ATOMIC_RELAXED);
+    }
+    return tty;
+}
+
+void log_print_terminal(int fd, char *prefix, char *contents)
+{
+    FILE *stream = fd == STDERR_FILENO ? stderr : stdout;
+    int mode = __atomic_load_n(&log_color_mode, __ATOMIC_RELAXED);
+    int level = log_current_level();
+
+    if (mode == LOG_COLOR_ALWAYS || (mode == LOG_COLOR_AUTO && log_color_is_tty(fd))) {
+        const char *ansi = (unsigned)level < LOG_LEVEL_BITMAP_BITS ?
+            __atomic_load_n(&log_level_colors[level], __ATOMIC_ACQUIRE) : NULL;
+        if (ansi)
+            fprintf(stream, "%s%s" LOG_ANSI_RESET " %s\n", ansi, prefix, contents);
+        else
+            fprintf(stream, "%s %s\n", prefix, contents);
+        return;
+    }
+
+    char scratch[LOG_RECORD_SIZE];
+    char *spill = log_color_plain(&prefix, &contents, scratch, sizeof(scratch));
+    fprintf(stream, "%s %s\n", prefix, contents);
+    free(spill);
+}
+
+size_t log_ansi_strip(char *dst, const char *src, size_t len)
+{
+    const char *end = src + len;
+    char *out = dst;
+
+    for (;;) {
+        const char *esc = memchr(src, '\x1b', end - src);
+        size_t plain = (esc ? esc : end) - src;
+        memmove(out, src, plain);
+        out += plain;
+        if (!esc)
+            break;
+
+        src = esc + 1;
+        if (src < end && *src == '[') {
+            /* CSI: parameters and intermediates, then one final byte */
+            for (src++; src < end && (unsigned char)*src >= 0x20 && (unsigned char)*src < 0x40; src++)
+                ;
+            if (src < end && (unsigned char)*src >= 0x40 && (unsigned char)*src <= 0x7e)
+                src++;
+        }
+        else if (src < end)
+            src++;   /* a two byte sequence */
+    }
+    return out - dst;
+}
+
+char *log_color_plain(char **prefix, char **contents, char *scratch, size_t room)
+{
+    if (__atomic_load_n(&log_color_mode, __ATOMIC_RELAXED) == LOG_COLOR_NEVER)
+        return NULL;
+
+    size_t prefix_len = *prefix ? strlen(*prefix) : 0;
+    size_t contents_len = *contents ? strlen(*contents) : 0;
+    int prefix_esc = prefix_len && memchr(*prefix, '\x1b', prefix_len);
+    int contents_esc = contents_len && memchr(*contents, '\x1b', contents_len);
+    if (!prefix_esc && !contents_esc)
+        return NULL;
+
+    /* the text may go to other outputs as well, so it is copied */
+    char *heap = NULL, *out = scratch;
+    if (prefix_len + contents_len + 2 > room) {
+        heap = malloc(prefix_len + contents_len + 2);
+        if (!heap)
+            return NULL;   /* left as it is */
+        out = heap;
+    }
+    if (prefix_esc) {
+        size_t len = log_ansi_strip(out, *prefix, prefix_len);
+        out[len] = '\0';
+        *prefix = out;
+        out += len + 1;
+    }
+    if (contents_esc) {
+        size_t len = log_ansi_strip(out, *contents, contents_len);
+        out[len] = '\0';
+        *contents = out;
+    }
+    return heap;
+}
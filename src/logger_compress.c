@@ -0,0 +1,570 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/****  compressed output to the log file ****/
+
+/* Messages are copied into the active block.  A full block goes to a
+ * background thread, which compresses it and appends it to the log
+ * file as a frame:
+ *
+ *   struct log_lz_frame    magic, sizes, checksum, time of the first message
+ *   packed bytes           LZ4 block format, or the raw block if that is
+ *                          no smaller
+ *
+ * Frames don't depend on each other, so a reader can start at any frame
+ * and find the next one after a damaged stretch by its magic.  Rotation
+ * and appending need nothing special.  The logging threads only wait
+ * when all blocks are queued up for the compressor.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "logger.h"
+#include "logger_internal.h"
+
+#define LOG_LZ_MAGIC "LGZ1"
+
+struct log_lz_frame {
+    char magic[4];
+    uint32_t raw_len;
+    uint32_t packed_len;   /* raw_len: the block is stored as it is */
+    uint32_t checksum;     /* FNV-1a of the raw block */
+    int64_t start_ns;      /* CLOCK_REALTIME of the first message */
+};
+
+#define LOG_COMPRESS_BLOCKS 4
+#define LOG_COMPRESS_MIN_BLOCK (4 * 1024)
+#define LOG_COMPRESS_MAX_BLOCK (64 * 1024 * 1024)
+
+/****  LZ4 block format ****/
+
+#define LOG_LZ_HASH_BITS 14
+#define LOG_LZ_MIN_MATCH 4
+#define LOG_LZ_LAST_LITERALS 5   /* the block ends in at least this many literals */
+#define LOG_LZ_MATCH_LIMIT 12    /* and no match starts closer to its end */
+#define LOG_LZ_MAX_OFFSET 65535
+
+/* Most bytes len bytes can take up */
+#define LOG_LZ_BOUND(len) ((len) + (len) / 255 + 16)
+
+static uint32_t log_lz_read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t log_lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LOG_LZ_HASH_BITS);
+}
+
+static unsigned char *log_lz_length(unsigned char *op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+/* One sequence: literals from anchor, then a match unless offset is 0 */
+static unsigned char *log_lz_sequence(unsigned char *op, const unsigned char *anchor,
+                                      size_t literals, size_t offset, size_t match_len)
+{
+    unsigned char *token = op++;
+
+    *token = (literals >= 15 ? 15 : literals) << 4;
+    if (literals >= 15)
+        op = log_lz_length(op, literals - 15);
+    memcpy(op, anchor, literals);
+    op += literals;
+    if (!offset)
+        return op;
+
+    match_len -= LOG_LZ_MIN_MATCH;
+    *token |= match_len >= 15 ? 15 : match_len;
+    *op++ = offset & 255;
+    *op++ = offset >> 8;
+    if (match_len >= 15)
+        op = log_lz_length(op, match_len - 15);
+    return op;
+}
+
+/* Compress len bytes into dst, which has LOG_LZ_BOUND(len) bytes.
+ * table has 1 << LOG_LZ_HASH_BITS entries.  Returns the packed length. */
+static size_t log_lz_compress(const unsigned char *src, size_t len, unsigned char *dst,
+                              uint32_t *table)
+{
+    const unsigned char *ip = src, *anchor = src, *end = src + len;
+    unsigned char *op = dst;
+
+    memset(table, 0, sizeof(uint32_t) << LOG_LZ_HASH_BITS);
+    if (len > LOG_LZ_MATCH_LIMIT) {
+        const unsigned char *match_limit = end - LOG_LZ_MATCH_LIMIT;
+        unsigned misses = 0;
+
+        while (ip < match_limit) {
+            uint32_t seq = log_lz_read32(ip);
+            uint32_t h = log_lz_hash(seq);
+            const unsigned char *ref = src + table[h];
+
+            table[h] = ip - src;
+            if (ref >= ip || ip - ref > LOG_LZ_MAX_OFFSET || log_lz_read32(ref) != seq) {
+                /* skip faster through data that doesn't compress */
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const unsigned char *mp = ip + LOG_LZ_MIN_MATCH, *rp = ref + LOG_LZ_MIN_MATCH;
+            while (mp < end - LOG_LZ_LAST_LITERALS && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+
+            op = log_lz_sequence(op, anchor, ip - anchor, ip - ref, mp - ip);
+            ip = anchor = mp;
+            if (ip - 2 >= src)
+                table[log_lz_hash(log_lz_read32(ip - 2))] = ip - 2 - src;
+        }
+    }
+    op = log_lz_sequence(op, anchor, end - anchor, 0, 0);
+    return op - dst;
+}
+
+/* Returns the unpacked length, or -1 if src is damaged or dst too small */
+static long log_lz_decompress(const unsigned char *src, size_t len,
+                              unsigned char *dst, size_t room)
+{
+    const unsigned char *ip = src, *iend = src + len;
+    unsigned char *op = dst, *oend = dst + room;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t literals = token >> 4, match_len = token & 15, offset;
+        unsigned b;
+
+        if (literals == 15) {
+            do {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+        if (literals > (size_t)(iend - ip) || literals > (size_t)(oend - op))
+            return -1;
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        if (ip == iend)
+            break;   /* the last sequence has no match */
+
+        if (iend - ip < 2)
+            return -1;
+        offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (!offset || offset > (size_t)(op - dst))
+            return -1;
+        if (match_len == 15) {
+            do {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                match_len += b;
+            } while (b == 255);
+        }
+        match_len += LOG_LZ_MIN_MATCH;
+        if (match_len > (size_t)(oend - op))
+            return -1;
+        for (const unsigned char *ref = op - offset; match_len--; )
+            *op++ = *ref++;   /* byte by byte, the match may overlap */
+    }
+    return op - dst;
+}
+
+static uint32_t log_lz_checksum(const unsigned char *p, size_t len)
+{
+    uint32_t h = 2166136261u;
+    while (len--)
+        h = (h ^ *p++) * 16777619u;
+    return h;
+}
+
+/****  the blocks and the compressor thread ****/
+
+struct log_compress_block {
+    char *data;
+    size_t used;
+    int64_t start_ns;
+    long long start_ms;    /* CLOCK_MONOTONIC, for the flush interval */
+};
+
+static struct log_compress_block log_compress_blocks[LOG_COMPRESS_BLOCKS];
+static struct log_compress_block *log_compress_active = NULL;
+static struct log_compress_block *log_compress_full[LOG_COMPRESS_BLOCKS];
+static struct log_compress_block *log_compress_free[LOG_COMPRESS_BLOCKS];
+static int log_compress_full_count = 0;
+static int log_compress_free_count = 0;
+static int log_compress_writing = 0;    /* the thread has a block out */
+static int log_compress_stopping = 0;
+static size_t log_compress_size = 0;
+static int log_compress_interval_ms = 0;
+
+static pthread_t log_compress_thread;
+static pthread_mutex_t log_compress_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_compress_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t log_compress_room = PTHREAD_COND_INITIALIZER;
+
+/* log_file_compress() runs one at a time */
+static pthread_mutex_t log_compress_config_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static long long log_compress_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* Queue the active block for the compressor and take a free one.
+ * Called with log_compress_mutex held. */
+static void log_compress_hand_over(void)
+{
+    while (!log_compress_free_count)
+        pthread_cond_wait(&log_compress_room, &log_compress_mutex);
+    log_compress_full[log_compress_full_count++] = log_compress_active;
+    log_compress_active = log_compress_free[--log_compress_free_count];
+    log_compress_active->used = 0;
+    pthread_cond_signal(&log_compress_work);
+}
+
+static void log_compress_write(const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t done = write(__atomic_load_n(&log_file_fd, __ATOMIC_ACQUIRE), data, len);
+        if (done <= 0)
+            return;
+        log_file_wrote(done);
+        data += done;
+        len -= done;
+    }
+}
+
+static void log_compress_block_out(struct log_compress_block *block, unsigned char *out,
+                                   uint32_t *table)
+{
+    struct log_lz_frame frame;
+    unsigned char *packed = out + sizeof(frame);
+    const unsigned char *raw = (const unsigned char *)block->data;
+    size_t packed_len = log_lz_compress(raw, block->used, packed, table);
+
+    if (packed_len >= block->used) {
+        memcpy(packed, raw, block->used);
+        packed_len = block->used;
+    }
+    memcpy(frame.magic, LOG_LZ_MAGIC, 4);
+    frame.raw_len = block->used;
+    frame.packed_len = packed_len;
+    frame.checksum = log_lz_checksum(raw, block->used);
+    frame.start_ns = block->start_ns;
+    memcpy(out, &frame, sizeof(frame));
+
+    /* one write per frame, so a rotation never splits one */
+    log_compress_write((const char *)out, sizeof(frame) + packed_len);
+}
+
+static void *log_compress_main(void *unused)
+{
+    size_t size = log_compress_size;
+    unsigned char *out = malloc(sizeof(struct log_lz_frame) + LOG_LZ_BOUND(size));
+    uint32_t *table = malloc(sizeof(uint32_t) << LOG_LZ_HASH_BITS);
+
+    (void)unused;
+    pthread_mutex_lock(&log_compress_mutex);
+    for (;;) {
+        if (log_compress_full_count) {
+            struct log_compress_block *block = log_compress_full[0];
+            memmove(log_compress_full, log_compress_full + 1,
+                    --log_compress_full_count * sizeof(block));
+            log_compress_writing = 1;
+            pthread_mutex_unlock(&log_compress_mutex);
+
+            if (out && table)
+                log_compress_block_out(block, out, table);
+
+            pthread_mutex_lock(&log_compress_mutex);
+            log_compress_free[log_compress_free_count++] = block;
+            log_compress_writing = 0;
+            pthread_cond_broadcast(&log_compress_room);
+            continue;
+        }
+        if (log_compress_stopping)
+            break;
+
+        struct log_compress_block *active = log_compress_active;
+        if (log_compress_interval_ms > 0 && active->used) {
+            long long due = active->start_ms + log_compress_interval_ms;
+            if (log_compress_now_ms() >= due) {
+                log_compress_hand_over();
+                continue;
+            }
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            long long wait_ms = due - log_compress_now_ms();
+            until.tv_sec += wait_ms / 1000;
+            until.tv_nsec += (wait_ms % 1000) * 1000000;
+            if (until.tv_nsec >= 1000000000) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&log_compress_work, &log_compress_mutex, &until);
+        }
+        else
+            pthread_cond_wait(&log_compress_work, &log_compress_mutex);
+    }
+    pthread_mutex_unlock(&log_compress_mutex);
+    free(out);
+    free(table);
+    return NULL;
+}
+
+void log_compress_flush(void)
+{
+    if (!__atomic_load_n(&log_compress_size, __ATOMIC_ACQUIRE))
+        return;
+
+    pthread_mutex_lock(&log_compress_mutex);
+    if (log_compress_active && log_compress_active->used)
+        log_compress_hand_over();
+    while (log_compress_full_count || log_compress_writing)
+        pthread_cond_wait(&log_compress_room, &log_compress_mutex);
+    pthread_mutex_unlock(&log_compress_mutex);
+}
+
+void log_file_compress(size_t block_size, int flush_interval_ms)
+{
+    pthread_mutex_lock(&log_compress_config_mutex);
+
+    if (__atomic_load_n(&log_compress_size, __ATOMIC_ACQUIRE)) {
+        log_compress_flush();
+        pthread_mutex_lock(&log_compress_mutex);
+        log_compress_stopping = 1;
+        pthread_cond_signal(&log_compress_work);
+        pthread_mutex_unlock(&log_compress_mutex);
+        pthread_join(log_compress_thread, NULL);
+
+        /* writers that still come in go to log_print_to_file */
+        pthread_mutex_lock(&log_compress_mutex);
+        __atomic_store_n(&log_compress_size, 0, __ATOMIC_RELEASE);
+        for (int i = 0; i < LOG_COMPRESS_BLOCKS; i++) {
+            free(log_compress_blocks[i].data);
+            log_compress_blocks[i].data = NULL;
+        }
+        log_compress_active = NULL;
+        pthread_mutex_unlock(&log_compress_mutex);
+    }
+
+    if (block_size) {
+        if (block_size < LOG_COMPRESS_MIN_BLOCK)
+            block_size = LOG_COMPRESS_MIN_BLOCK;
+        if (block_size > LOG_COMPRESS_MAX_BLOCK)
+            block_size = LOG_COMPRESS_MAX_BLOCK;
+
+        pthread_mutex_lock(&log_compress_mutex);
+        int ok = 1;
+        for (int i = 0; i < LOG_COMPRESS_BLOCKS; i++) {
+            log_compress_blocks[i].data = malloc(block_size);
+            log_compress_blocks[i].used = 0;
+            ok &= log_compress_blocks[i].data != NULL;
+            log_compress_free[i] = &log_compress_blocks[i + 1 < LOG_COMPRESS_BLOCKS ? i + 1 : 0];
+        }
+        log_compress_active = &log_compress_blocks[0];
+        log_compress_free_count = LOG_COMPRESS_BLOCKS - 1;
+        log_compress_full_count = 0;
+        log_compress_stopping = 0;
+        log_compress_interval_ms = flush_interval_ms;
+        log_compress_size = block_size;
+        if (!ok || pthread_create(&log_compress_thread, NULL, log_compress_main, NULL)) {
+            for (int i = 0; i < LOG_COMPRESS_BLOCKS; i++) {
+                free(log_compress_blocks[i].data);
+                log_compress_blocks[i].data = NULL;
+            }
+            log_compress_active = NULL;
+            log_compress_size = 0;
+        }
+        __atomic_store_n(&log_compress_size, log_compress_size, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&log_compress_mutex);
+    }
+
+    pthread_mutex_unlock(&log_compress_config_mutex);
+}
+
+void log_print_to_file_compressed(char *prefix, char *contents)
+{
+    if (!__atomic_load_n(&log_compress_size, __ATOMIC_ACQUIRE) || log_bin_is_active()) {
+        log_print_to_file(prefix, contents);
+        return;
+    }
+
+    if (!prefix)
+        prefix = "(null)";
+    if (!contents)
+        contents = "(null)";
+    char plain[LOG_RECORD_SIZE];
+    char *spill = log_color_plain(&prefix, &contents, plain, sizeof(plain));
+    size_t prefix_len = strlen(prefix);
+    size_t contents_len = strlen(contents);
+
+    pthread_mutex_lock(&log_compress_mutex);
+    if (!log_compress_active) {   /* switched off meanwhile */
+        pthread_mutex_unlock(&log_compress_mutex);
+        log_print_to_file(prefix, contents);
+        free(spill);
+        return;
+    }
+
+    /* a message bigger than a whole block is cut short */
+    size_t size = log_compress_size;
+    if (prefix_len + contents_len + 2 > size) {
+        if (prefix_len + 2 > size)
+            prefix_len = size - 2;
+        contents_len = size - prefix_len - 2;
+    }
+    size_t len = prefix_len + 1 + contents_len + 1;
+
+    if (size - log_compress_active->used < len)
+        log_compress_hand_over();
+    struct log_compress_block *block = log_compress_active;
+    if (!block->used) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        block->start_ns = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        block->start_ms = log_compress_now_ms();
+        if (log_compress_interval_ms > 0)
+            pthread_cond_signal(&log_compress_work);   /* start the clock */
+    }
+    char *p = block->data + block->used;
+    memcpy(p, prefix, prefix_len);      p += prefix_len;
+    *p++ = ' ';
+    memcpy(p, contents, contents_len);  p += contents_len;
+    *p = '\n';
+    block->used += len;
+    pthread_mutex_unlock(&log_compress_mutex);
+    free(spill);
+}
+
+/****  reading ****/
+
+/* Read len bytes at offset, returns 0 if the file ends first */
+static int log_compress_pread(int fd, void *into, size_t len, off_t offset)
+{
+    char *p = into;
+    while (len > 0) {
+        ssize_t got = pread(fd, p, len, offset);
+        if (got <= 0)
+            return 0;
+        p += got;
+        len -= got;
+        offset += got;
+    }
+    return 1;
+}
+
+/* The offset of the next frame magic at or after 'from', -1 if none */
+static off_t log_compress_find(int fd, off_t from)
+{
+    char chunk[64 * 1024];
+
+    for (;;) {
+        ssize_t got = pread(fd, chunk, sizeof(chunk), from);
+        if (got < 4)
+            return -1;
+        char *hit = memmem(chunk, got, LOG_LZ_MAGIC, 4);
+        if (hit)
+            return from + (hit - chunk);
+        from += got - 3;   /* a magic may straddle the chunks */
+    }
+}
+
+long log_compressed_read(int fd, long long from,
+                         void (*frame)(const struct log_compressed_frame *info,
+                                       const char *text))
+{
+    unsigned char *packed = NULL, *raw = NULL;
+    size_t packed_size = 0, raw_size = 0;
+    long frames = 0;
+    off_t pos = from;
+
+    for (;;) {
+        struct log_lz_frame header;
+
+        pos = log_compress_find(fd, pos);
+        if (pos < 0 || !log_compress_pread(fd, &header, sizeof(header), pos))
+            break;
+        if (header.raw_len > LOG_COMPRESS_MAX_BLOCK ||
+            header.packed_len > LOG_LZ_BOUND(header.raw_len)) {
+            pos++;   /* not a frame after all */
+            continue;
+        }
+
+        if (packed_size < header.packed_len) {
+            unsigned char *bigger = realloc(packed, header.packed_len);
+            if (!bigger)
+                break;
+            packed = bigger;
+            packed_size = header.packed_len;
+        }
+        if (raw_size < header.raw_len + 1) {
+            unsigned char *bigger = realloc(raw, header.raw_len + 1);
+            if (!bigger)
+                break;
+            raw = bigger;
+            raw_size = header.raw_len + 1;
+        }
+        if (!log_compress_pread(fd, packed, header.packed_len, pos + sizeof(header)))
+            break;   /* cut off, the program was killed while writing it */
+
+        long len = header.raw_len;
+        if (header.packed_len == header.raw_len)
+            memcpy(raw, packed, len);
+        else
+            len = log_lz_decompress(packed, header.packed_len, raw, header.raw_len);
+        if (len != (long)header.raw_len || log_lz_checksum(raw, len) != header.checksum) {
+            pos++;
+            continue;
+        }
+        raw[len] = '\0';
+
+        struct log_compressed_frame info = { pos, header.start_ns,
+                                             header.raw_len, header.packed_len };
+        frame(&info, (const char *)raw);
+        frames++;
+        pos += sizeof(header) + header.packed_len;
+    }
+    free(packed);
+    free(raw);
+    return frames ? frames : -1;
+}
@@ -0,0 +1,729 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/****  flight recorder: the last messages of every thread, in memory ****/
+
+/* Every thread owns a ring of fixed size slots.  A slot holds the call
+ * site, the time, the level and the raw arguments in the binary log
+ * layout; nothing is formatted until the ring is dumped.  Only the
+ * owner writes its ring, so recording takes no lock.  Readers check
+ * the sequence number of a slot before and after copying it and skip
+ * the ones that were being written meanwhile.
+ *
+ * Rings are never freed, a finished thread's ring goes to the next new
+ * thread.  That keeps the list safe to walk from a signal handler, and
+ * the dump code there only uses write() and its own formatting.  Each
+ * ring comes with an alternate signal stack for its thread, so a crash
+ * from running out of stack gets dumped as well.
+ */
+
+#include <math.h>      // isnan, isinf
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "logger.h"
+#include "logger_internal.h"
+
+#define LOG_FLIGHT_SLOT_SIZE 256
+#define LOG_FLIGHT_MIN_SLOTS 16
+
+/* slot len of a message whose arguments couldn't be recorded */
+#define LOG_FLIGHT_NO_ARGS 0xffffffffu
+
+/* Room for the crash handler, which formats the dump on its stack */
+#define LOG_FLIGHT_STACK_SIZE (64 * 1024 + 4 * LOG_RECORD_SIZE)
+
+struct log_flight_slot {
+    uint64_t seq;                        /* index + 1 once written, 0 while writing */
+    struct log_callsite *site;
+    int64_t ns;                          /* CLOCK_REALTIME */
+    int32_t level;
+    uint32_t len;                        /* bytes in args */
+    char args[LOG_FLIGHT_SLOT_SIZE - 32];
+};
+
+struct log_flight_ring {
+    struct log_flight_ring *next;
+    int owned;          /* a live thread records into it */
+    int tid;
+    uint64_t head;      /* index of the next slot to write */
+    uint64_t first;     /* the first record of the current owner */
+    uint64_t dumped;    /* records before this went out with LOG_ERR */
+    char *stack;        /* the owner's alternate signal stack */
+    size_t stack_size;
+    size_t mask;
+    struct log_flight_slot slots[];
+};
+
+int log_flight_active = 0;
+
+static size_t log_flight_slots = 0;
+static int log_flight_records = 0;
+static int log_flight_options = 0;
+static struct log_flight_ring *log_flight_rings = NULL;
+static pthread_mutex_t log_flight_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t log_flight_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_flight_key;
+static __thread struct log_flight_ring *log_flight_mine = NULL;
+static __thread int log_flight_dumping = 0;
+
+static const int log_flight_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+#define LOG_FLIGHT_SIGNAL_COUNT ((int)(sizeof(log_flight_signals) / sizeof(int)))
+static struct sigaction log_flight_old_actions[LOG_FLIGHT_SIGNAL_COUNT];
+static int log_flight_handlers_set = 0;
+static int log_flight_crashing = 0;
+
+/****  recording ****/
+
+/* The crash handlers run with SA_ONSTACK.  Give the thread the stack of
+ * its ring, unless it has an alternate stack of its own already. */
+static void log_flight_stack(struct log_flight_ring *ring)
+{
+    stack_t ss;
+
+    if (sigaltstack(NULL, &ss) == -1 || !(ss.ss_flags & SS_DISABLE))
+        return;
+    if (!ring->stack) {
+        size_t size = LOG_FLIGHT_STACK_SIZE;
+        if (size < (size_t)SIGSTKSZ)
+            size = SIGSTKSZ;
+        if (!(ring->stack = malloc(size)))
+            return;
+        ring->stack_size = size;
+    }
+    ss.ss_sp = ring->stack;
+    ss.ss_size = ring->stack_size;
+    ss.ss_flags = 0;
+    sigaltstack(&ss, NULL);
+}
+
+static void log_flight_thread_exit(void *mine)
+{
+    struct log_flight_ring *ring = mine;
+    stack_t ss;
+
+    /* the stack goes to the next owner of the ring */
+    if (ring->stack && sigaltstack(NULL, &ss) == 0 && ss.ss_sp == ring->stack) {
+        ss.ss_flags = SS_DISABLE;
+        sigaltstack(&ss, NULL);
+    }
+    __atomic_store_n(&ring->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void log_flight_make_key(void)
+{
+    pthread_key_create(&log_flight_key, log_flight_thread_exit);
+}
+
+static struct log_flight_ring *log_flight_ring(void)
+{
+    size_t slots = __atomic_load_n(&log_flight_slots, __ATOMIC_RELAXED);
+    struct log_flight_ring *ring;
+
+    if (!slots)
+        return NULL;
+    pthread_once(&log_flight_once, log_flight_make_key);
+
+    /* a ring of a finished thread, or a new one */
+    for (ring = __atomic_load_n(&log_flight_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        int free_ring = 0;
+        if (ring->mask == slots - 1 &&
+            __atomic_compare_exchange_n(&ring->owned, &free_ring, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (!ring) {
+        ring = calloc(1, sizeof(*ring) + slots * sizeof(struct log_flight_slot));
+        if (!ring)
+            return NULL;
+        ring->mask = slots - 1;
+        ring->owned = 1;
+        ring->next = __atomic_load_n(&log_flight_rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&log_flight_rings, &ring->next, ring, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    ring->tid = syscall(SYS_gettid);
+    ring->first = ring->dumped = ring->head;
+    log_flight_stack(ring);
+
+    pthread_setspecific(log_flight_key, ring);
+    log_flight_mine = ring;
+    return ring;
+}
+
+/* The argument types of the site, parsed on its first message */
+static int log_flight_parse(struct log_callsite *site)
+{
+    unsigned char types[LOG_SITE_MAX_ARGS];
+    int count = log_fmt_args(site->fmt, types, LOG_SITE_MAX_ARGS);
+
+    /* threads racing here write the same bytes */
+    if (count >= 0)
+        memcpy(site->arg_types, types, count);
+    count = count < 0 ? -1 : count + 1;
+    __atomic_store_n(&site->arg_count, count, __ATOMIC_RELEASE);
+    return count;
+}
+
+void log_flight_record(struct log_callsite *site, int level, va_list argp)
+{
+    struct log_flight_ring *ring = log_flight_mine ? log_flight_mine : log_flight_ring();
+    if (!ring)
+        return;
+
+    int count = __atomic_load_n(&site->arg_count, __ATOMIC_ACQUIRE);
+    if (!count)
+        count = log_flight_parse(site);
+
+    uint64_t index = ring->head;
+    struct log_flight_slot *slot = &ring->slots[index & ring->mask];
+    struct timespec ts;
+
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    slot->site = site;
+    slot->ns = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    slot->level = level;
+    char *end = NULL;
+    if (count > 0) {
+        va_list args;
+        va_copy(args, argp);
+        end = log_args_encode(slot->args, slot->args + sizeof(slot->args),
+                              site->arg_types, count - 1, &args);
+        va_end(args);
+    }
+    slot->len = end ? (uint32_t)(end - slot->args) : LOG_FLIGHT_NO_ARGS;
+
+    __atomic_store_n(&slot->seq, index + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->head, index + 1, __ATOMIC_RELEASE);
+}
+
+/****  formatting, without anything that isn't async-signal-safe ****/
+
+struct log_flight_text {
+    char *p;
+    char *end;   /* one byte is kept for the terminating NUL */
+};
+
+static void log_flight_put(struct log_flight_text *t, const char *s, size_t len)
+{
+    while (len-- && t->p < t->end)
+        *t->p++ = *s++;
+}
+
+static void log_flight_puts(struct log_flight_text *t, const char *s)
+{
+    log_flight_put(t, s, strlen(s));
+}
+
+/* Digits of u in base, backwards from the end of buf, returns the start */
+static char *log_flight_digits(char *end, unsigned long long u, int base, int upper)
+{
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char *p = end;
+
+    do {
+        *--p = digits[u % base];
+        u /= base;
+    } while (u);
+    return p;
+}
+
+/* A converted field, with its sign, padded to width */
+static void log_flight_field(struct log_flight_text *t, const char *sign,
+                             const char *s, size_t len, int width, int left, int zero)
+{
+    size_t sign_len = strlen(sign);
+    int pad = width - (int)(sign_len + len);
+
+    if (!left && !zero)
+        for (; pad > 0; pad--)
+            log_flight_put(t, " ", 1);
+    log_flight_put(t, sign, sign_len);
+    if (!left && zero)
+        for (; pad > 0; pad--)
+            log_flight_put(t, "0", 1);
+    log_flight_put(t, s, len);
+    for (; pad > 0; pad--)
+        log_flight_put(t, " ", 1);
+}
+
+/* v >= 0 with prec decimals, returns the start of the text before end */
+static char *log_flight_fixed(char *end, double v, int prec)
+{
+    unsigned long long scale = 1;
+
+    for (int i = 0; i < prec; i++)
+        scale *= 10;
+    unsigned long long whole = (unsigned long long)v;
+    unsigned long long frac = (unsigned long long)((v - whole) * scale + 0.5);
+    if (frac >= scale) {
+        whole++;
+        frac -= scale;
+    }
+
+    char *p = end;
+    if (prec > 0) {
+        for (int i = 0; i < prec; i++) {
+            *--p = '0' + frac % 10;
+            frac /= 10;
+        }
+        *--p = '.';
+    }
+    return log_flight_digits(p, whole, 10, 0);
+}
+
+/* %f, %e and %g, close to what printf makes of them */
+static size_t log_flight_double(char *out, double v, int prec, char conv)
+{
+    char buf[64], *end = buf + sizeof(buf), *p;
+    int exponent = 0, g = conv == 'g' || conv == 'G' || conv == 'a' || conv == 'A';
+    int scientific = conv == 'e' || conv == 'E';
+
+    if (isnan(v) || isinf(v)) {
+        strcpy(out, isnan(v) ? "nan" : "inf");
+        return 3;
+    }
+    if (prec < 0)
+        prec = 6;
+    if (prec > 17)
+        prec = 17;
+    if (g || v >= 1e18)
+        scientific |= v >= 1e18 || (v != 0 && (v < 1e-4 || v >= 1e15));
+
+    if (scientific) {
+        while (v >= 10) {
+            v /= 10;
+            exponent++;
+        }
+        while (v != 0 && v < 1) {
+            v *= 10;
+            exponent--;
+        }
+    }
+    if (g)   /* significant digits, not decimals */
+        prec = scientific ? (prec ? prec - 1 : 0) : 6;
+
+    p = log_flight_fixed(end, v, prec);
+    if (scientific && end - p > 1 && p[0] == '1' && p[1] == '0' && v >= 9.5) {
+        /* rounded up to 10.0...: one more power of ten */
+        p = log_flight_fixed(end, v / 10, prec);
+        exponent++;
+    }
+    size_t len = end - p;
+    memcpy(out, p, len);
+
+    if (g && memchr(out, '.', len)) {   /* %g drops trailing zeros */
+        while (out[len - 1] == '0')
+            len--;
+        if (out[len - 1] == '.')
+            len--;
+    }
+    if (scientific) {
+        char digits[8], *d = log_flight_digits(digits + sizeof(digits),
+                                                exponent < 0 ? -exponent : exponent, 10, 0);
+        out[len++] = (conv == 'E' || conv == 'G' || conv == 'A') ? 'E' : 'e';
+        out[len++] = exponent < 0 ? '-' : '+';
+        if (digits + sizeof(digits) - d < 2)
+            out[len++] = '0';
+        memcpy(out + len, d, digits + sizeof(digits) - d);
+        len += digits + sizeof(digits) - d;
+    }
+    return len;
+}
+
+/* Render fmt with the raw arguments, as far as they go */
+static void log_flight_format(struct log_flight_text *t, const char *fmt,
+                              const char *args, const char *end)
+{
+#define LOG_FLIGHT_TAKE(var, size)                                             \
+    do {                                                                       \
+        if (args + (size) > end)                                               \
+            return;                                                            \
+        memcpy(&(var), args, size);                                            \
+        args += (size);                                                        \
+    } while (0)
+
+    for (const char *p = fmt; *p; ) {
+        if (*p != '%' || p[1] == '%') {
+            log_flight_put(t, p, 1);
+            p += (*p == '%') ? 2 : 1;
+            continue;
+        }
+
+        int type, stars, left = 0, zero = 0, plus = 0, space = 0, width = 0, prec = -1;
+        const char *spec_end = log_fmt_spec(p + 1, &type, &stars);
+        const char *q = p + 1;
+
+        for (; *q && strchr("-+ #0'I", *q); q++) {
+            left |= *q == '-';
+            zero |= *q == '0';
+            plus |= *q == '+';
+            space |= *q == ' ';
+        }
+        if (*q == '*') {
+            LOG_FLIGHT_TAKE(width, 4);
+            if (width < 0) {
+                left = 1;
+                width = -width;
+            }
+            q++;
+        }
+        for (; *q >= '0' && *q <= '9'; q++)
+            width = width * 10 + *q - '0';
+        if (*q == '.') {
+            prec = 0;
+            if (*++q == '*') {
+                LOG_FLIGHT_TAKE(prec, 4);
+                q++;
+            }
+            for (; *q >= '0' && *q <= '9'; q++)
+                prec = prec * 10 + *q - '0';
+        }
+        char conv = spec_end > p + 1 ? spec_end[-1] : '\0';
+        p = spec_end;
+
+        char buf[80], *digits_end = buf + sizeof(buf), *s = buf;
+        const char *sign = "";
+        size_t len = 0;
+
+        switch (type) {
+            case(LOG_ARG_INT):
+            case(LOG_ARG_LONG): {
+                long long v = 0;
+                if (type == LOG_ARG_INT) {
+                    int i;
+                    LOG_FLIGHT_TAKE(i, 4);
+                    v = (conv == 'd' || conv == 'i') ? (long long)i : (long long)(unsigned)i;
+                }
+                else
+                    LOG_FLIGHT_TAKE(v, 8);
+                if (conv == 'c') {
+                    buf[0] = (char)v;
+                    len = 1;
+                    break;
+                }
+                unsigned long long u = v;
+                if (conv == 'd' || conv == 'i') {
+                    if (v < 0) {
+                        u = -(unsigned long long)v;
+                        sign = "-";
+                    }
+                    else
+                        sign = plus ? "+" : space ? " " : "";
+                }
+                int base = (conv == 'x' || conv == 'X') ? 16 : conv == 'o' ? 8 : 10;
+                s = log_flight_digits(digits_end, u, base, conv == 'X');
+                len = digits_end - s;
+                break;
+            }
+            case(LOG_ARG_DOUBLE):
+            case(LOG_ARG_LDOUBLE): {
+                double v;
+                if (type == LOG_ARG_LDOUBLE) {
+                    long double l;
+                    LOG_FLIGHT_TAKE(l, sizeof(l));
+                    v = (double)l;
+                }
+                else
+                    LOG_FLIGHT_TAKE(v, 8);
+                if (signbit(v)) {
+                    v = -v;
+                    sign = "-";
+                }
+                else
+                    sign = plus ? "+" : space ? " " : "";
+                len = log_flight_double(buf, v, prec, conv);
+                break;
+            }
+            case(LOG_ARG_POINTER): {
+                uint64_t v;
+                LOG_FLIGHT_TAKE(v, 8);
+                if (!v) {
+                    s = "(nil)";
+                    len = 5;
+                    break;
+                }
+                s = log_flight_digits(digits_end, v, 16, 0);
+                *--s = 'x';
+                *--s = '0';
+                len = digits_end - s;
+                break;
+            }
+            case(LOG_ARG_STRING): {
+                uint32_t slen;
+                LOG_FLIGHT_TAKE(slen, 4);
+                if (slen == 0 || args + slen > end)
+                    return;
+                s = (char *)args;
+                len = slen - 1;
+                if (prec >= 0 && (size_t)prec < len)
+                    len = prec;
+                args += slen;
+                zero = 0;
+                break;
+            }
+            default:   /* %n */
+                continue;
+        }
+        log_flight_field(t, sign, s, len, width, left, zero && !left);
+    }
+#undef LOG_FLIGHT_TAKE
+}
+
+/* 2026-10-18T02:47:12.123456Z, worked out by hand: localtime isn't
+ * async-signal-safe */
+static void log_flight_time(struct log_flight_text *t, int64_t ns)
+{
+    int64_t secs = ns / 1000000000, days = secs / 86400, rest = secs % 86400;
+    char buf[40], *end = buf + sizeof(buf);
+
+    /* days since 1970-01-01 to a civil date, after H. Hinnant */
+    int64_t z = days + 719468, era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = (unsigned)(z - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    unsigned day = doy - (153 * mp + 2) / 5 + 1;
+    unsigned month = mp < 10 ? mp + 3 : mp - 9;
+    int64_t year = (int64_t)yoe + era * 400 + (month <= 2);
+    unsigned long long parts[] = { year, month, day, rest / 3600, rest % 3600 / 60,
+                                   rest % 60, (ns % 1000000000) / 1000 };
+    static const char after[] = "--T::.Z";
+    static const int widths[] = { 4, 2, 2, 2, 2, 2, 6 };
+
+    for (int i = 0; i < 7; i++) {
+        char *d = log_flight_digits(end, parts[i], 10, 0);
+        for (int n = end - d; n < widths[i]; n++)
+            log_flight_put(t, "0", 1);
+        log_flight_put(t, d, end - d);
+        log_flight_put(t, &after[i], 1);
+    }
+}
+
+/* Render one record into prefix and contents, of LOG_RECORD_SIZE / 2
+ * and LOG_RECORD_SIZE bytes */
+static void log_flight_render(const struct log_flight_slot *slot, char *prefix,
+                              char *contents)
+{
+    const struct log_callsite *site = slot->site;
+    struct log_flight_text t = { prefix, prefix + LOG_RECORD_SIZE / 2 - 1 };
+    char number[24], *end = number + sizeof(number), *d;
+
+    log_flight_puts(&t, "FLIGHT ");
+    log_flight_time(&t, slot->ns);
+    log_flight_puts(&t, " ");
+    log_flight_puts(&t, site->name);
+    for (size_t n = strlen(site->name); n < 10; n++)
+        log_flight_put(&t, " ", 1);
+    log_flight_puts(&t, " ");
+    log_flight_puts(&t, site->filename);
+    log_flight_puts(&t, ":");
+    d = log_flight_digits(end, site->linenum, 10, 0);
+    log_flight_put(&t, d, end - d);
+    log_flight_puts(&t, " ");
+    log_flight_puts(&t, site->function);
+    log_flight_puts(&t, "()");
+    *t.p = '\0';
+
+    t.p = contents;
+    t.end = contents + LOG_RECORD_SIZE - 1;
+    if (slot->len == LOG_FLIGHT_NO_ARGS)
+        log_flight_puts(&t, site->fmt);   /* the arguments weren't kept */
+    else
+        log_flight_format(&t, site->fmt, slot->args, slot->args + slot->len);
+    *t.p = '\0';
+}
+
+/****  dumping ****/
+
+/* Go through the records of a ring from 'from' on, copying each slot
+ * first so a record being overwritten is skipped rather than torn */
+static void log_flight_dump_ring(struct log_flight_ring *ring, uint64_t from, uint64_t to,
+                                 void (*emit)(int level, char *prefix, char *contents))
+{
+    struct log_flight_slot copy;
+    char prefix[LOG_RECORD_SIZE / 2], contents[LOG_RECORD_SIZE];
+
+    for (uint64_t i = from; i < to; i++) {
+        struct log_flight_slot *slot = &ring->slots[i & ring->mask];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != i + 1)
+            continue;
+        memcpy(&copy, slot, sizeof(copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != i + 1)
+            continue;
+        log_flight_render(&copy, prefix, contents);
+        emit(copy.level, prefix, contents);
+    }
+}
+
+/* Dump every ring, only what came after the last LOG_ERR dump if asked */
+static void log_flight_dump_all(int new_only, void (*emit)(int level, char *prefix, char *contents))
+{
+    for (struct log_flight_ring *ring = __atomic_load_n(&log_flight_rings, __ATOMIC_ACQUIRE);
+         ring; ring = ring->next) {
+        uint64_t to = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t from = ring->first;
+        uint64_t records = __atomic_load_n(&log_flight_records, __ATOMIC_RELAXED);
+
+        if (to - from > ring->mask + 1)
+            from = to - (ring->mask + 1);
+        if (to - from > records)
+            from = to - records;
+        if (new_only && ring->dumped > from)
+            from = ring->dumped;
+        if (new_only)
+            ring->dumped = to;
+        if (from >= to)
+            continue;
+
+        char prefix[64], contents[96], number[24], *end = number + sizeof(number), *d;
+        struct log_flight_text t = { contents, contents + sizeof(contents) - 1 };
+        log_flight_puts(&t, "thread ");
+        d = log_flight_digits(end, ring->tid, 10, 0);
+        log_flight_put(&t, d, end - d);
+        log_flight_puts(&t, ", the last ");
+        d = log_flight_digits(end, to - from, 10, 0);
+        log_flight_put(&t, d, end - d);
+        log_flight_puts(&t, " records");
+        *t.p = '\0';
+        strcpy(prefix, "FLIGHT RECORDER");
+        emit(0, prefix, contents);
+        log_flight_dump_ring(ring, from, to, emit);
+    }
+}
+
+static void log_flight_emit(int level, char *prefix, char *contents)
+{
+    log_deliver(level, prefix, contents);
+}
+
+static void log_flight_dump_locked(int new_only)
+{
+    log_flight_dumping = 1;
+    pthread_mutex_lock(&log_flight_mutex);
+    log_flight_dump_all(new_only, log_flight_emit);
+    pthread_mutex_unlock(&log_flight_mutex);
+    log_flight_dumping = 0;
+}
+
+void log_flight_dump(void)
+{
+    if (!log_flight_dumping)
+        log_flight_dump_locked(0);
+}
+
+void log_flight_error(void)
+{
+    if (!log_flight_dumping &&
+        (__atomic_load_n(&log_flight_options, __ATOMIC_RELAXED) & LOG_FLIGHT_DUMP_ON_ERROR))
+        log_flight_dump_locked(1);
+}
+
+/****  crashes ****/
+
+static int log_flight_crash_fd = 2;
+
+static void log_flight_write(int level, char *prefix, char *contents)
+{
+    char line[LOG_RECORD_SIZE * 2];
+    size_t prefix_len = strlen(prefix), contents_len = strlen(contents);
+
+    (void)level;
+    memcpy(line, prefix, prefix_len);
+    line[prefix_len] = ' ';
+    memcpy(line + prefix_len + 1, contents, contents_len);
+    line[prefix_len + 1 + contents_len] = '\n';
+    for (size_t done = 0, len = prefix_len + contents_len + 2; done < len; ) {
+        ssize_t n = write(log_flight_crash_fd, line + done, len - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+}
+
+static void log_flight_crash(int sig)
+{
+    int i;
+
+    if (!__atomic_exchange_n(&log_flight_crashing, 1, __ATOMIC_SEQ_CST)) {
+        int fd = log_file_text_fd();
+        log_flight_crash_fd = fd >= 0 ? fd : STDERR_FILENO;
+        log_flight_dump_all(0, log_flight_write);
+    }
+    /* let whatever handled the signal before us have it */
+    for (i = 0; i < LOG_FLIGHT_SIGNAL_COUNT; i++)
+        if (log_flight_signals[i] == sig)
+            sigaction(sig, &log_flight_old_actions[i], NULL);
+    raise(sig);
+}
+
+/* Called with log_flight_mutex held */
+static void log_flight_handlers(int on)
+{
+    if (on == log_flight_handlers_set)
+        return;
+    for (int i = 0; i < LOG_FLIGHT_SIGNAL_COUNT; i++) {
+        if (on) {
+            struct sigaction action;
+            memset(&action, 0, sizeof(action));
+            action.sa_handler = log_flight_crash;
+            action.sa_flags = SA_ONSTACK;
+            sigemptyset(&action.sa_mask);
+            sigaction(log_flight_signals[i], &action, &log_flight_old_actions[i]);
+        }
+        else
+            sigaction(log_flight_signals[i], &log_flight_old_actions[i], NULL);
+    }
+    log_flight_handlers_set = on;
+}
+
+void log_flight_start(size_t ring_bytes, int dump_records, int options)
+{
+    size_t slots = LOG_FLIGHT_MIN_SLOTS;
+
+    while (slots * sizeof(struct log_flight_slot) < ring_bytes)
+        slots *= 2;
+
+    pthread_mutex_lock(&log_flight_mutex);
+    __atomic_store_n(&log_flight_slots, slots, __ATOMIC_RELAXED);
+    __atomic_store_n(&log_flight_records, dump_records, __ATOMIC_RELAXED);
+    __atomic_store_n(&log_flight_options, options, __ATOMIC_RELAXED);
+    log_flight_handlers(!!(options & LOG_FLIGHT_DUMP_ON_CRASH));
+    __atomic_store_n(&log_flight_active, 1, __ATOMIC_RELEASE);
+    __atomic_or_fetch(&log_sites_wanted, LOG_WANTED_FLIGHT, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&log_flight_mutex);
+}
+
+void log_flight_stop(void)
+{
+    pthread_mutex_lock(&log_flight_mutex);
+    __atomic_and_fetch(&log_sites_wanted, ~LOG_WANTED_FLIGHT, __ATOMIC_RELEASE);
+    __atomic_store_n(&log_flight_active, 0, __ATOMIC_RELEASE);
+    log_flight_handlers(0);
+    pthread_mutex_unlock(&log_flight_mutex);
+}
@@ -0,0 +1,189 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/****  sidecar index of the log file ****/
+
+/* Next to each log file lies name.idx: a header, then an entry for
+ * every block of about log_index_block bytes of messages, saying where
+ * the block is, when its messages were written, which levels they have
+ * and, in a small bloom filter, which source files they came from.  A
+ * message is written and counted under log_index_mutex, so the offsets
+ * are exact.  While the file is swapped underneath there is no index:
+ * whatever is written meanwhile is either at the end of the old file,
+ * after its last entry, or before the first entry of the new one.
+ */
+
+#include <limits.h>    // PATH_MAX
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "logger.h"
+#include "logger_internal.h"
+
+int log_index_active = 0;
+
+static size_t log_index_block = 0;
+static int log_index_fd = -1;
+static unsigned long long log_index_offset = 0;   /* the end of the log file */
+static struct log_index_entry log_index_entry;   /* the block being filled */
+static pthread_mutex_t log_index_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+__thread const char *log_output_file = NULL;
+
+unsigned long long log_index_file_bits(const char *filename)
+{
+    const char *slash = filename ? strrchr(filename, '/') : NULL;
+    unsigned long long hash = 14695981039346656037ULL;
+
+    if (!filename)
+        return 0;
+    for (const char *p = slash ? slash + 1 : filename; *p; p++)
+        hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+    return (1ULL << (hash & 63)) | (1ULL << ((hash >> 6) & 63));
+}
+
+unsigned long long log_index_level_bit(int level)
+{
+    return 1ULL << ((unsigned)level < 63 ? (unsigned)level : 63);
+}
+
+/* Write out the block being filled, under the mutex */
+static void log_index_put(void)
+{
+    if (!log_index_entry.count)
+        return;
+    if (log_index_fd != -1 &&
+        write(log_index_fd, &log_index_entry, sizeof(log_index_entry)) != sizeof(log_index_entry))
+        fprintf(stderr, "Couldn't write the log file index.\n");
+    memset(&log_index_entry, 0, sizeof(log_index_entry));
+}
+
+void log_index_open(const char *log_name, int fd)
+{
+    char name[PATH_MAX];
+    struct stat statbuf;
+
+    if (!__atomic_load_n(&log_index_active, __ATOMIC_ACQUIRE))
+        return;
+    snprintf(name, sizeof(name), "%s.idx", log_name);
+
+    pthread_mutex_lock(&log_index_mutex);
+    if (log_index_fd != -1) {
+        log_index_put();
+        close(log_index_fd);
+    }
+    log_index_fd = open(name, O_CREAT | O_WRONLY | O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (log_index_fd == -1)
+        fprintf(stderr, "Couldn't open the log file index %s\n", name);
+    else if (fstat(log_index_fd, &statbuf) == 0 && statbuf.st_size == 0) {
+        struct log_index_header header = { LOG_INDEX_MAGIC, sizeof(struct log_index_entry),
+                                           log_index_block };
+        if (write(log_index_fd, &header, sizeof(header)) != sizeof(header))
+            fprintf(stderr, "Couldn't write the log file index %s\n", name);
+    }
+    /* messages written before an append start after them */
+    log_index_offset = fstat(fd, &statbuf) == 0 ? (unsigned long long)statbuf.st_size : 0;
+    memset(&log_index_entry, 0, sizeof(log_index_entry));
+    pthread_mutex_unlock(&log_index_mutex);
+}
+
+void log_index_close(void)
+{
+    pthread_mutex_lock(&log_index_mutex);
+    if (log_index_fd != -1) {
+        log_index_put();
+        close(log_index_fd);
+        log_index_fd = -1;
+    }
+    pthread_mutex_unlock(&log_index_mutex);
+}
+
+long log_index_writev(int fd, const struct iovec *iov, int count)
+{
+    struct timespec ts;
+
+    pthread_mutex_lock(&log_index_mutex);
+    long written = writev(fd, iov, count);
+    if (written > 0 && log_index_fd != -1) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        long long ns = (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        struct log_index_entry *entry = &log_index_entry;
+
+        if (!entry->count) {
+            entry->offset = log_index_offset;
+            entry->first_ns = entry->last_ns = ns;
+        }
+        if (ns < entry->first_ns)
+            entry->first_ns = ns;
+        if (ns > entry->last_ns)
+            entry->last_ns = ns;
+        entry->levels |= log_index_level_bit(log_current_level());
+        entry->files |= log_index_file_bits(log_output_file);
+        entry->length += written;
+        entry->count++;
+        log_index_offset += written;
+        if (entry->length >= log_index_block)
+            log_index_put();
+    }
+    pthread_mutex_unlock(&log_index_mutex);
+    return written;
+}
+
+void log_file_index(size_t block_bytes)
+{
+    char name[PATH_MAX];
+    int fd = -1;
+
+    log_index_close();
+    if (block_bytes && block_bytes < LOG_INDEX_MIN_BLOCK)
+        block_bytes = LOG_INDEX_MIN_BLOCK;
+    if (block_bytes > LOG_INDEX_MAX_BLOCK)
+        block_bytes = LOG_INDEX_MAX_BLOCK;
+    pthread_mutex_lock(&log_index_mutex);
+    log_index_block = block_bytes;
+    pthread_mutex_unlock(&log_index_mutex);
+    __atomic_store_n(&log_index_active, block_bytes != 0, __ATOMIC_RELEASE);
+
+    /* a file that is open already gets its index from here on */
+    if (block_bytes && (fd = log_file_text_fd()) != -1 && log_file_name(name, sizeof(name)) == 0)
+        log_index_open(name, fd);
+}
+
+long log_index_read(int fd, int (*entry_func)(const struct log_index_entry *entry))
+{
+    struct log_index_header header;
+    struct log_index_entry entry;
+    long count = 0;
+
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, LOG_INDEX_MAGIC, sizeof(header.magic)) ||
+        header.entry_size != sizeof(entry))
+        return -1;
+    for (off_t at = sizeof(header); pread(fd, &entry, sizeof(entry), at) == sizeof(entry);
+         at += sizeof(entry)) {
+        count++;
+        if (entry_func(&entry))
+            break;
+    }
+    return count;
+}
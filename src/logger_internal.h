@@ -0,0 +1,322 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Declarations shared between the logger source files, not for users. */
+
+#ifndef LOGGER_INTERNAL_H
+#define LOGGER_INTERNAL_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+
+struct log_kv;
+struct log_callsite;
+struct timespec;
+
+/* The main output function, the sinks come on top */
+extern void (*log_output_ptr)(char* prefix, char* contents);
+
+/* Hand a formatted message to the main output function and the sinks
+ * that show its level, in this thread */
+void log_output(int level, char *prefix, char *contents);
+
+/* Does a display option show this level? */
+int log_filter_shows(int scope, int current, const int *selection, int selection_size,
+                     int level);
+
+/* Rebuild log_level_bitmap after a sink changed */
+void log_level_bitmap_update(void);
+
+/****  colours (logger_color.c) ****/
+
+#define LOG_ANSI_RESET "\x1b[0;0m"
+
+/* Print a message to stdout or stderr, coloured by level on a terminal */
+void log_print_terminal(int fd, char *prefix, char *contents);
+
+/* Copy len bytes of src to dst without escape sequences, returns the
+ * new length.  dst may be src. */
+size_t log_ansi_strip(char *dst, const char *src, size_t len);
+
+/* For the file outputs: if prefix or contents hold escape sequences,
+ * point them at copies without, in scratch or on the heap.  Returns
+ * what to free. */
+char *log_color_plain(char **prefix, char **contents, char *scratch, size_t room);
+
+/****  sinks (logger_sinks.c) ****/
+
+/* Or the bitmaps of the sinks into bitmap */
+void log_sinks_union(unsigned long long *bitmap);
+
+/* Does any sink show this level?  The slow way, for levels beyond the bitmap. */
+int log_sinks_show(int level);
+
+/* Call the sinks that show the level, returns how many there were.
+ * bytes is the length of the message for the stats, 0 without them. */
+int log_sinks_deliver(int level, char *prefix, char *contents, size_t bytes);
+
+/* How the location of a log message is written in front of it */
+#define LOG_PREFIX_FMT "%-10s %s:%d %s() \n          "
+
+/* The LOG_TIMESTAMP_ options */
+extern int log_timestamp_options;
+
+/* Write the timestamp log_set_timestamp() asked for into 'out',
+ * followed by a space.  Returns its length, 0 without timestamps. */
+int log_timestamp(char *out, size_t room);
+
+/* Write the local time in ts with microseconds, ISO 8601 with the zone
+ * for JSON.  Returns the end, nothing gets terminated. */
+char *log_put_wall(char *p, const struct timespec *ts, int json);
+
+/* Write ts as seconds.microseconds, returns the end */
+char *log_put_seconds(char *p, const struct timespec *ts);
+
+/* The unfiltered body of _log_msg and _log_kv_msg: format and deliver
+ * a message.  site, if not NULL, is where the message comes from and
+ * supplies the prefix; fields may be NULL */
+void log_vmsg(const char *name, int level, const char* filename, int linenum,
+              const char* function, struct log_callsite *site,
+              const struct log_kv *fields, int field_count,
+              const char *fmt, va_list argp);
+
+/* The LOG_PREFIX_FMT prefix of a call site and its length in *len,
+ * rendered once on its first message.  NULL if that failed. */
+const char *log_site_prefix(struct log_callsite *site, int *len);
+
+/* Hand a finished message to the output function, or to the async queue */
+void log_deliver(int level, char *prefix, char *contents);
+
+/****  flight recorder (logger_flight.c) ****/
+
+/* Non zero while the flight recorder runs */
+extern int log_flight_active;
+
+/* The reasons for log_sites_wanted */
+#define LOG_WANTED_FLIGHT 1
+#define LOG_WANTED_STATS  2
+
+/* Put a message into this thread's ring, argp is left untouched */
+void log_flight_record(struct log_callsite *site, int level, va_list argp);
+
+/* Called before a LOG_ERR message is delivered */
+void log_flight_error(void);
+
+/****  key/value fields and JSON (logger_json.c) ****/
+
+/* LOG_FORMAT_TEXT or LOG_FORMAT_JSON */
+extern int log_output_format;
+
+/* Write the fields as " key=value ..." like snprintf: at most room
+ * bytes, terminated, returns the length it would need */
+size_t log_kv_text(char *out, size_t room, const struct log_kv *fields, int field_count);
+
+/* Render a JSON record into *record of 'size' bytes.  The prefix
+ * starts at *record and may take up to half of it, the returned
+ * contents follow.  The message may lie in the record.  If it doesn't
+ * fit, *record is replaced with a bigger one from malloc. */
+char *log_json_render(char **record, size_t size,
+                      const char *name, int level, const char *filename, int linenum,
+                      const char *function, const char *message,
+                      const struct log_kv *fields, int field_count);
+
+/* The file log_print_to_file writes to */
+extern int log_file_fd;
+
+/* Count bytes written to log_file_fd, for the rotation by size */
+void log_file_wrote(long bytes);
+
+/* log_file_fd if it holds plain text written with write(), else -1.
+ * Safe to call from a signal handler. */
+int log_file_text_fd(void);
+
+/* Open the log file for reading and writing, -1 if there is none.
+ * With 'next' set, move on to a new file first, as the rotation does. */
+int log_file_reopen(int next);
+
+/****  format strings and raw arguments (logger_binary.c) ****/
+
+/* Argument types of a format string */
+#define LOG_ARG_NONE    0  /* %n, the pointer is skipped */
+#define LOG_ARG_INT     1
+#define LOG_ARG_LONG    2
+#define LOG_ARG_DOUBLE  3
+#define LOG_ARG_LDOUBLE 4
+#define LOG_ARG_STRING  5
+#define LOG_ARG_POINTER 6
+
+/* Parse the conversion after a '%'.  Stores the argument type and the
+ * number of '*' ints that come before it, returns the end of the spec. */
+const char *log_fmt_spec(const char *p, int *type, int *stars);
+
+/* Fill in the argument types of fmt, -1 if it can't be logged in binary */
+int log_fmt_args(const char *fmt, unsigned char *types, int max);
+
+/* Copy the arguments into p, in the binary log layout: 4 bytes per int,
+ * 8 per long/pointer/double, sizeof(long double), or u32 length + NUL
+ * terminated bytes for a string.  Strings are cut short to fit before
+ * end, returns the end of the arguments or NULL if they don't fit. */
+char *log_args_encode(char *p, char *end, const unsigned char *types, int count,
+                      va_list *argp);
+
+/****  binary log files (logger_binary.c) ****/
+
+/* Start a binary log in log_file_fd, and flush it before it's closed */
+void log_bin_start(void);
+void log_bin_stop(void);
+
+/* Non zero while log_file_fd holds a binary log */
+int log_bin_is_active(void);
+
+/* Write an already formatted message into the binary log */
+void log_bin_text(const char *prefix, const char *contents);
+
+/* Write out the binary log buffers of all threads */
+void log_bin_flush(void);
+
+/* Move the binary log over to the file in fd: no thread's frames get
+ * split between the two files, and the new one starts with a header */
+void log_bin_rotate(int fd);
+
+/****  memory mapped log file output (logger_mmap.c) ****/
+
+/* Non zero while messages go into a mapped segment */
+int log_mmap_is_active(void);
+
+/* Close the current segment and map one in a new file */
+void log_mmap_roll(void);
+
+/* Close the current segment, and map a new one in the current log file
+ * if log_file_mmap() asked for it.  Called around file changes. */
+void log_mmap_stop(void);
+void log_mmap_resume(void);
+
+/****  buffered log file output (logger_buffer.c) ****/
+
+/* Write out the file buffer, if there is one */
+void log_buffer_flush(void);
+
+/****  compressed log file output (logger_compress.c) ****/
+
+/* Compress and write out the blocks held back, if there are any */
+void log_compress_flush(void);
+
+/* The level log_current_level() reports in this thread */
+extern __thread int log_output_level;
+
+/****  sidecar index of the log file (logger_index.c) ****/
+
+/* Non zero while log_file_index() asks for an index */
+extern int log_index_active;
+
+/* The source file of the message being output in this thread */
+extern __thread const char *log_output_file;
+
+/* Start the index of a log file just opened in fd, and finish it */
+void log_index_open(const char *log_name, int fd);
+void log_index_close(void);
+
+/* writev a message to the log file and count it in the index */
+struct iovec;
+long log_index_writev(int fd, const struct iovec *iov, int count);
+
+/* Copy the name of the log file, -1 if there is none */
+int log_file_name(char *out, size_t room);
+
+/****  io_uring log file output (logger_uring.c) ****/
+
+/* Write out the buffers and wait until the kernel has them in the file */
+void log_uring_flush(void);
+
+/* Hand what is buffered to the kernel, without waiting */
+void log_uring_submit(void);
+
+/****  lock-free ring buffer (logger_ring.c) ****/
+
+/* A bounded multi-producer multi-consumer queue of fixed size slots.
+ * Everything lives in one block of memory and there are no pointers
+ * in it, so a ring can be placed in shared memory as well.
+ */
+struct log_ring {
+    uint64_t mask;         /* number of slots - 1 */
+    uint64_t slot_size;    /* bytes per slot, header included */
+    uint64_t head __attribute__((aligned(64)));  /* next position to fill */
+    uint64_t tail __attribute__((aligned(64)));  /* next position to drain */
+    uint64_t dropped __attribute__((aligned(64)));
+};
+
+/* Bytes needed for a ring of 'slots' slots with 'payload' bytes each.
+ * 'slots' must be a power of two. */
+size_t log_ring_size(uint64_t slots, size_t payload);
+
+/* Set up a ring in memory of at least log_ring_size() bytes */
+void log_ring_init(struct log_ring *ring, uint64_t slots, size_t payload);
+
+/* Claim a slot to write into, NULL if the ring is full.
+ * Hand the slot over with log_ring_commit(ring, pos). */
+void *log_ring_reserve(struct log_ring *ring, uint64_t *pos);
+void log_ring_commit(struct log_ring *ring, uint64_t pos);
+
+/* Claim the oldest filled slot, NULL if the ring is empty.
+ * Give the slot back with log_ring_release(ring, pos). */
+void *log_ring_claim(struct log_ring *ring, uint64_t *pos);
+void log_ring_release(struct log_ring *ring, uint64_t pos);
+
+/****  rate limiting and sampling (logger_limit.c) ****/
+
+/* Report what the limited call sites have suppressed since their last
+ * summary */
+void log_limit_flush(void);
+
+/****  async output (logger_async.c) ****/
+
+/* Non zero while the consumer thread is running */
+extern int log_async_running;
+
+/* Queue a formatted message for the consumer thread */
+void log_async_push(int level, const char *prefix, const char *contents);
+
+/* Wait until everything queued so far has been written */
+void log_async_flush(void);
+
+/* Messages waiting in the queue */
+unsigned long log_async_queued(void);
+
+/****  self-metrics (logger_stats.c) ****/
+
+/* Non zero while log_stats_start() has the counters running */
+extern int log_stats_active;
+
+/* Non zero while filtered messages are counted as well */
+extern int log_stats_filtering;
+
+/* Monotonic nanoseconds, for the latencies */
+unsigned long long log_stats_clock(void);
+
+/* A message went out (0 ns if it wasn't timed), or was filtered out */
+void log_stats_message(int level, unsigned long long ns);
+void log_stats_filtered(int level);
+
+/* bytes went to output 0, the output function, or to sink + 1 */
+void log_stats_wrote(int output, size_t bytes);
+
+/* Time spent in the output functions for one message */
+void log_stats_output(unsigned long long ns);
+
+#endif /* LOGGER_INTERNAL_H */
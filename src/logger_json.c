@@ -0,0 +1,322 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/****  key/value fields and JSON records ****/
+
+/* A JSON record is written straight into the record buffer, split the
+ * way every output function expects it: the prefix holds the opening
+ * brace and the location, the contents hold the message, the fields
+ * and the closing brace.  "prefix contents" is one valid JSON object.
+ * The message is escaped from the back of the record forward; when it
+ * doesn't fit, the record goes on the heap.  Fields that don't fit are
+ * left out or cut short, but the brackets and quotes always get closed.
+ */
+
+#include <math.h>      // isfinite
+#include <stdio.h>
+#include <stdlib.h>    // strtod
+#include <string.h>
+#include <time.h>
+#include "logger.h"
+#include "logger_internal.h"
+
+int log_output_format = LOG_FORMAT_TEXT;
+
+void log_set_format(int format)
+{
+    __atomic_store_n(&log_output_format, format, __ATOMIC_RELAXED);
+}
+
+/****  text ****/
+
+size_t log_kv_text(char *out, size_t room, const struct log_kv *fields, int field_count)
+{
+    size_t len = 0;
+
+    for (int i = 0; i < field_count; i++) {
+        const struct log_kv *kv = &fields[i];
+        char *at = len < room ? out + len : NULL;
+        size_t left = len < room ? room - len : 0;
+        int n = 0;
+
+        switch (kv->type) {
+            case(LOG_KV_TYPE_STRING): {
+                n = snprintf(at, left, " %s=\"%s\"", kv->key,
+                             kv->value.s ? kv->value.s : "(null)");
+                break;
+            }
+            case(LOG_KV_TYPE_INT): {
+                n = snprintf(at, left, " %s=%lld", kv->key, kv->value.i);
+                break;
+            }
+            case(LOG_KV_TYPE_DOUBLE): {
+                n = snprintf(at, left, " %s=%g", kv->key, kv->value.d);
+                break;
+            }
+            case(LOG_KV_TYPE_BOOL): {
+                n = snprintf(at, left, " %s=%s", kv->key, kv->value.i ? "true" : "false");
+                break;
+            }
+        }
+        if (n > 0)
+            len += n;
+    }
+    return len;
+}
+
+/****  JSON ****/
+
+struct log_json {
+    char *p;
+    char *end;      /* the closing brackets go behind this */
+    int members;    /* in the object being written */
+};
+
+static int log_json_put(struct log_json *j, const char *s, size_t len)
+{
+    if ((size_t)(j->end - j->p) < len)
+        return 0;
+    memcpy(j->p, s, len);
+    j->p += len;
+    return 1;
+}
+
+/* A quoted and escaped string, cut short if it doesn't fit */
+static int log_json_string(struct log_json *j, const char *s)
+{
+    static const char hex[] = "0123456789abcdef";
+    char *p = j->p, *stop = j->end - 1;   /* keep room for the closing quote */
+
+    if (j->end - j->p < 2)
+        return 0;
+    *p++ = '"';
+    for (; s && *s; s++) {
+        unsigned char c = *s;
+        char esc[6] = { c };
+        int len = 1;
+
+        switch (c) {
+            case('"'): case('\\'): esc[0] = '\\'; esc[1] = c;   len = 2; break;
+            case('\n'):            esc[0] = '\\'; esc[1] = 'n'; len = 2; break;
+            case('\r'):            esc[0] = '\\'; esc[1] = 'r'; len = 2; break;
+            case('\t'):            esc[0] = '\\'; esc[1] = 't'; len = 2; break;
+            default: {
+                if (c < 0x20) {
+                    memcpy(esc, "\\u00", 4);
+                    esc[4] = hex[c >> 4];
+                    esc[5] = hex[c & 15];
+                    len = 6;
+                }
+            }
+        }
+        if (stop - p < len) {
+            /* don't leave half a UTF-8 character behind */
+            if ((c & 0xC0) == 0x80) {
+                while (p > j->p + 1 && (p[-1] & 0xC0) == 0x80)
+                    p--;
+                if (p > j->p + 1)
+                    p--;
+            }
+            break;
+        }
+        memcpy(p, esc, len);
+        p += len;
+    }
+    *p++ = '"';
+    j->p = p;
+    return 1;
+}
+
+/* "key": with a comma in front if needed.  Returns where the member
+ * starts, to take it back if the value doesn't fit, or NULL. */
+static char *log_json_key(struct log_json *j, const char *key)
+{
+    char *start = j->p;
+
+    if ((j->members && !log_json_put(j, ",", 1)) ||
+        !log_json_string(j, key) || !log_json_put(j, ":", 1)) {
+        j->p = start;
+        return NULL;
+    }
+    return start;
+}
+
+static void log_json_member_string(struct log_json *j, const char *key, const char *value)
+{
+    char *start = log_json_key(j, key);
+
+    if (!start)
+        return;
+    if (value ? !log_json_string(j, value) : !log_json_put(j, "null", 4)) {
+        j->p = start;
+        return;
+    }
+    j->members++;
+}
+
+/* A member whose value is already JSON: a number, true, false, null */
+static void log_json_member_raw(struct log_json *j, const char *key,
+                                const char *value, size_t len)
+{
+    char *start = log_json_key(j, key);
+
+    if (!start)
+        return;
+    if (!log_json_put(j, value, len)) {
+        j->p = start;
+        return;
+    }
+    j->members++;
+}
+
+static void log_json_member_int(struct log_json *j, const char *key, long long value)
+{
+    char number[24];
+    int len = snprintf(number, sizeof(number), "%lld", value);
+    log_json_member_raw(j, key, number, len);
+}
+
+/* How many bytes log_json_string adds to s, quotes not counted */
+static size_t log_json_growth(const char *s)
+{
+    size_t growth = 0;
+
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\' || c == '\n' || c == '\r' || c == '\t')
+            growth += 1;
+        else if (c < 0x20)
+            growth += 5;
+    }
+    return growth;
+}
+
+static void log_json_member_double(struct log_json *j, const char *key, double value)
+{
+    char number[32];
+    int len = 4;
+
+    if (isfinite(value)) {
+        /* as short as it gets without losing anything */
+        len = snprintf(number, sizeof(number), "%.15g", value);
+        if (strtod(number, NULL) != value)
+            len = snprintf(number, sizeof(number), "%.17g", value);
+    }
+    else
+        memcpy(number, "null", 4);   /* JSON has no NaN or infinity */
+    log_json_member_raw(j, key, number, len);
+}
+
+char *log_json_render(char **recordp, size_t size,
+                      const char *name, int level, const char *filename, int linenum,
+                      const char *function, const char *message,
+                      const struct log_kv *fields, int field_count)
+{
+    int options = __atomic_load_n(&log_timestamp_options, __ATOMIC_RELAXED);
+    size_t prefix_max = size / 2;
+    char *record = *recordp;
+    char stamp[64];
+    struct timespec ts;
+
+    /* The escaped message starts within 8 bytes of the end of the
+     * prefix room and is closed 4 bytes before the end of the record.
+     * A message inside the record is moved to its end, escaping it
+     * forward from there never overtakes it if the result fits. */
+    size_t len = strlen(message), growth = log_json_growth(message);
+    int inside = message >= record && message < record + size;
+    if (prefix_max + 12 + len + growth > size) {
+        char *bigger = malloc(size + len + growth);
+        if (bigger) {
+            *recordp = record = bigger;
+            size += len + growth;
+            inside = 0;
+        }
+        else if (inside) {
+            /* cut short to what fits however much it grows */
+            char *cut = (char *)message;
+            len = (size - prefix_max - 12) / 6;
+            while (len && (cut[len] & 0xC0) == 0x80)
+                len--;
+            cut[len] = '\0';
+        }
+    }
+    if (inside && message < record + size - len - 1)
+        message = memmove(record + size - len - 1, message, len + 1);
+
+    /* the prefix, room is kept for the trailing comma */
+    struct log_json j = { record, record + prefix_max - 2, 0 };
+    *j.p++ = '{';
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    *stamp = '"';
+    char *stamp_end = log_put_wall(stamp + 1, &ts, 1);
+    *stamp_end++ = '"';
+    log_json_member_raw(&j, "ts", stamp, stamp_end - stamp);
+    if (options & LOG_TIMESTAMP_MONOTONIC) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        log_json_member_raw(&j, "mono", stamp, log_put_seconds(stamp, &ts) - stamp);
+    }
+    log_json_member_string(&j, "level", name);
+    log_json_member_int(&j, "level_num", level);
+    log_json_member_string(&j, "file", filename);
+    log_json_member_int(&j, "line", linenum);
+    log_json_member_string(&j, "function", function);
+    *j.p++ = ',';
+    *j.p = '\0';
+
+    /* the contents, room is kept for two closing braces */
+    char *contents = j.p + 1;
+    j.p = contents;
+    j.end = record + size - 3;
+    j.members = 0;
+    log_json_member_string(&j, "msg", message);
+
+    if (field_count > 0 && log_json_put(&j, ",\"fields\":{", 11)) {
+        int outer = j.members;
+        j.members = 0;
+        for (int i = 0; i < field_count; i++) {
+            const struct log_kv *kv = &fields[i];
+            switch (kv->type) {
+                case(LOG_KV_TYPE_STRING): {
+                    log_json_member_string(&j, kv->key, kv->value.s);
+                    break;
+                }
+                case(LOG_KV_TYPE_INT): {
+                    log_json_member_int(&j, kv->key, kv->value.i);
+                    break;
+                }
+                case(LOG_KV_TYPE_DOUBLE): {
+                    log_json_member_double(&j, kv->key, kv->value.d);
+                    break;
+                }
+                case(LOG_KV_TYPE_BOOL): {
+                    if (kv->value.i)
+                        log_json_member_raw(&j, kv->key, "true", 4);
+                    else
+                        log_json_member_raw(&j, kv->key, "false", 5);
+                    break;
+                }
+            }
+        }
+        *j.p++ = '}';
+        j.members = outer;
+    }
+    *j.p++ = '}';
+    *j.p = '\0';
+    return contents;
+}
@@ -0,0 +1,174 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/****  rate limiting and sampling per call site ****/
+
+/* Every limited call site owns a static struct log_limit.  Deciding
+ * whether a message goes out takes an atomic or two on that struct and
+ * no lock, so a site that suppresses thousands of messages a second
+ * costs little more than one that is filtered out by level.  The
+ * number suppressed is added up and reported in front of the next
+ * message that does go out.  A site joins a list the first time it
+ * holds one back, log_flush and close_log report what is left on it.
+ */
+
+#include <stdint.h>
+#include <time.h>
+#include "logger.h"
+#include "logger_internal.h"
+
+/* Whole seconds of a clock that is cheap to read and never steps back */
+static unsigned log_limit_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (unsigned)ts.tv_sec;
+}
+
+/* Every site that ever suppressed a message, sites are never removed */
+static struct log_limit *log_limit_sites = NULL;
+
+static void log_limit_suppress(struct log_limit *limit)
+{
+    if (__atomic_fetch_add(&limit->suppressed, 1, __ATOMIC_RELAXED) ||
+        __atomic_load_n(&limit->listed, __ATOMIC_RELAXED) ||
+        __atomic_exchange_n(&limit->listed, 1, __ATOMIC_RELAXED))
+        return;
+    limit->next = __atomic_load_n(&log_limit_sites, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&log_limit_sites, &limit->next, limit, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+}
+
+int log_limit_rate(struct log_limit *limit, unsigned per_second)
+{
+    /* the second and the count in it change together, in one word */
+    unsigned long long now = log_limit_seconds();
+    unsigned long long state = __atomic_load_n(&limit->state, __ATOMIC_RELAXED);
+
+    for (;;) {
+        unsigned long long next;
+
+        if (state >> 32 != now)
+            next = now << 32 | 1;
+        else if ((state & 0xffffffffu) >= per_second) {
+            log_limit_suppress(limit);
+            return 0;
+        }
+        else
+            next = state + 1;
+        if (__atomic_compare_exchange_n(&limit->state, &state, next, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return 1;
+    }
+}
+
+int log_limit_every(struct log_limit *limit, unsigned n)
+{
+    unsigned long long seen = __atomic_fetch_add(&limit->state, 1, __ATOMIC_RELAXED);
+
+    if (n <= 1 || seen % n == 0)
+        return 1;
+    log_limit_suppress(limit);
+    return 0;
+}
+
+/* xorshift64*, one per thread so sampling shares nothing */
+static __thread uint64_t log_limit_random_state = 0;
+
+static uint32_t log_limit_random(void)
+{
+    uint64_t x = log_limit_random_state;
+
+    if (!x) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        x = ((uint64_t)ts.tv_sec * 1000000007u) ^ (uint64_t)ts.tv_nsec ^
+            (uint64_t)(uintptr_t)&log_limit_random_state;
+        if (!x)
+            x = 0x9e3779b97f4a7c15ull;
+    }
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    log_limit_random_state = x;
+    return (uint32_t)((x * 0x2545f4914f6cdd1dull) >> 32);
+}
+
+int log_limit_sample(struct log_limit *limit, double probability)
+{
+    if (probability >= 1.0 || log_limit_random() < probability * 4294967296.0)
+        return 1;
+    log_limit_suppress(limit);
+    return 0;
+}
+
+/* The summary goes out under the name and location of the site */
+static void log_limit_summary(const char *name, int level, const char* filename,
+                              int linenum, const char* function, const char *fmt, ...)
+{
+    va_list argp;
+    va_start(argp, fmt);
+    log_vmsg(name, level, filename, linenum, function, NULL, NULL, 0, fmt, argp);
+    va_end(argp);
+}
+
+void log_limit_flush(void)
+{
+    struct log_limit *limit = __atomic_load_n(&log_limit_sites, __ATOMIC_ACQUIRE);
+
+    for (; limit; limit = limit->next) {
+        unsigned long long suppressed =
+            __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+        if (!suppressed)
+            continue;
+        const struct log_callsite *site = limit->site;
+        int level = site->level > 0 ? site->level : limit->level;
+        log_limit_summary(site->name, level > 0 ? level : LOG_INFO, site->filename,
+                          site->linenum, site->function,
+                          "%llu similar messages suppressed", suppressed);
+    }
+}
+
+void _log_limit_msg(struct log_limit *limit, const char *name, int level,
+                    const char* filename, int linenum, const char* function,
+                    const char *fmt, ...)
+{
+    if (__atomic_load_n(&limit->level, __ATOMIC_RELAXED) != level)
+        __atomic_store_n(&limit->level, level, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&limit->suppressed, __ATOMIC_RELAXED)) {
+        unsigned now = log_limit_seconds();
+        unsigned reported = __atomic_load_n(&limit->reported, __ATOMIC_RELAXED);
+
+        /* one thread a second takes the count and reports it */
+        if (reported != now &&
+            __atomic_compare_exchange_n(&limit->reported, &reported, now, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            unsigned long long suppressed =
+                __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+            if (suppressed)
+                log_limit_summary(name, level, filename, linenum, function,
+                                  "%llu similar messages suppressed", suppressed);
+        }
+    }
+
+    va_list argp;
+    va_start(argp, fmt);
+    log_vmsg(name, level, filename, linenum, function, NULL, NULL, 0, fmt, argp);
+    va_end(argp);
+}
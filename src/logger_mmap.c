@@ -0,0 +1,288 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/****  memory mapped output to the log file ****/
+
+/* The end of the log file is extended by a segment, which is mapped
+ * into memory.  Writers reserve their bytes with one atomic add and
+ * copy the message into the mapping, no system call involved.  The
+ * writer that runs over the end cuts the segment back to the bytes
+ * actually written and extends the file by the next one; log rotation
+ * moves on to a new file.  After a crash the file ends in the zeros of
+ * the segment that wasn't cut back.
+ *
+ * Writers may still hold a pointer to a segment that has been retired,
+ * so the structs are never freed but kept for the next segment.  A
+ * retired one looks full to everybody until it is live again.
+ */
+
+#include <fcntl.h>     // fallocate
+#include <pthread.h>
+#include <sched.h>     // sched_yield
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "logger.h"
+#include "logger_internal.h"
+
+/* Smallest segment, so a full record always fits */
+#define LOG_MMAP_MIN_SEGMENT (64 * 1024)
+
+/* 'used' of a retired segment, beyond any size */
+#define LOG_MMAP_RETIRED ((size_t)1 << (sizeof(size_t) * 8 - 2))
+
+struct log_mmap_segment {
+    char *map;          /* the mapping starts at a page boundary ...     */
+    char *base;         /* ... the segment where the file ended          */
+    size_t map_len;
+    off_t file_start;   /* file offset of base                           */
+    size_t size;
+    size_t used;        /* bytes reserved, may run past size             */
+    size_t valid;       /* bytes to keep, set by whoever ran over size   */
+    int writers;        /* threads between reserving and copying         */
+    int fd;
+    struct log_mmap_segment *next_spare;
+};
+
+static struct log_mmap_segment *log_mmap_current = NULL;
+static struct log_mmap_segment *log_mmap_spares = NULL;
+static size_t log_mmap_segment_size = 0;
+
+/* Taken to switch segments, and by writers while there is no segment */
+static pthread_mutex_t log_mmap_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Map a new segment at the end of the file fd, which it takes over.
+ * NULL if that fails.  Called with log_mmap_mutex held. */
+static struct log_mmap_segment *log_mmap_map_fd(int fd)
+{
+    struct log_mmap_segment *seg = log_mmap_spares;
+    struct stat statbuf;
+    long page = sysconf(_SC_PAGESIZE);
+
+    if (seg)
+        log_mmap_spares = seg->next_spare;
+    else if (NULL == (seg = calloc(1, sizeof(*seg)))) {
+        close(fd);
+        return NULL;
+    }
+    if (fstat(fd, &statbuf) == -1) {
+        close(fd);
+        seg->next_spare = log_mmap_spares;
+        log_mmap_spares = seg;
+        return NULL;
+    }
+
+    off_t map_start = statbuf.st_size & ~(off_t)(page - 1);
+    size_t size = log_mmap_segment_size;
+    size_t map_len = statbuf.st_size - map_start + size;
+    char *map = MAP_FAILED;
+
+    /* fallocate makes sure the disk space is there, ftruncate is
+     * second best for file systems that can't do it */
+    if ((fallocate(fd, 0, statbuf.st_size, size) == -1 &&
+         ftruncate(fd, statbuf.st_size + size) == -1) ||
+        MAP_FAILED == (map = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED, fd, map_start))) {
+        fprintf(stderr, "Couldn't map the log file, writing it instead.\n");
+        ftruncate(fd, statbuf.st_size);
+        close(fd);
+        seg->next_spare = log_mmap_spares;
+        log_mmap_spares = seg;
+        return NULL;
+    }
+
+    seg->fd = fd;
+    seg->map = map;
+    seg->base = map + (statbuf.st_size - map_start);
+    seg->map_len = map_len;
+    seg->file_start = statbuf.st_size;
+    seg->size = size;
+    seg->valid = 0;
+    /* last: writers that still hold on to it from before can have it */
+    __atomic_store_n(&seg->used, 0, __ATOMIC_SEQ_CST);
+    return seg;
+}
+
+/* The same at the end of the log file, or of the next one */
+static struct log_mmap_segment *log_mmap_map(int next)
+{
+    if (log_bin_is_active()) {
+        fprintf(stderr, "Binary log files can't be memory mapped.\n");
+        return NULL;
+    }
+    int fd = log_file_reopen(next);
+    return fd == -1 ? NULL : log_mmap_map_fd(fd);
+}
+
+/* Cut back a segment nobody can reserve in any more and keep its struct
+ * for later.  Closes its file unless keep_fd.  Returns the bytes that
+ * were written into it.  Called with log_mmap_mutex held. */
+static size_t log_mmap_retire(struct log_mmap_segment *seg, int keep_fd)
+{
+    /* run over the end ourselves, unless a writer got there first */
+    size_t start = __atomic_fetch_add(&seg->used, seg->size + 1, __ATOMIC_SEQ_CST);
+    if (start <= seg->size)
+        __atomic_store_n(&seg->valid, start, __ATOMIC_SEQ_CST);
+
+    while (__atomic_load_n(&seg->writers, __ATOMIC_SEQ_CST))
+        sched_yield();
+
+    size_t valid = __atomic_load_n(&seg->valid, __ATOMIC_SEQ_CST);
+    munmap(seg->map, seg->map_len);
+    ftruncate(seg->fd, seg->file_start + valid);
+    if (!keep_fd)
+        close(seg->fd);
+    __atomic_store_n(&seg->used, LOG_MMAP_RETIRED, __ATOMIC_SEQ_CST);
+    seg->next_spare = log_mmap_spares;
+    log_mmap_spares = seg;
+    return valid;
+}
+
+/* Replace 'full' with the next segment of the same file, or with one in
+ * a new file, unless that happened already */
+static void log_mmap_roll_from(struct log_mmap_segment *full, int new_file)
+{
+    pthread_mutex_lock(&log_mmap_mutex);
+    if (full && __atomic_load_n(&log_mmap_current, __ATOMIC_ACQUIRE) == full) {
+        if (new_file) {
+            __atomic_store_n(&log_mmap_current, log_mmap_map(1), __ATOMIC_RELEASE);
+            log_mmap_retire(full, 0);
+        }
+        else {
+            /* writers wait for it while the file is cut back and extended */
+            int fd = full->fd;
+            log_file_wrote(log_mmap_retire(full, 1));
+            __atomic_store_n(&log_mmap_current, log_mmap_map_fd(fd), __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&log_mmap_mutex);
+}
+
+void log_mmap_roll(void)
+{
+    log_mmap_roll_from(__atomic_load_n(&log_mmap_current, __ATOMIC_ACQUIRE), 1);
+}
+
+int log_mmap_is_active(void)
+{
+    return __atomic_load_n(&log_mmap_current, __ATOMIC_ACQUIRE) != NULL;
+}
+
+void log_mmap_stop(void)
+{
+    pthread_mutex_lock(&log_mmap_mutex);
+    struct log_mmap_segment *seg = log_mmap_current;
+    __atomic_store_n(&log_mmap_current, NULL, __ATOMIC_RELEASE);
+    if (seg)
+        log_mmap_retire(seg, 0);
+    pthread_mutex_unlock(&log_mmap_mutex);
+}
+
+void log_mmap_resume(void)
+{
+    pthread_mutex_lock(&log_mmap_mutex);
+    if (log_mmap_segment_size && !log_mmap_current)
+        __atomic_store_n(&log_mmap_current, log_mmap_map(0), __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&log_mmap_mutex);
+}
+
+void log_file_mmap(size_t segment_size)
+{
+    long page = sysconf(_SC_PAGESIZE);
+
+    log_mmap_stop();
+    if (segment_size && segment_size < LOG_MMAP_MIN_SEGMENT)
+        segment_size = LOG_MMAP_MIN_SEGMENT;
+    segment_size = (segment_size + page - 1) & ~(size_t)(page - 1);
+
+    pthread_mutex_lock(&log_mmap_mutex);
+    log_mmap_segment_size = segment_size;
+    pthread_mutex_unlock(&log_mmap_mutex);
+    log_mmap_resume();
+}
+
+static void log_mmap_write(char *prefix, char *contents)
+{
+    size_t prefix_len = strlen(prefix);
+    size_t contents_len = strlen(contents);
+
+    for (;;) {
+        struct log_mmap_segment *seg = __atomic_load_n(&log_mmap_current, __ATOMIC_ACQUIRE);
+
+        if (!seg) {
+            /* no mapping: write, but never while a segment is set up */
+            pthread_mutex_lock(&log_mmap_mutex);
+            int mapped = log_mmap_current != NULL;
+            if (!mapped)
+                log_print_to_file(prefix, contents);
+            pthread_mutex_unlock(&log_mmap_mutex);
+            if (mapped)
+                continue;
+            return;
+        }
+
+        /* a message bigger than a whole segment is cut short */
+        if (prefix_len + contents_len + 2 > seg->size) {
+            if (prefix_len + 2 > seg->size)
+                prefix_len = seg->size - 2;
+            contents_len = seg->size - prefix_len - 2;
+        }
+        size_t len = prefix_len + 1 + contents_len + 1;
+
+        __atomic_add_fetch(&seg->writers, 1, __ATOMIC_SEQ_CST);
+        size_t start = __atomic_fetch_add(&seg->used, len, __ATOMIC_SEQ_CST);
+        if (start + len <= seg->size) {
+            char *p = seg->base + start;
+            memcpy(p, prefix, prefix_len);      p += prefix_len;
+            *p++ = ' ';
+            memcpy(p, contents, contents_len);  p += contents_len;
+            *p = '\n';
+            __atomic_sub_fetch(&seg->writers, 1, __ATOMIC_SEQ_CST);
+            return;
+        }
+
+        /* full: the first one over the end marks it and rolls over,
+         * everybody else waits for the next segment, which may be
+         * this struct again */
+        int first = start <= seg->size;
+        if (first)
+            __atomic_store_n(&seg->valid, start, __ATOMIC_SEQ_CST);
+        __atomic_sub_fetch(&seg->writers, 1, __ATOMIC_SEQ_CST);
+        if (first)
+            log_mmap_roll_from(seg, 0);
+        else
+            while (__atomic_load_n(&log_mmap_current, __ATOMIC_ACQUIRE) == seg &&
+                   __atomic_load_n(&seg->used, __ATOMIC_ACQUIRE) > seg->size)
+                sched_yield();
+    }
+}
+
+void log_print_to_file_mmap(char *prefix, char *contents)
+{
+    if (!prefix)
+        prefix = "(null)";
+    if (!contents)
+        contents = "(null)";
+    char plain[LOG_RECORD_SIZE];
+    char *spill = log_color_plain(&prefix, &contents, plain, sizeof(plain));
+    log_mmap_write(prefix, contents);
+    free(spill);
+}
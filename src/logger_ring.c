@@ -0,0 +1,121 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* A bounded lock-free queue after Dmitry Vyukov's MPMC design:
+ * every slot carries a sequence number that tells producers and
+ * consumers whether it is free for the lap they are on.  Claiming a
+ * position is a single CAS, handing it over is a single store.
+ */
+
+#include <string.h>    // memset
+#include "logger_internal.h"
+
+struct log_ring_slot {
+    uint64_t seq;
+    char payload[];
+};
+
+#define LOG_RING_ALIGN 64
+
+static uint64_t log_ring_slot_size(size_t payload)
+{
+    uint64_t size = sizeof(struct log_ring_slot) + payload;
+    return (size + LOG_RING_ALIGN - 1) & ~(uint64_t)(LOG_RING_ALIGN - 1);
+}
+
+static struct log_ring_slot *log_ring_slot_at(struct log_ring *ring, uint64_t pos)
+{
+    char *slots = (char *)ring + sizeof(struct log_ring);
+    return (struct log_ring_slot *)(slots + (pos & ring->mask) * ring->slot_size);
+}
+
+size_t log_ring_size(uint64_t slots, size_t payload)
+{
+    return sizeof(struct log_ring) + slots * log_ring_slot_size(payload);
+}
+
+void log_ring_init(struct log_ring *ring, uint64_t slots, size_t payload)
+{
+    memset(ring, 0, sizeof(struct log_ring));
+    ring->mask = slots - 1;
+    ring->slot_size = log_ring_slot_size(payload);
+    for (uint64_t i = 0; i < slots; i++)
+        log_ring_slot_at(ring, i)->seq = i;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void *log_ring_reserve(struct log_ring *ring, uint64_t *pos)
+{
+    uint64_t p = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        struct log_ring_slot *slot = log_ring_slot_at(ring, p);
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - p);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->head, &p, p + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *pos = p;
+                return slot->payload;
+            }
+        }
+        else if (diff < 0) {
+            return NULL;  /* full */
+        }
+        else {
+            p = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void log_ring_commit(struct log_ring *ring, uint64_t pos)
+{
+    __atomic_store_n(&log_ring_slot_at(ring, pos)->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+void *log_ring_claim(struct log_ring *ring, uint64_t *pos)
+{
+    uint64_t p = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+    for (;;) {
+        struct log_ring_slot *slot = log_ring_slot_at(ring, p);
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - (p + 1));
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->tail, &p, p + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *pos = p;
+                return slot->payload;
+            }
+        }
+        else if (diff < 0) {
+            return NULL;  /* empty */
+        }
+        else {
+            p = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void log_ring_release(struct log_ring *ring, uint64_t pos)
+{
+    __atomic_store_n(&log_ring_slot_at(ring, pos)->seq, pos + ring->mask + 1,
+                     __ATOMIC_RELEASE);
+}
@@ -0,0 +1,403 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/****  many processes, one log file: shared memory collection ****/
+
+/* The collector creates a POSIX shared memory segment holding a table
+ * of owners and a number of log rings (logger_ring.c).  A process that
+ * logs into it claims a ring of its own with a CAS on the owner table,
+ * so the processes never contend with each other, and copies each
+ * message into a slot together with its time.  The collector drains
+ * the rings and hands the messages on in time order: they wait until
+ * they are lag_ms old, so a message taken a little late by one process
+ * still goes in front of younger ones.  Rings of processes that have
+ * gone away are drained and given out again.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "logger.h"
+#include "logger_internal.h"
+
+#define LOG_SHM_MAGIC "LOGSHM1"
+#define LOG_SHM_MAX_RINGS 256
+
+struct log_shm_header {
+    char magic[8];
+    uint32_t ring_count;
+    uint32_t record_size;      /* bytes per slot, record header included */
+    uint64_t slots;            /* per ring */
+    uint64_t ring_bytes;
+    int32_t collector_pid;
+    int32_t owners[LOG_SHM_MAX_RINGS];   /* 0: free */
+} __attribute__((aligned(64)));
+
+struct log_shm_record {
+    int64_t ns;                /* CLOCK_REALTIME */
+    int32_t pid;
+    int32_t level;
+    uint32_t prefix_len;
+    uint32_t contents_len;
+    char text[];               /* prefix, '\0', contents, '\0' */
+};
+
+#define LOG_SHM_MIN_RECORD (sizeof(struct log_shm_record) + 64)
+
+static struct log_ring *log_shm_ring_at(struct log_shm_header *shm, unsigned i)
+{
+    return (struct log_ring *)((char *)shm + sizeof(*shm) + i * shm->ring_bytes);
+}
+
+static size_t log_shm_total(const struct log_shm_header *shm)
+{
+    return sizeof(*shm) + shm->ring_count * shm->ring_bytes;
+}
+
+static int64_t log_shm_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int log_shm_pid_alive(pid_t pid)
+{
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+/****  the logging processes ****/
+
+static struct log_shm_header *log_shm = NULL;
+static struct log_ring *log_shm_ring = NULL;
+static int log_shm_slot = -1;
+static int log_shm_policy = LOG_ASYNC_BLOCK;
+static unsigned long log_shm_dropped_count = 0;
+
+/* The collector may be stopped and started again: check now and then */
+#define LOG_SHM_SPINS_PER_CHECK 1024
+
+int log_shm_start(const char *name, int full_policy)
+{
+    if (log_shm)
+        return 0;
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1)
+        return -1;
+
+    struct log_shm_header header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, LOG_SHM_MAGIC, sizeof(header.magic))) {
+        close(fd);
+        return -1;
+    }
+    struct log_shm_header *shm = mmap(NULL, log_shm_total(&header), PROT_READ | PROT_WRITE,
+                                      MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED)
+        return -1;
+
+    int32_t pid = getpid();
+    for (unsigned i = 0; i < shm->ring_count; i++) {
+        int32_t free_slot = 0;
+        if (__atomic_compare_exchange_n(&shm->owners[i], &free_slot, pid, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            log_shm_policy = full_policy;
+            log_shm_slot = i;
+            log_shm_ring = log_shm_ring_at(shm, i);
+            __atomic_store_n(&log_shm, shm, __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    munmap(shm, log_shm_total(&header));
+    return -1;   /* every ring is taken */
+}
+
+void log_shm_stop(void)
+{
+    struct log_shm_header *shm = __atomic_exchange_n(&log_shm, NULL, __ATOMIC_ACQ_REL);
+
+    if (!shm)
+        return;
+    /* wait for the collector to take what is still in the ring */
+    while (log_shm_pid_alive(shm->collector_pid) &&
+           __atomic_load_n(&log_shm_ring->tail, __ATOMIC_ACQUIRE) !=
+           __atomic_load_n(&log_shm_ring->head, __ATOMIC_ACQUIRE))
+        nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+    /* a negative owner tells the collector the ring is free once empty */
+    __atomic_store_n(&shm->owners[log_shm_slot], -getpid(), __ATOMIC_RELEASE);
+    munmap(shm, log_shm_total(shm));
+    log_shm_ring = NULL;
+    log_shm_slot = -1;
+}
+
+unsigned long log_shm_dropped(void)
+{
+    return __atomic_load_n(&log_shm_dropped_count, __ATOMIC_RELAXED);
+}
+
+void log_print_to_shm(char *prefix, char *contents)
+{
+    struct log_shm_header *shm = __atomic_load_n(&log_shm, __ATOMIC_ACQUIRE);
+
+    if (!shm) {
+        log_default_stdout_func(prefix, contents);
+        return;
+    }
+    if (!prefix)
+        prefix = "(null)";
+    if (!contents)
+        contents = "(null)";
+
+    int64_t ns = log_shm_now_ns();   /* before any wait for room */
+    uint64_t pos;
+    struct log_shm_record *rec;
+    for (unsigned spins = 1; !(rec = log_ring_reserve(log_shm_ring, &pos)); spins++) {
+        if (log_shm_policy != LOG_ASYNC_BLOCK ||
+            (spins % LOG_SHM_SPINS_PER_CHECK == 0 && !log_shm_pid_alive(shm->collector_pid))) {
+            __atomic_add_fetch(&log_shm_dropped_count, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&log_shm_ring->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        sched_yield();
+    }
+
+    /* cut short to fit the slot, the contents first */
+    size_t room = shm->record_size - sizeof(*rec) - 2;
+    size_t prefix_len = strlen(prefix), contents_len = strlen(contents);
+    if (prefix_len > room / 2 && prefix_len + contents_len > room)
+        prefix_len = room / 2;
+    if (prefix_len + contents_len > room)
+        contents_len = room - prefix_len;
+
+    rec->ns = ns;
+    rec->pid = getpid();
+    rec->level = log_current_level();
+    rec->prefix_len = prefix_len;
+    rec->contents_len = contents_len;
+    memcpy(rec->text, prefix, prefix_len);
+    rec->text[prefix_len] = '\0';
+    memcpy(rec->text + prefix_len + 1, contents, contents_len);
+    rec->text[prefix_len + 1 + contents_len] = '\0';
+    log_ring_commit(log_shm_ring, pos);
+}
+
+/****  the collector ****/
+
+struct log_collected {
+    int64_t ns;
+    uint64_t order;      /* keeps equal times in the order they came */
+    struct log_shm_record *rec;
+};
+
+static struct log_shm_header *log_collector_shm = NULL;
+/* messages dropped by processes whose rings were reclaimed */
+static unsigned long log_collector_dropped_before = 0;
+static char log_collector_name[256];
+static struct log_collected *log_collected = NULL;
+static size_t log_collected_count = 0, log_collected_room = 0;
+static uint64_t log_collected_order = 0;
+static time_t log_collector_owners_checked = 0;
+
+int log_collector_create(const char *name, int rings, int slots, int record_size)
+{
+    struct log_shm_header header = { LOG_SHM_MAGIC, 0, 0, 0, 0, 0, { 0 } };
+
+    if (log_collector_shm || strlen(name) >= sizeof(log_collector_name))
+        return -1;
+    if (rings < 1)
+        rings = 1;
+    if (rings > LOG_SHM_MAX_RINGS)
+        rings = LOG_SHM_MAX_RINGS;
+    if ((size_t)record_size < LOG_SHM_MIN_RECORD)
+        record_size = LOG_SHM_MIN_RECORD;
+    uint64_t ring_slots = 2;
+    while (ring_slots < (uint64_t)slots)
+        ring_slots <<= 1;
+
+    header.ring_count = rings;
+    header.record_size = record_size;
+    header.slots = ring_slots;
+    header.ring_bytes = (log_ring_size(ring_slots, record_size) + 63) & ~(uint64_t)63;
+    header.collector_pid = getpid();
+
+    /* a segment left behind by a collector that died goes */
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (fd == -1) {
+        perror(name);
+        return -1;
+    }
+    if (ftruncate(fd, log_shm_total(&header)) == -1) {
+        perror(name);
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    struct log_shm_header *shm = mmap(NULL, log_shm_total(&header), PROT_READ | PROT_WRITE,
+                                      MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        perror(name);
+        shm_unlink(name);
+        return -1;
+    }
+
+    memcpy(shm, &header, sizeof(header));
+    memset(shm->magic, 0, sizeof(shm->magic));   /* not ready yet */
+    for (int i = 0; i < rings; i++)
+        log_ring_init(log_shm_ring_at(shm, i), ring_slots, record_size);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(shm->magic, LOG_SHM_MAGIC, sizeof(shm->magic));
+
+    strcpy(log_collector_name, name);
+    log_collector_shm = shm;
+    log_collector_dropped_before = 0;
+    return 0;
+}
+
+/* Move what a ring holds to the pending records */
+static void log_collector_drain(struct log_ring *ring, int record_size)
+{
+    uint64_t pos;
+    struct log_shm_record *rec;
+
+    while ((rec = log_ring_claim(ring, &pos))) {
+        if (log_collected_count == log_collected_room) {
+            size_t room = log_collected_room ? 2 * log_collected_room : 1024;
+            struct log_collected *bigger = realloc(log_collected, room * sizeof(*bigger));
+            if (!bigger) {
+                log_ring_release(ring, pos);
+                continue;
+            }
+            log_collected = bigger;
+            log_collected_room = room;
+        }
+        struct log_shm_record *copy = malloc(record_size);
+        if (copy) {
+            memcpy(copy, rec, record_size);
+            log_collected[log_collected_count].ns = copy->ns;
+            log_collected[log_collected_count].order = log_collected_order++;
+            log_collected[log_collected_count].rec = copy;
+            log_collected_count++;
+        }
+        log_ring_release(ring, pos);
+    }
+}
+
+/* Rings of processes that are gone or have stopped go back to the pool */
+static void log_collector_reclaim(struct log_shm_header *shm)
+{
+    for (unsigned i = 0; i < shm->ring_count; i++) {
+        int32_t owner = __atomic_load_n(&shm->owners[i], __ATOMIC_ACQUIRE);
+        if (!owner || (owner > 0 && log_shm_pid_alive(owner)))
+            continue;
+        struct log_ring *ring = log_shm_ring_at(shm, i);
+        log_collector_drain(ring, shm->record_size);
+        log_collector_dropped_before += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        /* a slot reserved by a process that died stays stuck, start over */
+        log_ring_init(ring, shm->slots, shm->record_size);
+        __atomic_store_n(&shm->owners[i], 0, __ATOMIC_RELEASE);
+    }
+}
+
+static int log_collected_compare(const void *a, const void *b)
+{
+    const struct log_collected *x = a, *y = b;
+
+    if (x->ns != y->ns)
+        return x->ns < y->ns ? -1 : 1;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+/* Hand on the pending records up to 'until', in time order */
+static int log_collector_emit(int64_t until)
+{
+    char prefix[LOG_RECORD_SIZE / 2];
+    size_t n = 0;
+
+    qsort(log_collected, log_collected_count, sizeof(*log_collected), log_collected_compare);
+    for (; n < log_collected_count && log_collected[n].ns <= until; n++) {
+        struct log_shm_record *rec = log_collected[n].rec;
+        snprintf(prefix, sizeof(prefix), "[%d] %s", (int)rec->pid, rec->text);
+        log_output(rec->level, prefix, rec->text + rec->prefix_len + 1);
+        free(rec);
+    }
+    memmove(log_collected, log_collected + n, (log_collected_count - n) * sizeof(*log_collected));
+    log_collected_count -= n;
+    return n;
+}
+
+int log_collector_poll(int lag_ms)
+{
+    struct log_shm_header *shm = log_collector_shm;
+
+    if (!shm)
+        return -1;
+    for (unsigned i = 0; i < shm->ring_count; i++)
+        if (__atomic_load_n(&shm->owners[i], __ATOMIC_ACQUIRE))
+            log_collector_drain(log_shm_ring_at(shm, i), shm->record_size);
+
+    time_t now = time(NULL);
+    if (now != log_collector_owners_checked) {
+        log_collector_owners_checked = now;
+        log_collector_reclaim(shm);
+    }
+    if (!log_collected_count)
+        return 0;
+    return log_collector_emit(log_shm_now_ns() - (int64_t)lag_ms * 1000000);
+}
+
+unsigned long log_collector_dropped(void)
+{
+    unsigned long dropped = log_collector_dropped_before;
+
+    if (log_collector_shm)
+        for (unsigned i = 0; i < log_collector_shm->ring_count; i++)
+            dropped += __atomic_load_n(&log_shm_ring_at(log_collector_shm, i)->dropped,
+                                       __ATOMIC_RELAXED);
+    return dropped;
+}
+
+void log_collector_destroy(void)
+{
+    struct log_shm_header *shm = log_collector_shm;
+
+    if (!shm)
+        return;
+    /* no one attaches from now on, then everything still there goes out */
+    shm_unlink(log_collector_name);
+    for (unsigned i = 0; i < shm->ring_count; i++)
+        log_collector_drain(log_shm_ring_at(shm, i), shm->record_size);
+    log_collector_emit(INT64_MAX);
+    free(log_collected);
+    log_collected = NULL;
+    log_collected_count = log_collected_room = 0;
+    log_collector_shm = NULL;
+    munmap(shm, log_shm_total(shm));
+}
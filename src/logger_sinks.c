@@ -0,0 +1,412 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/****  more output functions, each with its own levels ****/
+
+/* Every sink keeps a level bitmap of its own.  log_level_bitmap, which
+ * the macros test, is the union of these and the bitmap of the main
+ * output function, so a level nobody shows is still turned away before
+ * its arguments are evaluated.  A message is formatted once and the
+ * same prefix and contents go to each sink that shows its level.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "logger.h"
+#include "logger_internal.h"
+
+struct log_sink {
+    void (*output)(char *prefix, char *contents);   /* NULL: a free slot */
+    int scope;
+    int level;
+    int *selection;
+    int selection_size;
+    unsigned long long bitmap[LOG_LEVEL_BITMAP_BITS / 64];
+};
+
+static struct log_sink log_sinks[LOG_SINKS_MAX];
+static int log_sink_count = 0;   /* slots ever used */
+static pthread_mutex_t log_sink_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Work out the bitmap of a sink.  Called with log_sink_mutex held. */
+static void log_sink_rebuild(struct log_sink *sink)
+{
+    for (int i = 0; i < LOG_LEVEL_BITMAP_BITS / 64; i++) {
+        unsigned long long word = 0;
+        for (int bit = 0; bit < 64; bit++)
+            if (log_filter_shows(sink->scope, sink->level, sink->selection,
+                                 sink->selection_size, i * 64 + bit))
+                word |= 1ULL << bit;
+        __atomic_store_n(&sink->bitmap[i], word, __ATOMIC_RELAXED);
+    }
+}
+
+int log_sink_add(void (*output)(char *prefix, char *contents), int display_option, int log_level)
+{
+    int sink = -1;
+
+    if (!output)
+        return -1;
+    pthread_mutex_lock(&log_sink_mutex);
+    for (int i = 0; i < LOG_SINKS_MAX && sink == -1; i++)
+        if (!log_sinks[i].output)
+            sink = i;
+    if (sink != -1) {
+        struct log_sink *s = &log_sinks[sink];
+        s->scope = display_option;
+        s->level = log_level;
+        s->selection = NULL;
+        s->selection_size = 0;
+        log_sink_rebuild(s);
+        /* the slot is ready before logging threads look at it */
+        __atomic_store_n(&s->output, output, __ATOMIC_RELEASE);
+        if (sink >= log_sink_count)
+            __atomic_store_n(&log_sink_count, sink + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&log_sink_mutex);
+
+    log_level_bitmap_update();
+    return sink;
+}
+
+static void log_sink_change(int sink, int display_option, int log_level,
+                            int *selection, int selection_size, int set_selection)
+{
+    if (sink < 0 || sink >= LOG_SINKS_MAX)
+        return;
+
+    pthread_mutex_lock(&log_sink_mutex);
+    struct log_sink *s = &log_sinks[sink];
+    if (s->output) {
+        if (set_selection) {
+            s->selection = selection;
+            s->selection_size = selection_size;
+        }
+        else {
+            s->scope = display_option;
+            s->level = log_level;
+        }
+        log_sink_rebuild(s);
+    }
+    pthread_mutex_unlock(&log_sink_mutex);
+
+    log_level_bitmap_update();
+}
+
+void log_sink_set_level(int sink, int display_option, int log_level)
+{
+    log_sink_change(sink, display_option, log_level, NULL, 0, 0);
+}
+
+void log_sink_set_selection(int sink, int selection[], int selection_size)
+{
+    log_sink_change(sink, 0, 0, selection, selection_size, 1);
+}
+
+void log_sink_remove(int sink)
+{
+    if (sink < 0 || sink >= LOG_SINKS_MAX)
+        return;
+
+    pthread_mutex_lock(&log_sink_mutex);
+    __atomic_store_n(&log_sinks[sink].output, NULL, __ATOMIC_RELEASE);
+    log_sinks[sink].scope = SHOW_NOTHING;
+    log_sink_rebuild(&log_sinks[sink]);
+    pthread_mutex_unlock(&log_sink_mutex);
+
+    log_level_bitmap_update();
+}
+
+void log_sinks_union(unsigned long long *bitmap)
+{
+    pthread_mutex_lock(&log_sink_mutex);
+    for (int i = 0; i < log_sink_count; i++)
+        for (int word = 0; word < LOG_LEVEL_BITMAP_BITS / 64; word++)
+            bitmap[word] |= log_sinks[i].bitmap[word];
+    pthread_mutex_unlock(&log_sink_mutex);
+}
+
+/* Which sinks show a level beyond the bitmap, one bit per sink */
+static unsigned log_sinks_showing(int level)
+{
+    unsigned mask = 0;
+
+    pthread_mutex_lock(&log_sink_mutex);
+    for (int i = 0; i < log_sink_count; i++)
+        if (log_sinks[i].output &&
+            log_filter_shows(log_sinks[i].scope, log_sinks[i].level, log_sinks[i].selection,
+                             log_sinks[i].selection_size, level))
+            mask |= 1u << i;
+    pthread_mutex_unlock(&log_sink_mutex);
+    return mask;
+}
+
+int log_sinks_show(int level)
+{
+    return __atomic_load_n(&log_sink_count, __ATOMIC_ACQUIRE) && log_sinks_showing(level);
+}
+
+int log_sinks_deliver(int level, char *prefix, char *contents, size_t bytes)
+{
+    int count = __atomic_load_n(&log_sink_count, __ATOMIC_ACQUIRE);
+    int delivered = 0;
+
+    if (!count)
+        return 0;
+
+    /* no lock on the way for levels in the bitmap */
+    unsigned mask = 0;
+    if ((unsigned)level < LOG_LEVEL_BITMAP_BITS) {
+        for (int i = 0; i < count; i++)
+            if ((__atomic_load_n(&log_sinks[i].bitmap[(unsigned)level / 64], __ATOMIC_RELAXED)
+                 >> ((unsigned)level % 64)) & 1)
+                mask |= 1u << i;
+    }
+    else
+        mask = log_sinks_showing(level);
+
+    for (int i = 0; mask; i++, mask >>= 1) {
+        if (!(mask & 1))
+            continue;
+        void (*output)(char *, char *) = __atomic_load_n(&log_sinks[i].output, __ATOMIC_ACQUIRE);
+        if (output) {
+            output(prefix, contents);
+            if (bytes)
+                log_stats_wrote(i + 1, bytes);
+            delivered++;
+        }
+    }
+    return delivered;
+}
+
+/****  standard error ****/
+
+void log_print_to_stderr(char *prefix, char *contents)
+{
+    log_print_terminal(STDERR_FILENO, prefix, contents);
+}
+
+/****  the last few kilobytes, in memory ****/
+
+/* A circle of bytes holding whole messages, each behind its length
+ * (the prefix has a newline in it, so lines won't do).  Making room
+ * throws away the oldest messages. */
+static char *log_memory = NULL;
+static size_t log_memory_size = 0;
+static size_t log_memory_start_at = 0;   /* the oldest byte */
+static size_t log_memory_used = 0;
+static pthread_mutex_t log_memory_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define LOG_MEMORY_MIN 256
+
+void log_memory_start(size_t bytes)
+{
+    if (bytes && bytes < LOG_MEMORY_MIN)
+        bytes = LOG_MEMORY_MIN;
+    char *memory = bytes ? malloc(bytes) : NULL;
+
+    pthread_mutex_lock(&log_memory_mutex);
+    free(log_memory);
+    log_memory = memory;
+    log_memory_size = memory ? bytes : 0;
+    log_memory_start_at = 0;
+    log_memory_used = 0;
+    pthread_mutex_unlock(&log_memory_mutex);
+}
+
+static void log_memory_put(const void *from, size_t len)
+{
+    const char *p = from;
+
+    while (len > 0) {
+        size_t at = (log_memory_start_at + log_memory_used) % log_memory_size;
+        size_t chunk = log_memory_size - at < len ? log_memory_size - at : len;
+        memcpy(log_memory + at, p, chunk);
+        log_memory_used += chunk;
+        p += chunk;
+        len -= chunk;
+    }
+}
+
+/* Copy len bytes from offset 'at' past the oldest byte */
+static void log_memory_get(size_t at, void *into, size_t len)
+{
+    char *p = into;
+
+    for (size_t i = 0; i < len; i++)
+        p[i] = log_memory[(log_memory_start_at + at + i) % log_memory_size];
+}
+
+void log_print_to_memory(char *prefix, char *contents)
+{
+    uint32_t len;
+
+    if (!prefix)
+        prefix = "(null)";
+    if (!contents)
+        contents = "(null)";
+    size_t prefix_len = strlen(prefix), contents_len = strlen(contents);
+
+    pthread_mutex_lock(&log_memory_mutex);
+    if (!log_memory) {
+        pthread_mutex_unlock(&log_memory_mutex);
+        return;
+    }
+    /* a message bigger than the whole memory is cut short */
+    size_t room = log_memory_size - sizeof(len);
+    if (prefix_len + contents_len + 2 > room) {
+        if (prefix_len + 2 > room)
+            prefix_len = room - 2;
+        contents_len = room - prefix_len - 2;
+    }
+    len = prefix_len + contents_len + 2;
+
+    while (log_memory_size - log_memory_used < sizeof(len) + len) {
+        uint32_t oldest;
+        log_memory_get(0, &oldest, sizeof(oldest));
+        log_memory_start_at = (log_memory_start_at + sizeof(oldest) + oldest) % log_memory_size;
+        log_memory_used -= sizeof(oldest) + oldest;
+    }
+    log_memory_put(&len, sizeof(len));
+    log_memory_put(prefix, prefix_len);
+    log_memory_put(" ", 1);
+    log_memory_put(contents, contents_len);
+    log_memory_put("\n", 1);
+    pthread_mutex_unlock(&log_memory_mutex);
+}
+
+size_t log_memory_read(char *out, size_t room)
+{
+    size_t len = 0;
+
+    if (!room)
+        return 0;
+    pthread_mutex_lock(&log_memory_mutex);
+    if (log_memory) {
+        size_t text = 0, at = 0;
+        uint32_t message;
+
+        for (; at < log_memory_used; at += sizeof(message) + message) {
+            log_memory_get(at, &message, sizeof(message));
+            text += message;
+        }
+        /* the newest messages that fit */
+        for (at = 0; at < log_memory_used; at += sizeof(message) + message) {
+            log_memory_get(at, &message, sizeof(message));
+            if (text <= room - 1) {
+                log_memory_get(at + sizeof(message), out + len, message);
+                len += message;
+            }
+            text -= message;
+        }
+    }
+    pthread_mutex_unlock(&log_memory_mutex);
+    out[len] = '\0';
+    return len;
+}
+
+/****  a syslog style datagram socket ****/
+
+#define LOG_SYSLOG_DEFAULT_PATH "/dev/log"
+#define LOG_SYSLOG_FACILITY_USER 1
+#define LOG_SYSLOG_MAX 2048
+
+static int log_syslog_fd = -1;
+static char log_syslog_ident[64];
+
+int log_syslog_open(const char *socket_path, const char *ident)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (!socket_path)
+        socket_path = LOG_SYSLOG_DEFAULT_PATH;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    log_syslog_close();
+    snprintf(log_syslog_ident, sizeof(log_syslog_ident), "%s", ident ? ident : "logger");
+    __atomic_store_n(&log_syslog_fd, fd, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void log_syslog_close(void)
+{
+    int fd = __atomic_exchange_n(&log_syslog_fd, -1, __ATOMIC_ACQ_REL);
+    if (fd != -1)
+        close(fd);
+}
+
+/* The syslog severity closest to a level, custom levels count as debug */
+static int log_syslog_severity(int level)
+{
+    switch (level) {
+        case LOG_ERR:    return 3;
+        case LOG_WARN:   return 4;
+        case LOG_NOTICE: return 5;
+        case LOG_INFO:   return 6;
+        default:         return 7;
+    }
+}
+
+void log_print_to_syslog(char *prefix, char *contents)
+{
+    int fd = __atomic_load_n(&log_syslog_fd, __ATOMIC_ACQUIRE);
+    char datagram[LOG_SYSLOG_MAX];
+
+    if (fd == -1)
+        return;
+    char plain[LOG_RECORD_SIZE];
+    char *spill = log_color_plain(&prefix, &contents, plain, sizeof(plain));
+    int len = snprintf(datagram, sizeof(datagram), "<%d>%s[%d]: %s %s",
+                       LOG_SYSLOG_FACILITY_USER * 8 + log_syslog_severity(log_current_level()),
+                       log_syslog_ident, (int)getpid(), prefix ? prefix : "(null)",
+                       contents ? contents : "(null)");
+    free(spill);
+    if (len < 0)
+        return;
+    if (len >= (int)sizeof(datagram))
+        len = sizeof(datagram) - 1;
+
+    /* one line: a newline and the indent after it become one space */
+    char *out = datagram;
+    for (int i = 0; i < len; i++) {
+        if (datagram[i] == '\n') {
+            *out++ = ' ';
+            while (i + 1 < len && datagram[i + 1] == ' ')
+                i++;
+        }
+        else
+            *out++ = datagram[i];
+    }
+    send(fd, datagram, out - datagram, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
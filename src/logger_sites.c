@@ -0,0 +1,200 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/****  call site registry ****/
+
+/* The log macros leave a struct log_callsite per call site in the
+ * log_callsites section.  The linker gathers them into one array per
+ * executable or shared library, and a constructor in logger.h hands
+ * that array to log_sites_add.  Turning a site on or off is a store to
+ * its state, which the macro reads before anything else happens.
+ */
+
+#include <ctype.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logger.h"
+#include "logger_internal.h"
+
+/* Executables and shared libraries, more than this are ignored */
+#define LOG_SITE_MODULES_MAX 64
+
+struct log_site_module {
+    struct log_callsite *start;
+    struct log_callsite *stop;
+};
+
+int log_sites_wanted = 0;
+
+static struct log_site_module log_site_modules[LOG_SITE_MODULES_MAX];
+static int log_site_module_count = 0;
+static pthread_mutex_t log_site_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void log_sites_add(struct log_callsite *start, struct log_callsite *stop)
+{
+    if (!start || start >= stop)
+        return;
+
+    pthread_mutex_lock(&log_site_mutex);
+    int known = 0;
+    /* every source file that includes logger.h asks for its module */
+    for (int i = 0; i < log_site_module_count; i++)
+        known |= log_site_modules[i].start == start;
+    if (!known && log_site_module_count < LOG_SITE_MODULES_MAX) {
+        log_site_modules[log_site_module_count].start = start;
+        log_site_modules[log_site_module_count].stop = stop;
+        log_site_module_count++;
+    }
+    pthread_mutex_unlock(&log_site_mutex);
+}
+
+/* __FILE__ is whatever path the compiler was given, so the glob may
+ * match all of it or just the file name */
+static int log_site_file_matches(const char *glob, const char *filename)
+{
+    const char *slash = strrchr(filename, '/');
+
+    return !fnmatch(glob, filename, 0) || (slash && !fnmatch(glob, slash + 1, 0));
+}
+
+int log_site_set(const char *file_glob, const char *function_glob, int level, int state)
+{
+    int changed = 0;
+
+    pthread_mutex_lock(&log_site_mutex);
+    for (int i = 0; i < log_site_module_count; i++) {
+        for (struct log_callsite *site = log_site_modules[i].start;
+             site < log_site_modules[i].stop; site++) {
+            if ((file_glob && !log_site_file_matches(file_glob, site->filename)) ||
+                (function_glob && fnmatch(function_glob, site->function, 0)) ||
+                (level && site->level != level))
+                continue;
+            __atomic_store_n(&site->state, state, __ATOMIC_RELAXED);
+            changed++;
+        }
+    }
+    pthread_mutex_unlock(&log_site_mutex);
+    return changed;
+}
+
+int log_site_control(const char *spec)
+{
+    char *copy = strdup(spec), *save = NULL;
+    char *file = NULL, *function = NULL;
+    int level = 0, state = -1;
+
+    if (!copy)
+        return -1;
+    for (char *word = strtok_r(copy, " \t\n", &save); word;
+         word = strtok_r(NULL, " \t\n", &save)) {
+        if (state != -1)
+            break;  /* nothing may follow the + - or = */
+        if (!strcmp(word, "+"))
+            state = LOG_SITE_ENABLED;
+        else if (!strcmp(word, "-"))
+            state = LOG_SITE_DISABLED;
+        else if (!strcmp(word, "="))
+            state = LOG_SITE_DEFAULT;
+        else {
+            char *value = strtok_r(NULL, " \t\n", &save);
+            if (!value)
+                break;
+            if (!strcmp(word, "file"))
+                file = value;
+            else if (!strcmp(word, "func"))
+                function = value;
+            else if (!strcmp(word, "level") && isdigit((unsigned char)*value))
+                level = atoi(value);
+            else
+                break;
+            continue;
+        }
+        if (!strtok_r(NULL, " \t\n", &save)) {
+            int changed = log_site_set(file, function, level, state);
+            free(copy);
+            return changed;
+        }
+    }
+    free(copy);
+    return -1;
+}
+
+void log_site_list(void (*output)(char *prefix, char *contents))
+{
+    static const char state_chars[] = "=+-";
+    char prefix[LOG_RECORD_SIZE / 2], contents[LOG_RECORD_SIZE / 2];
+
+    pthread_mutex_lock(&log_site_mutex);
+    for (int i = 0; i < log_site_module_count; i++) {
+        for (struct log_callsite *site = log_site_modules[i].start;
+             site < log_site_modules[i].stop; site++) {
+            int state = __atomic_load_n(&site->state, __ATOMIC_RELAXED);
+            snprintf(prefix, sizeof(prefix), "%s:%d %s()",
+                     site->filename, site->linenum, site->function);
+            snprintf(contents, sizeof(contents), "%s %d %c \"%s\"", site->name, site->level,
+                     state >= 0 && state <= 2 ? state_chars[state] : '?', site->fmt);
+            output(prefix, contents);
+        }
+    }
+    pthread_mutex_unlock(&log_site_mutex);
+}
+
+const char *log_site_prefix(struct log_callsite *site, int *len)
+{
+    const char *prefix = __atomic_load_n(&site->prefix, __ATOMIC_ACQUIRE);
+    char *mine = NULL;
+
+    if (LOG_UNLIKELY(!prefix)) {
+        /* threads racing here render the same bytes, one of them is kept */
+        int mine_len = asprintf(&mine, LOG_PREFIX_FMT, site->name, site->filename,
+                                site->linenum, site->function);
+        if (mine_len < 0)
+            return NULL;
+        __atomic_store_n(&site->prefix_len, mine_len, __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&site->prefix, &prefix, mine, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+            prefix = mine;
+        else
+            free(mine);
+    }
+    *len = __atomic_load_n(&site->prefix_len, __ATOMIC_RELAXED);
+    return prefix;
+}
+
+void __attribute__((nonnull, format(printf,3,4)))
+_log_site_msg(struct log_callsite *site, int level, const char *fmt, ...)
+{
+    va_list argp;
+    va_start(argp, fmt);
+
+    /* recorded whatever the level, shown only if the site is enabled */
+    if (__atomic_load_n(&log_flight_active, __ATOMIC_RELAXED))
+        log_flight_record(site, level, argp);
+    if (!log_callsite_enabled(site, level)) {
+        if (__atomic_load_n(&log_stats_filtering, __ATOMIC_RELAXED))
+            log_stats_filtered(level);
+        va_end(argp);
+        return;
+    }
+    log_vmsg(site->name, level, site->filename, site->linenum, site->function,
+             site, NULL, 0, fmt, argp);
+    va_end(argp);
+}
@@ -0,0 +1,386 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/****  self-metrics: counters and latency histograms ****/
+
+/* Every thread counts into a shard of its own, so counting takes no
+ * lock and no atomic read-modify-write: only the owner writes a shard,
+ * log_get_stats() reads them all and adds them up.  Like the flight
+ * recorder rings, shards are never freed, a finished thread's shard
+ * goes on counting for the next new thread.
+ *
+ * Latencies go into log-linear buckets as in an HDR histogram: values
+ * below 8 get a bucket each, above that every power of two is split
+ * into 8 buckets, which covers the whole 64 bit range in 496 buckets.
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "logger.h"
+#include "logger_internal.h"
+
+struct log_stats_shard {
+    struct log_stats_shard *next;
+    int owned;          /* a live thread counts into it */
+    unsigned long long emitted[LOG_STATS_LEVELS];
+    unsigned long long filtered[LOG_STATS_LEVELS];
+    unsigned long long bytes[1 + LOG_SINKS_MAX];   /* output function, sinks */
+    struct log_latency message;
+    struct log_latency output;
+};
+
+int log_stats_active = 0;
+int log_stats_filtering = 0;
+
+static struct log_stats_shard *log_stats_shards = NULL;
+static pthread_once_t log_stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_stats_key;
+static __thread struct log_stats_shard *log_stats_mine = NULL;
+
+/* Only the owner adds, readers may see the old or the new value */
+#define LOG_STATS_ADD(counter, n)                                              \
+    __atomic_store_n(&(counter), __atomic_load_n(&(counter), __ATOMIC_RELAXED) + (n), \
+                     __ATOMIC_RELAXED)
+
+/****  counting ****/
+
+static void log_stats_thread_exit(void *mine)
+{
+    struct log_stats_shard *shard = mine;
+    __atomic_store_n(&shard->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void log_stats_make_key(void)
+{
+    pthread_key_create(&log_stats_key, log_stats_thread_exit);
+}
+
+static struct log_stats_shard *log_stats_shard(void)
+{
+    struct log_stats_shard *shard = log_stats_mine;
+
+    if (shard)
+        return shard;
+    pthread_once(&log_stats_once, log_stats_make_key);
+
+    /* the shard of a finished thread, or a new one */
+    for (shard = __atomic_load_n(&log_stats_shards, __ATOMIC_ACQUIRE); shard; shard = shard->next) {
+        int free_shard = 0;
+        if (__atomic_compare_exchange_n(&shard->owned, &free_shard, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (!shard) {
+        shard = calloc(1, sizeof(*shard));
+        if (!shard)
+            return NULL;
+        shard->owned = 1;
+        shard->next = __atomic_load_n(&log_stats_shards, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&log_stats_shards, &shard->next, shard, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    pthread_setspecific(log_stats_key, shard);
+    log_stats_mine = shard;
+    return shard;
+}
+
+unsigned long long log_stats_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned log_latency_bucket(unsigned long long ns)
+{
+    if (ns < 8)
+        return ns;
+    int power = 63 - __builtin_clzll(ns);
+    return (power - 2) * 8 + ((ns >> (power - 3)) & 7);
+}
+
+/* The largest value that goes into bucket */
+static unsigned long long log_latency_bucket_top(unsigned bucket)
+{
+    if (bucket < 8)
+        return bucket;
+    int shift = bucket / 8 - 1;
+    return ((8ULL + bucket % 8) << shift) + ((1ULL << shift) - 1);
+}
+
+static void log_latency_add(struct log_latency *latency, unsigned long long ns)
+{
+    LOG_STATS_ADD(latency->buckets[log_latency_bucket(ns)], 1);
+    LOG_STATS_ADD(latency->count, 1);
+    LOG_STATS_ADD(latency->total_ns, ns);
+    if (ns > latency->max_ns)
+        __atomic_store_n(&latency->max_ns, ns, __ATOMIC_RELAXED);
+}
+
+static unsigned log_stats_level(int level)
+{
+    return (unsigned)level < LOG_STATS_LEVELS ? (unsigned)level : LOG_STATS_LEVELS - 1;
+}
+
+void log_stats_message(int level, unsigned long long ns)
+{
+    struct log_stats_shard *shard = log_stats_shard();
+
+    if (!shard)
+        return;
+    LOG_STATS_ADD(shard->emitted[log_stats_level(level)], 1);
+    if (ns)
+        log_latency_add(&shard->message, ns);
+}
+
+void log_stats_filtered(int level)
+{
+    struct log_stats_shard *shard = log_stats_shard();
+
+    if (shard)
+        LOG_STATS_ADD(shard->filtered[log_stats_level(level)], 1);
+}
+
+void log_stats_wrote(int output, size_t bytes)
+{
+    struct log_stats_shard *shard = log_stats_shard();
+
+    if (shard && output >= 0 && output <= LOG_SINKS_MAX)
+        LOG_STATS_ADD(shard->bytes[output], bytes);
+}
+
+void log_stats_output(unsigned long long ns)
+{
+    struct log_stats_shard *shard = log_stats_shard();
+
+    if (shard)
+        log_latency_add(&shard->output, ns);
+}
+
+void log_stats_start(int options)
+{
+    int filtering = !!(options & LOG_STATS_FILTERED);
+
+    __atomic_store_n(&log_stats_filtering, filtering, __ATOMIC_RELAXED);
+    if (filtering)
+        __atomic_or_fetch(&log_sites_wanted, LOG_WANTED_STATS, __ATOMIC_RELEASE);
+    else
+        __atomic_and_fetch(&log_sites_wanted, ~LOG_WANTED_STATS, __ATOMIC_RELEASE);
+    __atomic_store_n(&log_stats_active, 1, __ATOMIC_RELEASE);
+}
+
+void log_stats_stop(void)
+{
+    __atomic_store_n(&log_stats_active, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&log_stats_filtering, 0, __ATOMIC_RELAXED);
+    __atomic_and_fetch(&log_sites_wanted, ~LOG_WANTED_STATS, __ATOMIC_RELEASE);
+}
+
+/****  reading ****/
+
+static void log_latency_sum(struct log_latency *sum, const struct log_latency *shard)
+{
+    for (int i = 0; i < LOG_LATENCY_BUCKETS; i++)
+        sum->buckets[i] += __atomic_load_n(&shard->buckets[i], __ATOMIC_RELAXED);
+    sum->count += __atomic_load_n(&shard->count, __ATOMIC_RELAXED);
+    sum->total_ns += __atomic_load_n(&shard->total_ns, __ATOMIC_RELAXED);
+    unsigned long long max = __atomic_load_n(&shard->max_ns, __ATOMIC_RELAXED);
+    if (max > sum->max_ns)
+        sum->max_ns = max;
+}
+
+void log_get_stats(struct log_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    for (struct log_stats_shard *shard = __atomic_load_n(&log_stats_shards, __ATOMIC_ACQUIRE);
+         shard; shard = shard->next) {
+        for (int i = 0; i < LOG_STATS_LEVELS; i++) {
+            stats->emitted[i] += __atomic_load_n(&shard->emitted[i], __ATOMIC_RELAXED);
+            stats->filtered[i] += __atomic_load_n(&shard->filtered[i], __ATOMIC_RELAXED);
+        }
+        stats->output_bytes += __atomic_load_n(&shard->bytes[0], __ATOMIC_RELAXED);
+        for (int i = 0; i < LOG_SINKS_MAX; i++)
+            stats->sink_bytes[i] += __atomic_load_n(&shard->bytes[i + 1], __ATOMIC_RELAXED);
+        log_latency_sum(&stats->message, &shard->message);
+        log_latency_sum(&stats->output, &shard->output);
+    }
+    stats->async_queued = log_async_queued();
+    stats->async_dropped = log_async_dropped();
+    stats->shm_dropped = log_shm_dropped();
+}
+
+unsigned long long log_latency_percentile(const struct log_latency *latency, double percent)
+{
+    unsigned long long count = 0;
+
+    for (int i = 0; i < LOG_LATENCY_BUCKETS; i++)
+        count += latency->buckets[i];
+    if (!count)
+        return 0;
+
+    /* the rank of the value asked for, rounded up */
+    double want = count * (percent < 0 ? 0 : percent > 100 ? 100 : percent) / 100;
+    unsigned long long rank = want;
+    if (rank < want || rank == 0)
+        rank++;
+    unsigned long long seen = 0;
+    for (int i = 0; i < LOG_LATENCY_BUCKETS; i++) {
+        seen += latency->buckets[i];
+        if (seen >= rank) {
+            unsigned long long top = log_latency_bucket_top(i);
+            return top < latency->max_ns ? top : latency->max_ns;
+        }
+    }
+    return latency->max_ns;
+}
+
+/****  dumps ****/
+
+static const char *log_stats_level_names[] = {
+    [LOG_ERR] = "ERR", [LOG_WARN] = "WARN", [LOG_NOTICE] = "NOTICE",
+    [LOG_DEBUG] = "DEBUG", [LOG_INFO] = "INFO",
+};
+
+/* Append printf output at *used, as far as it fits */
+static void __attribute__((format(printf, 4, 5)))
+log_stats_put(char *out, size_t room, size_t *used, const char *fmt, ...)
+{
+    va_list argp;
+
+    if (*used >= room)
+        return;
+    va_start(argp, fmt);
+    int len = vsnprintf(out + *used, room - *used, fmt, argp);
+    va_end(argp);
+    if (len > 0)
+        *used += len;
+}
+
+static void log_stats_put_levels(char *out, size_t room, size_t *used, const char *what,
+                                 const unsigned long long *counts)
+{
+    log_stats_put(out, room, used, "\n           %-9s", what);
+    for (int i = 0; i < LOG_STATS_LEVELS; i++) {
+        if (!counts[i])
+            continue;
+        if ((size_t)i < sizeof(log_stats_level_names) / sizeof(char *) &&
+            log_stats_level_names[i])
+            log_stats_put(out, room, used, " %s %llu", log_stats_level_names[i], counts[i]);
+        else
+            log_stats_put(out, room, used, " %d%s %llu", i,
+                          i == LOG_STATS_LEVELS - 1 ? "+" : "", counts[i]);
+    }
+}
+
+static void log_stats_put_latency(char *out, size_t room, size_t *used, const char *what,
+                                  const struct log_latency *latency)
+{
+    log_stats_put(out, room, used,
+                  "\n           %-9s n %llu mean %llu p50 %llu p90 %llu p99 %llu p99.9 %llu "
+                  "max %llu ns", what, latency->count,
+                  latency->count ? latency->total_ns / latency->count : 0,
+                  log_latency_percentile(latency, 50), log_latency_percentile(latency, 90),
+                  log_latency_percentile(latency, 99), log_latency_percentile(latency, 99.9),
+                  latency->max_ns);
+}
+
+void log_stats_dump(void (*output)(char *prefix, char *contents))
+{
+    struct log_stats *stats = malloc(sizeof(*stats));
+    char prefix[80], contents[LOG_RECORD_SIZE * 2];
+    size_t used = 0, room = sizeof(contents);
+
+    if (!stats)
+        return;
+    log_get_stats(stats);
+
+    int stamp_len = log_timestamp(prefix, sizeof(prefix));
+    snprintf(prefix + stamp_len, sizeof(prefix) - stamp_len, "%-10s logger stats \n          ",
+             "STATS");
+
+    contents[0] = '\0';
+    log_stats_put_levels(contents, room, &used, "emitted", stats->emitted);
+    log_stats_put_levels(contents, room, &used, "filtered", stats->filtered);
+    log_stats_put(contents, room, &used, "\n           %-9s output %llu", "bytes",
+                  stats->output_bytes);
+    for (int i = 0; i < LOG_SINKS_MAX; i++)
+        if (stats->sink_bytes[i])
+            log_stats_put(contents, room, &used, ", sink %d %llu", i, stats->sink_bytes[i]);
+    log_stats_put(contents, room, &used,
+                  "\n           %-9s queued %lu, dropped %lu, shm dropped %lu", "async",
+                  stats->async_queued, stats->async_dropped, stats->shm_dropped);
+    log_stats_put_latency(contents, room, &used, "message", &stats->message);
+    log_stats_put_latency(contents, room, &used, "output", &stats->output);
+    free(stats);
+
+    int outer = log_output_level;
+    log_output_level = LOG_NOTICE;
+    output(prefix, contents + 12);   /* the prefix ends the first line */
+    log_output_level = outer;
+}
+
+static pthread_t log_stats_thread;
+static pthread_mutex_t log_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_stats_wake = PTHREAD_COND_INITIALIZER;
+static int log_stats_interval = 0;
+static void (*log_stats_dump_output)(char *prefix, char *contents) = NULL;
+
+static void *log_stats_dumper(void *unused)
+{
+    (void)unused;
+    pthread_mutex_lock(&log_stats_mutex);
+    while (log_stats_interval > 0) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += log_stats_interval;
+        if (pthread_cond_timedwait(&log_stats_wake, &log_stats_mutex, &until) == 0)
+            continue;   /* woken up: stopped, or a new interval */
+
+        void (*output)(char *, char *) = log_stats_dump_output;
+        pthread_mutex_unlock(&log_stats_mutex);
+        log_stats_dump(output);
+        pthread_mutex_lock(&log_stats_mutex);
+    }
+    pthread_mutex_unlock(&log_stats_mutex);
+    return NULL;
+}
+
+void log_stats_dump_every(int interval_secs, void (*output)(char *prefix, char *contents))
+{
+    pthread_mutex_lock(&log_stats_mutex);
+    int running = log_stats_interval > 0;
+    log_stats_interval = output && interval_secs > 0 ? interval_secs : 0;
+    log_stats_dump_output = output;
+    pthread_cond_signal(&log_stats_wake);
+
+    if (!running && log_stats_interval &&
+        pthread_create(&log_stats_thread, NULL, log_stats_dumper, NULL)) {
+        fprintf(stderr, "Couldn't start the stats dump thread.\n");
+        log_stats_interval = 0;
+    }
+    pthread_mutex_unlock(&log_stats_mutex);
+
+    if (running && !log_stats_interval)
+        pthread_join(log_stats_thread, NULL);
+}
@@ -0,0 +1,508 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/****  log file output through io_uring ****/
+
+/* Messages are copied into one of a few buffers registered with the
+ * kernel.  Full buffers are handed to an io_uring as a chain of linked
+ * writes, so the kernel writes them in order while the logging threads
+ * go on filling the others; nobody waits for the disk unless every
+ * buffer is taken.  Only one chain is in flight at a time, the log file
+ * is opened O_APPEND and writes that overtake each other would mix it
+ * up.  Completions are picked up by whichever thread logs next, which
+ * then submits what has filled up meanwhile in one go.
+ *
+ * The ring is set up with the raw system calls, there is no liburing.
+ * Kernels without io_uring, or where it is not allowed, get write().
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include "logger.h"
+#include "logger_internal.h"
+
+#define LOG_URING_MIN_BUFFER 4096
+#define LOG_URING_MAX_BUFFERS 64
+
+/* user_data of the fsync, the writes carry their buffer number */
+#define LOG_URING_FSYNC_DATA (~0ULL)
+
+struct log_uring {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_map_len, cq_map_len, sqes_len;
+    int fixed;          /* the buffers are registered */
+    int async;          /* IOSQE_ASYNC is known */
+};
+
+struct log_uring_buffer {
+    char *data;
+    size_t used;
+    size_t done;        /* written so far, while it is in flight */
+};
+
+static struct log_uring log_uring = { .fd = -1 };
+static struct log_uring_buffer log_uring_buffers[LOG_URING_MAX_BUFFERS];
+static int log_uring_count = 0;
+static size_t log_uring_size = 0;
+static int log_uring_interval_ms = 0;
+static int log_uring_options = 0;
+static long long log_uring_last_submit_ms = 0;
+
+/* The buffer being filled, the full ones in order, and the chain the
+ * kernel is working on.  All of it under log_uring_mutex. */
+static int log_uring_active = -1;
+static int log_uring_full[LOG_URING_MAX_BUFFERS];
+static int log_uring_full_count = 0;
+static int log_uring_free[LOG_URING_MAX_BUFFERS];
+static int log_uring_free_count = 0;
+static int log_uring_in_flight = 0;
+static int log_uring_fsync_wanted = 0;
+static int log_uring_broken = 0;   /* submitting failed, write() it is */
+static pthread_mutex_t log_uring_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static long long log_uring_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static int log_uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, log_uring.fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/****  the ring ****/
+
+static void log_uring_close(void)
+{
+    if (log_uring.fd == -1)
+        return;
+    if (log_uring.sqes)
+        munmap(log_uring.sqes, log_uring.sqes_len);
+    if (log_uring.cq_map && log_uring.cq_map != log_uring.sq_map)
+        munmap(log_uring.cq_map, log_uring.cq_map_len);
+    if (log_uring.sq_map)
+        munmap(log_uring.sq_map, log_uring.sq_map_len);
+    close(log_uring.fd);
+    memset(&log_uring, 0, sizeof(log_uring));
+    log_uring.fd = -1;
+}
+
+static int log_uring_open(unsigned entries)
+{
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    log_uring.fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (log_uring.fd < 0) {
+        log_uring.fd = -1;
+        return -1;
+    }
+
+    log_uring.sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    log_uring.cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (log_uring.cq_map_len > log_uring.sq_map_len)
+            log_uring.sq_map_len = log_uring.cq_map_len;
+        log_uring.cq_map_len = log_uring.sq_map_len;
+    }
+    log_uring.sq_map = mmap(NULL, log_uring.sq_map_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, log_uring.fd, IORING_OFF_SQ_RING);
+    if (log_uring.sq_map == MAP_FAILED) {
+        log_uring.sq_map = NULL;
+        log_uring_close();
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        log_uring.cq_map = log_uring.sq_map;
+    else {
+        log_uring.cq_map = mmap(NULL, log_uring.cq_map_len, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, log_uring.fd, IORING_OFF_CQ_RING);
+        if (log_uring.cq_map == MAP_FAILED) {
+            log_uring.cq_map = NULL;
+            log_uring_close();
+            return -1;
+        }
+    }
+    log_uring.sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    log_uring.sqes = mmap(NULL, log_uring.sqes_len, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, log_uring.fd, IORING_OFF_SQES);
+    if (log_uring.sqes == MAP_FAILED) {
+        log_uring.sqes = NULL;
+        log_uring_close();
+        return -1;
+    }
+
+    /* came with 5.6, as did IOSQE_ASYNC */
+    log_uring.async = !!(params.features & IORING_FEAT_RW_CUR_POS);
+
+    char *sq = log_uring.sq_map, *cq = log_uring.cq_map;
+    log_uring.sq_head = (unsigned *)(sq + params.sq_off.head);
+    log_uring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    log_uring.sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    log_uring.sq_array = (unsigned *)(sq + params.sq_off.array);
+    log_uring.cq_head = (unsigned *)(cq + params.cq_off.head);
+    log_uring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    log_uring.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    log_uring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+/****  writing ****/
+
+/* The kernel didn't write all of the buffer: do the rest ourselves,
+ * the writes linked behind it were cancelled and come after this */
+static void log_uring_write_rest(struct log_uring_buffer *buf)
+{
+    int fd = __atomic_load_n(&log_file_fd, __ATOMIC_ACQUIRE);
+
+    while (buf->done < buf->used) {
+        ssize_t done = write(fd, buf->data + buf->done, buf->used - buf->done);
+        if (done <= 0 && errno != EINTR)
+            break;
+        if (done > 0) {
+            log_file_wrote(done);
+            buf->done += done;
+        }
+    }
+}
+
+/* Take the completions the kernel has posted, without waiting */
+static void log_uring_reap(void)
+{
+    unsigned head = *log_uring.cq_head;
+
+    while (head != __atomic_load_n(log_uring.cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &log_uring.cqes[head & *log_uring.cq_mask];
+        if (cqe->user_data != LOG_URING_FSYNC_DATA) {
+            struct log_uring_buffer *buf = &log_uring_buffers[cqe->user_data];
+            if (cqe->res > 0) {
+                log_file_wrote(cqe->res);
+                buf->done += cqe->res;
+            }
+            /* short, failed, or cancelled because one before it was */
+            log_uring_write_rest(buf);
+            buf->used = buf->done = 0;
+            log_uring_free[log_uring_free_count++] = cqe->user_data;
+        }
+        log_uring_in_flight--;
+        head++;
+    }
+    __atomic_store_n(log_uring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Wait for at least one completion and take it */
+static void log_uring_wait(void)
+{
+    /* completions get posted whatever enter says, so on errors nap */
+    if (log_uring_enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+        nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+    log_uring_reap();
+}
+
+/* Hand the full buffers to the kernel as one chain of linked writes,
+ * with an fsync behind them if a LOG_ERR message asked for one */
+static void log_uring_submit_chain(void)
+{
+    if (log_uring_in_flight || (!log_uring_full_count && !log_uring_fsync_wanted))
+        return;
+
+    int fd = __atomic_load_n(&log_file_fd, __ATOMIC_ACQUIRE);
+
+    if (log_uring_broken) {
+        for (int i = 0; i < log_uring_full_count; i++) {
+            struct log_uring_buffer *buf = &log_uring_buffers[log_uring_full[i]];
+            log_uring_write_rest(buf);
+            buf->used = buf->done = 0;
+            log_uring_free[log_uring_free_count++] = log_uring_full[i];
+        }
+        if (log_uring_fsync_wanted)
+            fdatasync(fd);
+        log_uring_full_count = 0;
+        log_uring_fsync_wanted = 0;
+        return;
+    }
+
+    unsigned tail = *log_uring.sq_tail;
+    int count = log_uring_full_count + log_uring_fsync_wanted;
+
+    for (int i = 0; i < count; i++) {
+        unsigned index = tail & *log_uring.sq_mask;
+        struct io_uring_sqe *sqe = &log_uring.sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = fd;
+        if (i < log_uring_full_count) {
+            int b = log_uring_full[i];
+            sqe->opcode = log_uring.fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+            sqe->buf_index = log_uring.fixed ? b : 0;
+            sqe->addr = (unsigned long)log_uring_buffers[b].data;
+            sqe->len = log_uring_buffers[b].used;
+            sqe->off = -1;   /* O_APPEND: the end of the file */
+            sqe->user_data = b;
+            /* straight to a kernel worker: tried inline, a buffered
+             * write would copy the data in this thread */
+            if (log_uring.async)
+                sqe->flags = IOSQE_ASYNC;
+        }
+        else {
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+            sqe->user_data = LOG_URING_FSYNC_DATA;
+        }
+        if (i < count - 1)
+            sqe->flags |= IOSQE_IO_LINK;
+        log_uring.sq_array[index] = index;
+        tail++;
+    }
+    __atomic_store_n(log_uring.sq_tail, tail, __ATOMIC_RELEASE);
+
+    int submitted = 0;
+    while (submitted < count) {
+        int done = log_uring_enter(count - submitted, 0, 0);
+        if (done > 0)
+            submitted += done;
+        else if (done < 0 && (errno == EAGAIN || errno == EBUSY))
+            nanosleep(&(struct timespec){ 0, 100000 }, NULL);
+        else if (done < 0 && errno != EINTR)
+            break;
+    }
+    log_uring_in_flight = submitted;
+    log_uring_last_submit_ms = log_uring_now_ms();
+
+    if (submitted < count) {
+        /* take back what the kernel didn't get, it is written directly
+         * once the writes in flight are done */
+        fprintf(stderr, "io_uring failed (%s), the log file is written directly.\n",
+                strerror(errno));
+        __atomic_store_n(log_uring.sq_tail, tail - (count - submitted), __ATOMIC_RELEASE);
+        log_uring_broken = 1;
+        if (submitted < log_uring_full_count) {
+            log_uring_full_count -= submitted;
+            memmove(log_uring_full, log_uring_full + submitted,
+                    log_uring_full_count * sizeof(int));
+            return;   /* the fsync stays wanted */
+        }
+    }
+    log_uring_full_count = 0;
+    log_uring_fsync_wanted = 0;
+}
+
+/* The active buffer goes in the queue of full ones */
+static void log_uring_retire_active(void)
+{
+    if (log_uring_active >= 0 && log_uring_buffers[log_uring_active].used) {
+        log_uring_full[log_uring_full_count++] = log_uring_active;
+        log_uring_active = -1;
+    }
+}
+
+/* Write out everything that is buffered and wait for it, under the mutex */
+static void log_uring_drain(void)
+{
+    log_uring_retire_active();
+    for (;;) {
+        log_uring_reap();
+        log_uring_submit_chain();
+        if (!log_uring_in_flight && !log_uring_full_count)
+            break;
+        if (log_uring_in_flight)
+            log_uring_wait();
+    }
+}
+
+void log_uring_flush(void)
+{
+    if (!__atomic_load_n(&log_uring_size, __ATOMIC_ACQUIRE))
+        return;
+    pthread_mutex_lock(&log_uring_mutex);
+    if (log_uring_size)
+        log_uring_drain();
+    pthread_mutex_unlock(&log_uring_mutex);
+}
+
+void log_uring_submit(void)
+{
+    if (!__atomic_load_n(&log_uring_size, __ATOMIC_ACQUIRE))
+        return;
+    pthread_mutex_lock(&log_uring_mutex);
+    if (log_uring_size) {
+        log_uring_reap();
+        if (!log_uring_in_flight)
+            log_uring_retire_active();
+        log_uring_submit_chain();
+    }
+    pthread_mutex_unlock(&log_uring_mutex);
+}
+
+/****  set up ****/
+
+static void log_uring_teardown(void)
+{
+    log_uring_drain();
+    log_uring_close();
+    for (int i = 0; i < log_uring_count; i++) {
+        free(log_uring_buffers[i].data);
+        log_uring_buffers[i].data = NULL;
+    }
+    log_uring_count = 0;
+    log_uring_free_count = log_uring_full_count = log_uring_in_flight = 0;
+    log_uring_active = -1;
+    __atomic_store_n(&log_uring_size, 0, __ATOMIC_RELEASE);
+}
+
+int log_file_uring(size_t buffer_size, int buffers, int flush_interval_ms, int options)
+{
+    pthread_mutex_lock(&log_uring_mutex);
+    if (log_uring_size)
+        log_uring_teardown();
+    if (!buffer_size) {
+        pthread_mutex_unlock(&log_uring_mutex);
+        return 0;
+    }
+
+    if (buffer_size < LOG_URING_MIN_BUFFER)
+        buffer_size = LOG_URING_MIN_BUFFER;
+    if (buffers < 2)
+        buffers = 2;
+    if (buffers > LOG_URING_MAX_BUFFERS)
+        buffers = LOG_URING_MAX_BUFFERS;
+
+    /* room for every buffer and an fsync in one chain */
+    unsigned entries = 1;
+    while (entries < (unsigned)buffers + 1)
+        entries <<= 1;
+    if (log_uring_open(entries)) {
+        pthread_mutex_unlock(&log_uring_mutex);
+        return -1;
+    }
+
+    struct iovec iov[LOG_URING_MAX_BUFFERS];
+    for (int i = 0; i < buffers; i++) {
+        log_uring_buffers[i].data = malloc(buffer_size);
+        log_uring_buffers[i].used = log_uring_buffers[i].done = 0;
+        if (!log_uring_buffers[i].data) {
+            log_uring_count = i;
+            log_uring_teardown();
+            pthread_mutex_unlock(&log_uring_mutex);
+            return -1;
+        }
+        iov[i].iov_base = log_uring_buffers[i].data;
+        iov[i].iov_len = buffer_size;
+        log_uring_free[i] = buffers - 1 - i;
+    }
+    log_uring_count = log_uring_free_count = buffers;
+    /* registered buffers save the kernel mapping them for every write,
+     * without them (RLIMIT_MEMLOCK on older kernels) plain writes do */
+    log_uring.fixed = syscall(__NR_io_uring_register, log_uring.fd,
+                              IORING_REGISTER_BUFFERS, iov, buffers) == 0;
+
+    log_uring_interval_ms = flush_interval_ms;
+    log_uring_options = options;
+    log_uring_broken = 0;
+    log_uring_last_submit_ms = log_uring_now_ms();
+    __atomic_store_n(&log_uring_size, buffer_size, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&log_uring_mutex);
+    return 0;
+}
+
+void log_print_to_file_uring(char *prefix, char *contents)
+{
+    if (!__atomic_load_n(&log_uring_size, __ATOMIC_ACQUIRE) || log_bin_is_active()) {
+        log_print_to_file(prefix, contents);
+        return;
+    }
+
+    if (!prefix)
+        prefix = "(null)";
+    if (!contents)
+        contents = "(null)";
+    char plain[LOG_RECORD_SIZE];
+    char *spill = log_color_plain(&prefix, &contents, plain, sizeof(plain));
+    size_t prefix_len = strlen(prefix);
+    size_t contents_len = strlen(contents);
+    size_t len = prefix_len + 1 + contents_len + 1;
+    int level = log_current_level();
+
+    pthread_mutex_lock(&log_uring_mutex);
+    if (!log_uring_size) {   /* turned off meanwhile */
+        pthread_mutex_unlock(&log_uring_mutex);
+        log_print_to_file(prefix, contents);
+        free(spill);
+        return;
+    }
+    log_uring_reap();
+    log_uring_submit_chain();
+
+    if (len > log_uring_size) {
+        /* bigger than a buffer: after everything before it, directly */
+        log_uring_drain();
+        pthread_mutex_unlock(&log_uring_mutex);
+        log_print_to_file(prefix, contents);
+        free(spill);
+        return;
+    }
+
+    struct log_uring_buffer *buf = log_uring_active >= 0 ?
+        &log_uring_buffers[log_uring_active] : NULL;
+    if (!buf || log_uring_size - buf->used < len) {
+        log_uring_retire_active();
+        while (!log_uring_free_count) {
+            /* every buffer is full or in flight: wait for the disk */
+            log_uring_submit_chain();
+            if (!log_uring_free_count && log_uring_in_flight)
+                log_uring_wait();
+        }
+        log_uring_active = log_uring_free[--log_uring_free_count];
+        buf = &log_uring_buffers[log_uring_active];
+    }
+
+    char *p = buf->data + buf->used;
+    memcpy(p, prefix, prefix_len);      p += prefix_len;
+    *p++ = ' ';
+    memcpy(p, contents, contents_len);  p += contents_len;
+    *p = '\n';
+    buf->used += len;
+
+    if (level == LOG_ERR) {
+        /* out now, and onto the disk if asked for */
+        log_uring_retire_active();
+        if (log_uring_options & LOG_URING_FSYNC_ON_ERROR)
+            log_uring_fsync_wanted = 1;
+    }
+    else if (log_uring_interval_ms > 0 && !log_uring_in_flight &&
+             log_uring_now_ms() - log_uring_last_submit_ms >= log_uring_interval_ms)
+        log_uring_retire_active();
+    log_uring_submit_chain();
+    pthread_mutex_unlock(&log_uring_mutex);
+    free(spill);
+}
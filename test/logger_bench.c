@@ -0,0 +1,464 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Microbenchmarks for the logging hot path: what a message costs when
+ * it is filtered out, in each output sink, for different message sizes
+ * and thread counts.  Prints ns per call, messages per second and the
+ * p50/p99/p999 latency of single calls.
+ *
+ * Usage: logger_bench [calls per thread] [max threads]
+ */
+
+#include "logger.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* To turn off color, pass -DCOLOR=0 to gcc */
+#include "color.h"
+
+#define MAX_THREADS 64
+#define MAX_MESSAGE 4096
+
+/* A level beyond the bitmap, filtered the slow way */
+#define LOG_BENCH_FAR_LEVEL 5000
+
+static long calls_per_thread = 100000;
+static char payload[MAX_MESSAGE + 1];
+static char log_dir[] = "/tmp/logger_bench_XXXXXX/";
+
+/* Results go here, stdout may be pointed at /dev/null for the logger */
+static FILE *report;
+
+/* What one call of a benchmark does */
+typedef void (*bench_call)(long i);
+
+struct bench_thread {
+    pthread_t tid;
+    bench_call call;
+    int timed;             /* record the latency of each call? */
+    double *latency;       /* ns, one per call */
+    double start, end;
+};
+
+static pthread_barrier_t start_line;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/****  the calls ****/
+
+/* Stands in for a to_string() style helper: costly, and counted to show
+ * that filtered out messages never call it */
+static long costly_calls = 0;
+
+static __attribute__((noinline)) const char *costly_argument(long i)
+{
+    static __thread char text[64];
+
+    __atomic_add_fetch(&costly_calls, 1, __ATOMIC_RELAXED);
+    snprintf(text, sizeof(text), "%ld squared is %ld", i, i * i);
+    return text;
+}
+
+/* The loop and the call around every benchmark, for comparison */
+static void call_nothing(long i)
+{
+    (void)i;
+}
+
+static void call_filtered(long i)
+{
+    LOG_DEBUG_MSG("filtered out %ld %s", i, "never formatted");
+}
+
+static void call_costly_filtered(long i)
+{
+    LOG_DEBUG_MSG("costly %s", costly_argument(i));
+}
+
+/* What a filtered message would cost if the arguments came first */
+static void call_costly_eager(long i)
+{
+    const char *text = costly_argument(i);
+    LOG_DEBUG_MSG("costly %s", text);
+}
+
+static void call_far_level(long i)
+{
+    DEFINE_LOG_MSG("FAR", LOG_BENCH_FAR_LEVEL, "filtered out %ld", i);
+}
+
+static void call_message(long i)
+{
+    (void)i;
+    LOG_ERROR_MSG("%s", payload);
+}
+
+static void call_colored(long i)
+{
+    (void)i;
+    LOG_ERROR_MSG(ORANGE "%s" RESET, payload);
+}
+
+static void call_fields(long i)
+{
+    LOG_ERROR_KV_MSG(LOG_KV(LOG_KV_STR("user", "bench"), LOG_KV_INT("call", i),
+                            LOG_KV_DOUBLE("ratio", 0.5), LOG_KV_BOOL("ok", 1)),
+                     "%s", payload);
+}
+
+static void call_rate_limited(long i)
+{
+    DEFINE_LOG_RATE_MSG("ERROR", LOG_ERR, 10, "%s %ld", payload, i);
+}
+
+static void call_every_n(long i)
+{
+    DEFINE_LOG_EVERY_N_MSG("ERROR", LOG_ERR, 1000, "%s %ld", payload, i);
+}
+
+static void call_sampled(long i)
+{
+    DEFINE_LOG_SAMPLE_MSG("ERROR", LOG_ERR, 0.001, "%s %ld", payload, i);
+}
+
+/****  running them ****/
+
+static void *bench_worker(void *arg)
+{
+    struct bench_thread *t = arg;
+
+    pthread_barrier_wait(&start_line);
+    t->start = now_ns();
+    if (t->timed) {
+        for (long i = 0; i < calls_per_thread; i++) {
+            double before = now_ns();
+            t->call(i);
+            t->latency[i] = now_ns() - before;
+        }
+    }
+    else {
+        for (long i = 0; i < calls_per_thread; i++)
+            t->call(i);
+    }
+    t->end = now_ns();
+    return NULL;
+}
+
+/* Run 'call' in 'threads' threads and print a line of results.
+ * Untimed runs are for calls too cheap to be timed one by one. */
+static void bench(const char *label, bench_call call, int threads, int timed)
+{
+    struct bench_thread t[MAX_THREADS];
+    long total = threads * calls_per_thread;
+    double *latency = timed ? malloc(total * sizeof(double)) : NULL;
+
+    if (timed && !latency) {
+        fprintf(report, "%-34s out of memory\n", label);
+        return;
+    }
+    pthread_barrier_init(&start_line, NULL, threads + 1);
+    for (int i = 0; i < threads; i++) {
+        t[i].call = call;
+        t[i].timed = timed;
+        t[i].latency = timed ? latency + i * calls_per_thread : NULL;
+        pthread_create(&t[i].tid, NULL, bench_worker, &t[i]);
+    }
+    pthread_barrier_wait(&start_line);
+    for (int i = 0; i < threads; i++)
+        pthread_join(t[i].tid, NULL);
+    pthread_barrier_destroy(&start_line);
+
+    /* the workers keep the time, main may not run until they are done */
+    double start = t[0].start, end = t[0].end;
+    for (int i = 1; i < threads; i++) {
+        if (t[i].start < start)
+            start = t[i].start;
+        if (t[i].end > end)
+            end = t[i].end;
+    }
+    double elapsed = end - start;
+    log_flush();
+
+    fprintf(report, "%-34s %3d %10.1f %12.0f", label, threads,
+           elapsed * threads / total, total / (elapsed / 1e9));
+    if (timed) {
+        qsort(latency, total, sizeof(double), compare_double);
+        fprintf(report, " %9.0f %9.0f %9.0f\n", latency[total / 2],
+               latency[total * 99 / 100], latency[total * 999 / 1000]);
+        free(latency);
+    }
+    else {
+        fprintf(report, " %9s %9s %9s\n", "-", "-", "-");
+    }
+    fflush(report);
+}
+
+static void set_payload(size_t len)
+{
+    memset(payload, 'x', len);
+    payload[len] = '\0';
+}
+
+/****  output sinks ****/
+
+static int saved_stdout = -1;
+
+/* Point stdout somewhere else while the logger writes to it, or while
+ * close_log tells us about the file */
+static void quiet_stdout(int quiet)
+{
+    fflush(stdout);
+    if (quiet) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        saved_stdout = dup(1);
+        dup2(null_fd, 1);
+        close(null_fd);
+    }
+    else {
+        dup2(saved_stdout, 1);
+        close(saved_stdout);
+    }
+}
+
+/* Delete the log files of the last run, the benchmarks write a lot */
+static void clean_log_dir(void)
+{
+    DIR *dir = opendir(log_dir);
+    char path[sizeof(log_dir) + 256];
+
+    for (struct dirent *entry; dir && (entry = readdir(dir)); ) {
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s%s", log_dir, entry->d_name);
+        unlink(path);
+    }
+    if (dir)
+        closedir(dir);
+}
+
+enum sink { SINK_STDOUT, SINK_FILE, SINK_BUFFERED, SINK_MMAP, SINK_COMPRESSED, SINK_URING,
+            SINK_ASYNC, SINK_COUNT };
+
+static const char *sink_names[SINK_COUNT] = {
+    "stdout", "file", "buffered file", "mmap file", "compressed file", "io_uring file",
+    "async file"
+};
+
+static void sink_open(enum sink sink)
+{
+    if (sink == SINK_STDOUT) {
+        quiet_stdout(1);
+        log_set_output_function(log_default_stdout_func);
+        return;
+    }
+    log_file_init(log_dir, log_dir, NO_HOSTNAME, LOG_WRITE_PER_RUN);
+    log_set_output_function(log_print_to_file);
+    if (sink == SINK_BUFFERED) {
+        log_file_buffer(1 << 20, 0, 0);
+        log_set_output_function(log_print_to_file_buffered);
+    }
+    if (sink == SINK_MMAP) {
+        log_file_mmap(64 << 20);
+        log_set_output_function(log_print_to_file_mmap);
+    }
+    if (sink == SINK_COMPRESSED) {
+        log_file_compress(1 << 20, 0);
+        log_set_output_function(log_print_to_file_compressed);
+    }
+    if (sink == SINK_URING) {
+        log_file_uring(256 << 10, 8, 0, 0);
+        log_set_output_function(log_print_to_file_uring);
+    }
+    if (sink == SINK_ASYNC)
+        log_async_start(4096, LOG_ASYNC_BLOCK);
+}
+
+static void sink_close(enum sink sink)
+{
+    if (sink == SINK_STDOUT) {
+        quiet_stdout(0);
+        return;
+    }
+    if (sink == SINK_ASYNC)
+        log_async_stop();
+    quiet_stdout(1);
+    close_log();
+    quiet_stdout(0);
+    if (sink == SINK_BUFFERED)
+        log_file_buffer(0, 0, 0);
+    if (sink == SINK_MMAP)
+        log_file_mmap(0);
+    if (sink == SINK_COMPRESSED)
+        log_file_compress(0, 0);
+    if (sink == SINK_URING)
+        log_file_uring(0, 0, 0, 0);
+    clean_log_dir();
+}
+
+static void heading(const char *title)
+{
+    fprintf(report, TEAL "\n%s\n" RESET, title);
+    fprintf(report, "%-34s %3s %10s %12s %9s %9s %9s\n", "benchmark", "thr",
+           "ns/call", "calls/s", "p50 ns", "p99 ns", "p999 ns");
+}
+
+int main(int argc, char *argv[])
+{
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char label[64];
+
+    if (argc > 1)
+        calls_per_thread = atol(argv[1]);
+    if (argc > 2)
+        max_threads = atoi(argv[2]);
+    if (max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+    if (max_threads < 1)
+        max_threads = 1;
+    if (calls_per_thread < 1000)
+        calls_per_thread = 1000;
+
+    report = fdopen(dup(1), "w");
+    log_dir[strlen(log_dir) - 1] = '\0';
+    if (!mkdtemp(log_dir)) {
+        perror(log_dir);
+        return 1;
+    }
+    log_dir[strlen(log_dir)] = '/';
+
+    fprintf(report, TEAL "Logger benchmarks: " PURPLE "%ld calls per thread, up to %d threads\n" RESET,
+           calls_per_thread, max_threads);
+
+    /* Filtered out messages: the cost every disabled log site pays */
+    heading("Filtered out messages");
+    log_set_output_function(log_print_to_file);
+    log_set_level(SHOW_EXACT_LOG_LEVEL, LOG_ERR);
+    bench("SHOW_EXACT_LOG_LEVEL", call_filtered, 1, 0);
+    log_set_level(SHOW_LOG_LEVEL_INCLUDING, LOG_WARN);
+    bench("SHOW_LOG_LEVEL_INCLUDING", call_filtered, 1, 0);
+    int selection[] = { LOG_ERR, LOG_WARN, LOG_BENCH_FAR_LEVEL - 1 };
+    log_set_level_selection(selection, 3);
+    log_set_level(SHOW_SELECT_LOG_LEVELS, LOG_WARN);
+    bench("SHOW_SELECT_LOG_LEVELS", call_filtered, 1, 0);
+    bench("level beyond the bitmap", call_far_level, 1, 0);
+    log_set_level(SHOW_NOTHING, 0);
+    bench("SHOW_NOTHING", call_filtered, 1, 0);
+    bench("SHOW_NOTHING", call_filtered, max_threads, 0);
+    bench("empty call, for comparison", call_nothing, 1, 0);
+    bench("SHOW_NOTHING, costly arguments", call_costly_filtered, 1, 0);
+    fprintf(report, "%-34s %ld\n", "  costly arguments evaluated", costly_calls);
+    bench("  the same, evaluated up front", call_costly_eager, 1, 0);
+    log_flight_start(256 * 1024, 16, 0);
+    bench("SHOW_NOTHING, flight recorder", call_filtered, 1, 0);
+    bench("SHOW_NOTHING, flight recorder", call_filtered, max_threads, 0);
+    log_flight_stop();
+    log_stats_start(LOG_STATS_FILTERED);
+    bench("SHOW_NOTHING, stats of filtered", call_filtered, 1, 0);
+    bench("SHOW_NOTHING, stats of filtered", call_filtered, max_threads, 0);
+    log_stats_stop();
+
+    /* Shown messages, one thread, each sink */
+    log_set_level(SHOW_LOG_LEVEL_INCLUDING, LOG_ERR);
+    set_payload(64);
+    heading("Output sinks, 64 byte messages");
+    for (int sink = 0; sink < SINK_COUNT; sink++) {
+        sink_open(sink);
+        bench(sink_names[sink], call_message, 1, 1);
+        sink_close(sink);
+    }
+    sink_open(SINK_FILE);
+    log_set_timestamp(LOG_TIMESTAMP_WALL);
+    bench("file, wall clock timestamp", call_message, 1, 1);
+    log_set_timestamp(LOG_TIMESTAMP_WALL | LOG_TIMESTAMP_MONOTONIC);
+    bench("file, wall + monotonic timestamp", call_message, 1, 1);
+    log_set_timestamp(LOG_TIMESTAMP_NONE);
+    log_set_format(LOG_FORMAT_JSON);
+    bench("file, JSON", call_message, 1, 1);
+    bench("file, JSON with fields", call_fields, 1, 1);
+    log_set_format(LOG_FORMAT_TEXT);
+    bench("file, key=value fields", call_fields, 1, 1);
+    log_memory_start(1 << 20);
+    int memory_sink = log_sink_add(log_print_to_memory, SHOW_LOG_LEVEL_INCLUDING, LOG_ERR);
+    bench("file + memory sink", call_message, 1, 1);
+    bench("file, colour codes stripped", call_colored, 1, 1);
+    log_set_color(LOG_COLOR_NEVER);
+    bench("file, colour codes kept", call_colored, 1, 1);
+    log_set_color(LOG_COLOR_AUTO);
+    log_sink_remove(memory_sink);
+    log_memory_start(0);
+    log_stats_start(0);
+    bench("file, with stats", call_message, 1, 1);
+    log_stats_stop();
+    log_file_index(64 << 10);
+    bench("file, with index", call_message, 1, 1);
+    log_file_index(0);
+    sink_close(SINK_FILE);
+
+    /* Limited messages, nearly all of them suppressed */
+    heading("Rate limited and sampled, file sink");
+    sink_open(SINK_FILE);
+    bench("at most 10 a second", call_rate_limited, 1, 0);
+    bench("at most 10 a second", call_rate_limited, max_threads, 0);
+    bench("every 1000th", call_every_n, 1, 0);
+    bench("every 1000th", call_every_n, max_threads, 0);
+    bench("sampled 0.1%", call_sampled, 1, 0);
+    bench("sampled 0.1%", call_sampled, max_threads, 0);
+    sink_close(SINK_FILE);
+
+    /* Message sizes, the last one no longer fits the record buffer */
+    size_t sizes[] = { 16, 128, 512, LOG_RECORD_SIZE - 128, MAX_MESSAGE };
+    heading("Message sizes, file sink");
+    for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+        set_payload(sizes[i]);
+        snprintf(label, sizeof(label), "file, %zu bytes", sizes[i]);
+        sink_open(SINK_FILE);
+        bench(label, call_message, 1, 1);
+        sink_close(SINK_FILE);
+    }
+
+    /* Threads */
+    set_payload(64);
+    heading("Threads, 64 byte messages");
+    for (int sink = SINK_FILE; sink < SINK_COUNT; sink++) {
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            sink_open(sink);
+            bench(sink_names[sink], call_message, threads, 1);
+            sink_close(sink);
+        }
+    }
+
+    rmdir(log_dir);
+    return 0;
+}
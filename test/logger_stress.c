@@ -0,0 +1,181 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Stress test: many threads log into one file at the same time while
+ * the level changes under them.  Prints the throughput per thread count
+ * and checks afterwards that no line in the file got torn.
+ *
+ * Usage: logger_stress [messages per thread] [max threads]
+ */
+
+#include "logger.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* To turn off color, pass -DCOLOR=0 to gcc */
+#include "color.h"
+
+#define MAX_THREADS 64
+
+static int messages_per_thread = 20000;
+static volatile int flipping = 0;
+static void (*volatile sink)(char *prefix, char *contents) = log_print_to_file;
+
+static void *worker(void *arg)
+{
+    long id = (long)arg;
+
+    for (int i = 0; i < messages_per_thread; i++) {
+        LOG_ERROR_MSG("thread %ld message %d padding %s", id, i,
+                      "abcdefghijklmnopqrstuvwxyz0123456789");
+        /* filtered out, but the thread keeps reading the level */
+        LOG_DEBUG_MSG("thread %ld never shows %d", id, i);
+    }
+    return NULL;
+}
+
+/* Changes the configuration while the workers are busy */
+static void *flipper(void *unused)
+{
+    (void)unused;
+    while (flipping) {
+        log_set_level(SHOW_LOG_LEVEL_INCLUDING, LOG_WARN);
+        log_set_level(SHOW_EXACT_LOG_LEVEL, LOG_ERR);
+        log_set_output_function(sink);
+    }
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(int threads)
+{
+    pthread_t tid[MAX_THREADS], flip;
+
+    flipping = 1;
+    pthread_create(&flip, NULL, flipper, NULL);
+
+    double start = now();
+    for (long i = 0; i < threads; i++)
+        pthread_create(&tid[i], NULL, worker, (void *)i);
+    for (int i = 0; i < threads; i++)
+        pthread_join(tid[i], NULL);
+    double elapsed = now() - start;
+
+    flipping = 0;
+    pthread_join(flip, NULL);
+    return elapsed;
+}
+
+/* Every message is two lines, the second one has to be complete */
+static int check_file(const char *name, long expected)
+{
+    FILE *in = fopen(name, "r");
+    char line[512];
+    long found = 0, torn = 0;
+
+    if (!in) {
+        perror(name);
+        return 1;
+    }
+    while (fgets(line, sizeof(line), in)) {
+        long id;
+        int i;
+        char padding[64];
+        if (strncmp(line, "ERROR", 5) == 0)
+            continue;
+        if (3 == sscanf(line, " thread %ld message %d padding %63s", &id, &i, padding) &&
+            0 == strcmp(padding, "abcdefghijklmnopqrstuvwxyz0123456789"))
+            found++;
+        else
+            torn++;
+    }
+    fclose(in);
+
+    printf("%s: %ld messages, %ld torn lines\n", name, found, torn);
+    return found != expected || torn != 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int max_threads = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    char log_dir[] = "/tmp/logger_stress_XXXXXX/";
+    long total = 0;
+    int failed = 0;
+
+    if (argc > 1)
+        messages_per_thread = atoi(argv[1]);
+    if (argc > 2)
+        max_threads = atoi(argv[2]);
+    if (max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+    if (max_threads < 1)
+        max_threads = 1;
+
+    log_dir[strlen(log_dir) - 1] = '\0';
+    mkdtemp(log_dir);
+    log_dir[strlen(log_dir)] = '/';
+
+    log_set_level(SHOW_EXACT_LOG_LEVEL, LOG_ERR);
+    log_set_output_function(log_print_to_file);
+    log_file_init(log_dir, "./stress_", NO_HOSTNAME, LOG_WRITE_PER_RUN);
+
+    printf(TEAL "Logger stress test: " PURPLE "%d messages per thread\n" RESET,
+           messages_per_thread);
+    printf("%8s %12s %14s %10s\n", "threads", "seconds", "messages/s", "speedup");
+
+    double single = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        double elapsed = run(threads);
+        double rate = threads * (double)messages_per_thread / elapsed;
+        if (threads == 1)
+            single = rate;
+        printf("%8d %12.3f %14.0f %9.2fx\n", threads, elapsed, rate, rate / single);
+        total += (long)threads * messages_per_thread;
+    }
+
+    log_async_start(4096, LOG_ASYNC_BLOCK);
+    double elapsed = run(max_threads);
+    log_async_stop();
+    printf("%8d %12.3f %14.0f %10s\n", max_threads, elapsed,
+           max_threads * (double)messages_per_thread / elapsed, "async");
+    total += (long)max_threads * messages_per_thread;
+
+    /* small segments, so the threads run over their ends many times */
+    log_file_mmap(256 << 10);
+    sink = log_print_to_file_mmap;
+    log_set_output_function(sink);
+    elapsed = run(max_threads);
+    printf("%8d %12.3f %14.0f %10s\n", max_threads, elapsed,
+           max_threads * (double)messages_per_thread / elapsed, "mmap");
+    total += (long)max_threads * messages_per_thread;
+
+    close_log();
+    failed = check_file("./stress_current.log", total);
+    printf(failed ? RED "FAILED\n" RESET : GREEN "OK\n" RESET);
+    return failed;
+}
@@ -17,24 +17,29 @@
 // limitations under the License.
 
 #include "logger.h"
+#include <dirent.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 /* To turn off color, pass -DCOLOR=0 to gcc */
 #include "color.h"
 
 /* Demonstrate how to define a custom log message */
-int LOG_FIRST_CUSTOM_LOG_LEVEL = LOG_BASE_COUNT + __COUNTER__;
+const int LOG_FIRST_CUSTOM_LOG_LEVEL = LOG_BASE_COUNT + __COUNTER__;
 #define LOG_FIRST_CUSTOM_MSG(msg,...) DEFINE_LOG_MSG("FIRST_CUSTOM_LOG_LEVEL",LOG_FIRST_CUSTOM_LOG_LEVEL,  msg, __VA_ARGS__);
 
-int LOG_SECOND_CUSTOM_LOG_LEVEL = LOG_BASE_COUNT + __COUNTER__;
+const int LOG_SECOND_CUSTOM_LOG_LEVEL = LOG_BASE_COUNT + __COUNTER__;
 #define LOG_SECOND_CUSTOM_MSG(msg,...) DEFINE_LOG_MSG("SECOND_CUSTOM_LOG_LEVEL",LOG_SECOND_CUSTOM_LOG_LEVEL, msg, __VA_ARGS__);
 
 /* Some custom debug levels for the tests */
-int LOG_debug_loop = LOG_BASE_COUNT + __COUNTER__;
+const int LOG_debug_loop = LOG_BASE_COUNT + __COUNTER__;
 #define LOG_debug_loop_msg(msg,...) DEFINE_LOG_MSG("LOG_debug_loop",LOG_debug_loop, msg, __VA_ARGS__);
 
-int LOG_debug_while = LOG_BASE_COUNT + __COUNTER__;
+const int LOG_debug_while = LOG_BASE_COUNT + __COUNTER__;
 #define LOG_debug_while_msg(msg,...) DEFINE_LOG_MSG("LOG_debug_while",LOG_debug_while, msg, __VA_ARGS__);
 
 /* Set a custom output function with colours that I happen to like */
@@ -43,6 +48,13 @@ void custom_output_function(char *prefix, char* contents)
     printf(MOSS "%s " GREY "%s\n" RESET, prefix, contents);
 }
 
+/* Print a frame of a compressed log file as it is */
+void print_compressed_frame(const struct log_compressed_frame *info, const char *text)
+{
+    printf(GREY "frame at %lld, %u bytes packed into %u\n" RESET "%s",
+           info->offset, info->raw_len, info->packed_len, text);
+}
+
 void logger_test(char *show_what)
 {
     printf(TEAL "Logger Demo: " PURPLE "%s\n" RESET ,show_what);
@@ -102,6 +114,22 @@ int main(int argc, char *argv[])
     log_set_level(SHOW_EXACT_LOG_LEVEL, LOG_SECOND_CUSTOM_LOG_LEVEL);
     logger_test("Show just your second custom log message");
 
+    /*******************************************************/
+    // Sinks: errors to stderr too, the newest messages in memory
+    /*******************************************************/
+    int stderr_sink = log_sink_add(log_print_to_stderr, SHOW_EXACT_LOG_LEVEL, LOG_ERR);
+    log_memory_start(4096);
+    int memory_sink = log_sink_add(log_print_to_memory, SHOW_LOG_LEVEL_INCLUDING, LOG_MAX_LEVEL);
+    log_set_level(SHOW_EXACT_LOG_LEVEL, LOG_NOTICE);
+    logger_test("Sinks: LOG_NOTICE shown, LOG_ERR to stderr, everything into memory");
+    log_sink_remove(stderr_sink);
+    log_sink_remove(memory_sink);
+
+    char memory[1024];
+    log_memory_read(memory, sizeof(memory));
+    printf(TEAL "Logger Demo: " PURPLE "The newest messages kept in memory\n" RESET "%s", memory);
+    log_memory_start(0);
+
     /*******************************************************/
     // Unix log file output tests
     /*******************************************************/
@@ -123,14 +151,187 @@ int main(int argc, char *argv[])
     logger_test("Write to log file:  selected log levels up to LOG_SECOND_CUSTOM_LOG_LEVEL");
 
     /*******************************************************/
+    log_file_index(LOG_INDEX_MIN_BLOCK);
     log_file_init("/tmp/", 
                   "./",  
                   WITH_HOSTNAME,
                   LOG_WRITE_PER_RUN);
     log_set_level(SHOW_EXACT_LOG_LEVEL, LOG_ERR);
-    logger_test("Write to log file:  exact log level -> LOG_ERR");
+    logger_test("Write to log file:  exact log level -> LOG_ERR, indexed");
+    log_file_index(0);
+    printf("Find them again with: ./bin/logger_query -l ERROR current.log\n");
+
+    /*******************************************************/
+    // Buffered log file output
+    /*******************************************************/
+    log_file_buffer(64 * 1024, 1000, LOG_ERR);
+    log_set_output_function(log_print_to_file_buffered);
+    log_set_level(SHOW_LOG_LEVEL_INCLUDING, LOG_INFO);
+    logger_test("Write to log file:  buffered, written at LOG_ERR and by log_flush()");
+    log_flush();
+
+    /*******************************************************/
+    // io_uring log file output, write() where there is none
+    /*******************************************************/
+    if (log_file_uring(64 * 1024, 4, 0, LOG_URING_FSYNC_ON_ERROR))
+        printf("No io_uring here, the log file is written with write()\n");
+    log_set_output_function(log_print_to_file_uring);
+    logger_test("Write to log file:  through io_uring, fsynced after LOG_ERR");
+    log_file_uring(0, 0, 0, 0);
+    log_set_output_function(log_print_to_file_buffered);
+
+    /*******************************************************/
+    // Async output test
+    /*******************************************************/
+    log_async_start(256, LOG_ASYNC_DROP_OLDEST);
+    log_set_level(SHOW_LOG_LEVEL_INCLUDING, LOG_MAX_LEVEL);
+    logger_test("Write to log file:  all levels via the async consumer thread");
+    log_async_stop();
+    printf("Async messages dropped: %lu\n", log_async_dropped());
+
+    close_log();
+
+    /*******************************************************/
+    // Binary log file test, bin/logger_decode reads these too
+    /*******************************************************/
+    char binary_dir[] = "/tmp/logger_binary_XXXXXX/";
+    binary_dir[strlen(binary_dir) - 1] = '\0';
+    mkdtemp(binary_dir);
+    binary_dir[strlen(binary_dir)] = '/';
+
+    log_file_init(binary_dir, 
+                  "./binary_",  
+                  NO_HOSTNAME,
+                  LOG_WRITE_PER_RUN | LOG_BINARY);
+    log_set_level(SHOW_LOG_LEVEL_INCLUDING, LOG_MAX_LEVEL);
+    for (int round = 1; round <= 3; round++)
+        LOG_DEBUG_BIN_MSG("Binary message %d of %d: %s %.2f", round, 3, "pi is about", 3.14159);
+    LOG_WARNING_MSG("Text messages go into a binary log as %s", "text frames");
+    close_log();
+
+    printf(TEAL "Logger Demo: " PURPLE "Decode the binary log file\n" RESET);
+    int binary_fd = open("./binary_current.log", O_RDONLY);
+    log_bin_decode(binary_fd, custom_output_function);
+    close(binary_fd);
+
+    /*******************************************************/
+    // Compressed log file test, bin/logger_decompress reads these too
+    /*******************************************************/
+    char compressed_dir[] = "/tmp/logger_compressed_XXXXXX/";
+    compressed_dir[strlen(compressed_dir) - 1] = '\0';
+    mkdtemp(compressed_dir);
+    compressed_dir[strlen(compressed_dir)] = '/';
 
+    log_file_init(compressed_dir, "./compressed_", NO_HOSTNAME, LOG_WRITE_PER_RUN);
+    log_file_compress(64 * 1024, 0);
+    log_set_output_function(log_print_to_file_compressed);
+    log_set_level(SHOW_LOG_LEVEL_INCLUDING, LOG_INFO);
+    for (int n = 1; n <= 3; n++)
+        LOG_INFO_MSG("Compressed message %d of %d", n, 3);
+    close_log();
+    log_file_compress(0, 0);
+
+    printf(TEAL "Logger Demo: " PURPLE "Decompress the compressed log file\n" RESET);
+    int compressed_fd = open("./compressed_current.log", O_RDONLY);
+    log_compressed_read(compressed_fd, 0, print_compressed_frame);
+    close(compressed_fd);
+
+    /*******************************************************/
+    // Log rotation test: roll over every 4k, keep 3 files
+    /*******************************************************/
+    char rotate_dir[] = "/tmp/logger_rotate_XXXXXX/";
+    rotate_dir[strlen(rotate_dir) - 1] = '\0';
+    mkdtemp(rotate_dir);
+    rotate_dir[strlen(rotate_dir)] = '/';
+
+    log_file_init(rotate_dir, "./rotate_", NO_HOSTNAME, LOG_WRITE_PER_RUN);
+    log_file_rotation(4096, 0, 3);
+    log_set_output_function(log_print_to_file);
+    log_set_level(SHOW_LOG_LEVEL_INCLUDING, LOG_INFO);
+    for (int n = 1; n <= 200; n++) {
+        LOG_INFO_MSG("Rotating message %d of %d", n, 200);
+        if (n % 20 == 0)
+            nanosleep(&(struct timespec){ 0, 5000000 }, NULL);  // let the rotation catch up
+    }
     close_log();
+    log_file_rotation(0, 0, 0);
+
+    int rotated_files = 0;
+    DIR *rotated = opendir(rotate_dir);
+    for (struct dirent *entry; rotated && (entry = readdir(rotated)); )
+        rotated_files += entry->d_name[0] != '.';
+    if (rotated)
+        closedir(rotated);
+    printf("Rotated log files kept in %s: %d\n", rotate_dir, rotated_files);
+
+    /*******************************************************/
+    // Timestamps in front of every message
+    /*******************************************************/
+    printf(TEAL "Logger Demo: " PURPLE "Timestamps\n" RESET);
+    log_set_output_function(log_default_stdout_func);
+    log_set_level(SHOW_LOG_LEVEL_INCLUDING, LOG_INFO);
+    log_set_timestamp(LOG_TIMESTAMP_WALL | LOG_TIMESTAMP_MONOTONIC);
+    LOG_INFO_MSG("This message has a wall clock and a %s timestamp", "monotonic");
+    log_set_timestamp(LOG_TIMESTAMP_NONE);
+
+    /*******************************************************/
+    // Key/value fields, as text and as JSON
+    /*******************************************************/
+    printf(TEAL "Logger Demo: " PURPLE "Key/value fields, text and JSON\n" RESET);
+    LOG_INFO_KV_MSG(LOG_KV(LOG_KV_STR("user", "gabriela"), LOG_KV_INT("attempt", 3)),
+                    "Login %s", "failed");
+    log_set_format(LOG_FORMAT_JSON);
+    LOG_INFO_KV_MSG(LOG_KV(LOG_KV_STR("user", "gabriela"), LOG_KV_INT("attempt", 3),
+                           LOG_KV_DOUBLE("load", 0.75), LOG_KV_BOOL("locked", 1)),
+                    "Login %s", "failed");
+    LOG_WARNING_MSG("Plain messages are JSON too, \"quotes\" and all%s", "");
+    log_set_format(LOG_FORMAT_TEXT);
+
+    /*******************************************************/
+    // Rate limiting and sampling per call site
+    /*******************************************************/
+    printf(TEAL "Logger Demo: " PURPLE "Every 40th of 100 messages, then sampled\n" RESET);
+    for (int n = 0; n < 100; n++)
+        DEFINE_LOG_EVERY_N_MSG("INFO", LOG_INFO, 40, "Occurrence %d", n);
+    for (int n = 0; n < 1000; n++)
+        DEFINE_LOG_SAMPLE_MSG("INFO", LOG_INFO, 0.002, "Sampled %d", n);
+
+    printf(TEAL "Logger Demo: " PURPLE "At most 3 a second of 100 messages\n" RESET);
+    for (int n = 0; n < 100; n++)
+        DEFINE_LOG_RATE_MSG("WARNING", LOG_WARN, 3, "Burst %d", n);
+    printf(TEAL "Logger Demo: " PURPLE "The suppressed messages left, reported by log_flush()\n" RESET);
+    log_flush();
+
+    /*******************************************************/
+    // Switch single call sites on and off at run time
+    /*******************************************************/
+    log_set_output_function(log_default_stdout_func);
+    log_set_level(SHOW_EXACT_LOG_LEVEL, LOG_ERR);
+    int switched = log_site_control("file logger_tests.c func logger_test level 4 +");
+    printf("Call sites switched on: %d\n", switched);
+    logger_test("Errors, and the one LOG_DEBUG_MSG site switched on");
+    log_site_set(NULL, "logger_test", 0, LOG_SITE_DEFAULT);
+
+    /*******************************************************/
+    // Flight recorder: filtered messages kept until an error
+    /*******************************************************/
+    printf(TEAL "Logger Demo: " PURPLE "Flight recorder, only errors shown\n" RESET);
+    log_flight_start(64 * 1024, 3, LOG_FLIGHT_DUMP_ON_ERROR);
+    for (int n = 1; n <= 10; n++)
+        LOG_DEBUG_MSG("Step %d of %d, load %.2f", n, 10, n / 4.0);
+    LOG_ERROR_MSG("Step %d failed, the last debug messages came first", 10);
+    log_flight_stop();
+
+    /*******************************************************/
+    // Self-metrics: how many messages, how long they took
+    /*******************************************************/
+    printf(TEAL "Logger Demo: " PURPLE "Stats of the messages so far, filtered ones counted\n" RESET);
+    log_stats_start(LOG_STATS_FILTERED);
+    for (int n = 1; n <= 10; n++)
+        LOG_DEBUG_MSG("Step %d of %d", n, 10);
+    LOG_ERROR_MSG("Step %d failed", 10);
+    log_stats_dump(log_default_stdout_func);
+    log_stats_stop();
 
     /*******************************************************/
     // TODO and custum debug levels
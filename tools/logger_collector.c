@@ -0,0 +1,107 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* logger_collector -- write the messages of many processes to one log file
+ *
+ * Usage: logger_collector [-n name] [-r rings] [-q slots] [-m record size]
+ *                         [-l lag ms] [-R rotate bytes] log_dir symlink_dir
+ *
+ *   -n name          shared memory segment, /logger by default
+ *   -r rings         how many processes can join, 64 by default
+ *   -q slots         messages each ring holds, 4096 by default
+ *   -m record size   bytes per message, LOG_RECORD_SIZE by default
+ *   -l lag ms        how long messages wait for older ones, 50 by default
+ *   -R rotate bytes  start a new log file after this many bytes
+ *
+ * The processes call log_shm_start(name, ...) and log with
+ * log_print_to_shm.  The log file is created like log_file_init does and
+ * written through a 1MB buffer, in large sequential writes.  Stop the
+ * collector with SIGINT or SIGTERM; it writes out what is left first.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "logger.h"
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int sig)
+{
+    (void)sig;
+    stopping = 1;
+}
+
+static int usage(void)
+{
+    fprintf(stderr, "Usage: logger_collector [-n name] [-r rings] [-q slots] [-m record size]\n"
+                    "                        [-l lag ms] [-R rotate bytes] log_dir symlink_dir\n");
+    return 2;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *name = "/logger";
+    int rings = 64, slots = 4096, record_size = LOG_RECORD_SIZE, lag_ms = 50;
+    long long rotate_bytes = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:q:m:l:R:")) != -1) {
+        switch (opt) {
+            case 'n': name = optarg; break;
+            case 'r': rings = atoi(optarg); break;
+            case 'q': slots = atoi(optarg); break;
+            case 'm': record_size = atoi(optarg); break;
+            case 'l': lag_ms = atoi(optarg); break;
+            case 'R': rotate_bytes = atoll(optarg); break;
+            default: return usage();
+        }
+    }
+    if (argc - optind != 2)
+        return usage();
+
+    struct sigaction action = { .sa_handler = stop };
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    log_set_color(LOG_COLOR_NEVER);   /* the processes have made their choice */
+    log_set_level(SHOW_LOG_LEVEL_INCLUDING, LOG_MAX_LEVEL);
+    log_file_init(argv[optind], argv[optind + 1], NO_HOSTNAME, LOG_WRITE_PER_RUN);
+    if (rotate_bytes > 0)
+        log_file_rotation(rotate_bytes, 0, 0);
+    log_file_buffer(1 << 20, 1000, 0);
+    log_set_output_function(log_print_to_file_buffered);
+
+    if (log_collector_create(name, rings, slots, record_size) == -1)
+        return 1;
+
+    while (!stopping) {
+        if (log_collector_poll(lag_ms) == 0)
+            nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+    }
+
+    unsigned long dropped = log_collector_dropped();
+    log_collector_destroy();
+    if (dropped)
+        fprintf(stderr, "logger_collector: the processes dropped %lu messages\n", dropped);
+    close_log();
+    return 0;
+}
@@ -0,0 +1,59 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* logger_decode -- print LOG_BINARY log files as text
+ *
+ * Usage: logger_decode [logfile ...]
+ *
+ * Reads standard input when no file is given.  The output looks exactly
+ * like a log written by log_print_to_file.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "logger.h"
+
+static int decode(int fd, const char *name)
+{
+    if (-1 == log_bin_decode(fd, log_default_stdout_func)) {
+        fprintf(stderr, "logger_decode: %s is not a binary log\n", name);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int failed = 0;
+
+    if (argc < 2)
+        return decode(STDIN_FILENO, "standard input");
+
+    for (int i = 1; i < argc; i++) {
+        int fd = open(argv[i], O_RDONLY);
+        if (fd == -1) {
+            perror(argv[i]);
+            failed = 1;
+            continue;
+        }
+        failed |= decode(fd, argv[i]);
+        close(fd);
+    }
+    return failed;
+}
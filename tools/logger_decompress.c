@@ -0,0 +1,102 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* logger_decompress -- print compressed log files as text
+ *
+ * Usage: logger_decompress [-l] [-o offset] logfile ...
+ *
+ *   -l         list the frames instead: offset, time of the first
+ *              message, raw and packed size
+ *   -o offset  start at the first frame at or after this byte offset
+ *
+ * Standard input is read when no file is given, it has to be a file
+ * rather than a pipe.  The text looks exactly like a log written by
+ * log_print_to_file.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "logger.h"
+
+static void print_text(const struct log_compressed_frame *info, const char *text)
+{
+    fwrite(text, 1, info->raw_len, stdout);
+}
+
+static void print_frame(const struct log_compressed_frame *info, const char *text)
+{
+    time_t secs = info->start_ns / 1000000000;
+    struct tm tm;
+    char when[32];
+
+    (void)text;
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime_r(&secs, &tm));
+    printf("%12lld  %s.%06lld  %9u %9u  %5.1f%%\n", info->offset, when,
+           info->start_ns % 1000000000 / 1000, info->raw_len, info->packed_len,
+           info->raw_len ? 100.0 * info->packed_len / info->raw_len : 100.0);
+}
+
+static int list = 0;
+static long long from = 0;
+
+static int decompress(int fd, const char *name)
+{
+    if (list)
+        printf("%12s  %-26s  %9s %9s  %6s\n", "offset", "first message", "raw", "packed", "size");
+    if (-1 == log_compressed_read(fd, from, list ? print_frame : print_text)) {
+        fprintf(stderr, "logger_decompress: %s is not a compressed log\n", name);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "lo:")) != -1) {
+        if (opt == 'l')
+            list = 1;
+        else if (opt == 'o')
+            from = strtoll(optarg, NULL, 0);
+        else {
+            fprintf(stderr, "Usage: logger_decompress [-l] [-o offset] [logfile ...]\n");
+            return 2;
+        }
+    }
+
+    if (optind == argc)
+        return decompress(STDIN_FILENO, "standard input");
+
+    for (int i = optind; i < argc; i++) {
+        int fd = open(argv[i], O_RDONLY);
+        if (fd == -1) {
+            perror(argv[i]);
+            failed = 1;
+            continue;
+        }
+        failed |= decompress(fd, argv[i]);
+        close(fd);
+    }
+    return failed;
+}
@@ -0,0 +1,471 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* logger_query -- print the messages of a log file that match, reading
+ *                 only the blocks its index (log_file_index) points at
+ *
+ * Usage: logger_query [-f from] [-t to] [-l levels] [-s source] [-i index] [-v] logfile
+ *
+ *   -f from     messages written at or after this time
+ *   -t to       messages written before this time
+ *               "2026-10-18 10:02[:00]", "10:02[:00]" (on the day the
+ *               log starts) or "@1792310520" (seconds since 1970)
+ *   -l levels   ERROR,WARN,NOTICE,DEBUG,INFO or level numbers
+ *   -s source   messages from this source file, with or without its path
+ *   -i index    the index, logfile.idx by default
+ *   -v          tell how much of the file was read, on stderr
+ *
+ * The index narrows the search down to blocks, the messages in them are
+ * checked one by one.  Times are checked per message if the log has
+ * LOG_TIMESTAMP_WALL timestamps, otherwise by block.  Parts of the file
+ * the index doesn't cover, such as its tail, are always searched.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "logger.h"
+
+#define LEVELS_MAX 32
+
+/* The file is read this much at a time, cut back to the start of a message */
+#define WINDOW_SIZE (4 << 20)
+
+static const char *level_names[] = {
+    [LOG_ERR] = "ERROR", [LOG_WARN] = "WARN", [LOG_NOTICE] = "NOTICE",
+    [LOG_DEBUG] = "DEBUG", [LOG_INFO] = "INFO",
+};
+#define LEVEL_NAME_COUNT ((int)(sizeof(level_names) / sizeof(level_names[0])))
+
+/* What to look for */
+static long long from_ns = 0, to_ns = 0;          /* 0: open */
+static unsigned long long level_mask = ~0ULL;     /* for the blocks */
+static const char *names[LEVELS_MAX];             /* for the messages */
+static int name_count = 0;
+static int check_names = 0;
+static const char *source = NULL;
+static unsigned long long source_bits = 0;
+static int verbose = 0;
+
+/* The entries of the index */
+static struct log_index_entry *entries = NULL;
+static long entry_count = 0, entry_room = 0;
+
+static int add_entry(const struct log_index_entry *entry)
+{
+    if (entry_count == entry_room) {
+        long room = entry_room ? 2 * entry_room : 1024;
+        struct log_index_entry *more = realloc(entries, room * sizeof(*entries));
+        if (!more)
+            return 1;
+        entries = more;
+        entry_room = room;
+    }
+    entries[entry_count++] = *entry;
+    return 0;
+}
+
+static const char *base_name(const char *path, size_t *len)
+{
+    const char *end = path + *len;
+    const char *p = end;
+
+    while (p > path && p[-1] != '/')
+        p--;
+    *len = end - p;
+    return p;
+}
+
+/****  times ****/
+
+/* "YYYY-MM-DD HH:MM[:SS]", "HH:MM[:SS]" on the day of day_ns, "@secs" */
+static long long parse_time(const char *text, long long day_ns)
+{
+    struct tm tm;
+    const char *end;
+
+    if (text[0] == '@')
+        return atoll(text + 1) * 1000000000LL;
+
+    memset(&tm, 0, sizeof(tm));
+    if ((end = strptime(text, "%Y-%m-%d %H:%M", &tm)) == NULL) {
+        time_t day = day_ns / 1000000000;
+        localtime_r(&day, &tm);
+        tm.tm_sec = 0;
+        if ((end = strptime(text, "%H:%M", &tm)) == NULL)
+            return -1;
+    }
+    if (*end == ':' && (end = strptime(end, ":%S", &tm)) == NULL)
+        return -1;
+    if (*end)
+        return -1;
+    tm.tm_isdst = -1;
+    return mktime(&tm) * 1000000000LL;
+}
+
+/* The LOG_TIMESTAMP_WALL timestamp at the start of a prefix, 0 if none */
+static long long message_time(const char *line, size_t len)
+{
+    struct tm tm;
+    char text[32];
+
+    /* 2026-10-18 02:47:12.123456 */
+    if (len < 26 || line[4] != '-' || line[10] != ' ' || line[19] != '.')
+        return 0;
+    memcpy(text, line, 26);
+    text[26] = '\0';
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(text, "%Y-%m-%d %H:%M:%S", &tm);
+    if (!end || *end != '.')
+        return 0;
+    tm.tm_isdst = -1;
+    return mktime(&tm) * 1000000000LL + atol(end + 1) * 1000LL;
+}
+
+/****  messages ****/
+
+/* Does the line start a message?  The prefix ends in "function() " */
+static int is_prefix(const char *line, size_t len)
+{
+    return len >= 3 && line[0] != ' ' && !memcmp(line + len - 3, "() ", 3);
+}
+
+/* Check a message whose prefix line is line[0..len) */
+static int message_matches(const char *line, size_t len)
+{
+    const char *p = line, *end = line + len;
+    long long ns = message_time(line, len);
+
+    if (ns) {
+        if ((from_ns && ns < from_ns) || (to_ns && ns >= to_ns))
+            return 0;
+        p += 27;
+    }
+    if (p < end && p[0] >= '0' && p[0] <= '9') {
+        /* a LOG_TIMESTAMP_MONOTONIC stamp, seconds.micros */
+        while (p < end && *p != ' ')
+            p++;
+        p++;
+    }
+
+    /* the name, padded to 10 */
+    const char *name = p;
+    while (p < end && *p != ' ')
+        p++;
+    size_t name_len = p - name;
+    if (check_names) {
+        int found = 0;
+        for (int i = 0; i < name_count && !found; i++)
+            found = strlen(names[i]) == name_len && !memcmp(names[i], name, name_len);
+        if (!found)
+            return 0;
+    }
+
+    if (source) {
+        /* file:line is the word in front of "function() " */
+        const char *q = end - 3;
+        while (q > p && *q != ' ')
+            q--;
+        const char *word_end = q;
+        while (q > p && q[-1] != ' ')
+            q--;
+        const char *colon = word_end;
+        while (colon > q && *colon != ':')
+            colon--;
+        size_t file_len = colon - q, source_len = strlen(source);
+        const char *file = base_name(q, &file_len);
+        const char *want = base_name(source, &source_len);
+        if (file_len != source_len || memcmp(file, want, file_len))
+            return 0;
+    }
+    return 1;
+}
+
+/* Print the messages in text[0..len) that match, returns how many */
+static long search(const char *text, size_t len)
+{
+    const char *p = text, *end = text + len;
+    const char *message = NULL;
+    int keep = 0;
+    long found = 0;
+
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        const char *line_end = nl ? nl : end;
+        const char *nul = memchr(p, '\0', line_end - p);
+        if (nul) {
+            /* the zeros a crash leaves at the end of a memory mapped
+             * log file end the message, the next one may follow them */
+            if (message && keep) {
+                fwrite(message, 1, nul - message, stdout);
+                if (nul[-1] != '\n')
+                    putchar('\n');
+            }
+            message = NULL;
+            while (nul < end && !*nul)
+                nul++;
+            p = nul;
+            continue;
+        }
+        if (is_prefix(p, line_end - p)) {
+            if (message && keep)
+                fwrite(message, 1, p - message, stdout);
+            message = p;
+            keep = message_matches(p, line_end - p);
+            found += keep;
+        }
+        p = nl ? nl + 1 : end;
+    }
+    if (message && keep)
+        fwrite(message, 1, end - message, stdout);
+    return found;
+}
+
+/****  blocks ****/
+
+static int block_wanted(const struct log_index_entry *entry)
+{
+    if (from_ns && entry->last_ns < from_ns)
+        return 0;
+    if (to_ns && entry->first_ns >= to_ns)
+        return 0;
+    if (!(entry->levels & level_mask))
+        return 0;
+    if (source_bits && (entry->files & source_bits) != source_bits)
+        return 0;
+    return 1;
+}
+
+static long long bytes_read = 0;
+
+/* Read up to len bytes at offset, short reads included */
+static size_t read_at(int fd, char *text, size_t len, unsigned long long offset)
+{
+    size_t got = 0;
+
+    while (got < len) {
+        ssize_t n = pread(fd, text + got, len - got, offset + got);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    bytes_read += got;
+    return got;
+}
+
+/* Where the last message that starts in text[0..len) does, 0 if none
+ * does after the start */
+static size_t last_message(const char *text, size_t len)
+{
+    const char *line_end = memrchr(text, '\n', len);
+
+    while (line_end && line_end > text) {
+        const char *nl = memrchr(text, '\n', line_end - text);
+        if (!nl)
+            break;
+        if (is_prefix(nl + 1, line_end - nl - 1))
+            return nl + 1 - text;
+        line_end = nl;
+    }
+    return 0;
+}
+
+/* Search length bytes at offset a window at a time */
+static long search_range(int fd, unsigned long long offset, unsigned long long length)
+{
+    size_t room = WINDOW_SIZE;
+    size_t kept = 0;        /* the start of the window, left from the last */
+    char *text = malloc(room);
+    long found = 0;
+
+    while (length) {
+        if (!text) {
+            fprintf(stderr, "logger_query: out of memory\n");
+            exit(1);
+        }
+        size_t want = length < room ? length : room;
+        size_t got = kept + read_at(fd, text + kept, want - kept, offset + kept);
+        if (got < want || want == length) {
+            /* the end of the range, or of the file */
+            found += search(text, got);
+            break;
+        }
+        size_t len = last_message(text, got);
+        if (!len) {
+            /* no message starts in it, it must be a big one */
+            room *= 2;
+            char *more = realloc(text, room);
+            if (!more)
+                free(text);
+            text = more;
+            kept = got;
+            continue;
+        }
+        /* the next window starts with the message cut off here */
+        found += search(text, len);
+        memmove(text, text + len, got - len);
+        kept = got - len;
+        offset += len;
+        length -= len;
+    }
+    free(text);
+    return found;
+}
+
+static void add_level(const char *level)
+{
+    char *end;
+    long number = strtol(level, &end, 10);
+
+    if (name_count == LEVELS_MAX)
+        return;
+    if (*level && !*end) {
+        if (level_mask == ~0ULL)
+            level_mask = 0;
+        level_mask |= log_index_level_bit(number);
+        /* a custom level has no known name, its messages aren't checked */
+        if (number > 0 && number < LEVEL_NAME_COUNT && level_names[number])
+            names[name_count++] = level_names[number];
+        else
+            check_names = -1;
+        return;
+    }
+    names[name_count++] = level;
+    for (int i = 0; i < LEVEL_NAME_COUNT; i++)
+        if (level_names[i] && !strcmp(level_names[i], level)) {
+            if (level_mask == ~0ULL)
+                level_mask = 0;
+            level_mask |= log_index_level_bit(i);
+            return;
+        }
+    /* a name we don't know the level of: every block may have it */
+    level_mask = ~0ULL;
+    check_names = check_names ? check_names : 2;
+}
+
+static int usage(void)
+{
+    fprintf(stderr, "Usage: logger_query [-f from] [-t to] [-l levels] [-s source] "
+                    "[-i index] [-v] logfile\n");
+    return 2;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *from = NULL, *to = NULL, *index = NULL;
+    char index_name[PATH_MAX];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:t:l:s:i:v")) != -1) {
+        switch (opt) {
+            case 'f': from = optarg; break;
+            case 't': to = optarg; break;
+            case 'l':
+                for (char *level = strtok(optarg, ","); level; level = strtok(NULL, ","))
+                    add_level(level);
+                break;
+            case 's': source = optarg; break;
+            case 'i': index = optarg; break;
+            case 'v': verbose = 1; break;
+            default: return usage();
+        }
+    }
+    if (optind != argc - 1)
+        return usage();
+    if (name_count)
+        check_names = check_names >= 0;
+    if (source)
+        source_bits = log_index_file_bits(source);
+
+    const char *log_name = argv[optind];
+    int fd = open(log_name, O_RDONLY);
+    struct stat statbuf;
+    if (fd == -1 || fstat(fd, &statbuf)) {
+        perror(log_name);
+        return 1;
+    }
+    if (!index) {
+        snprintf(index_name, sizeof(index_name), "%s.idx", log_name);
+        index = index_name;
+    }
+    int index_fd = open(index, O_RDONLY);
+    if (index_fd == -1 || log_index_read(index_fd, add_entry) < 0)
+        fprintf(stderr, "logger_query: no index in %s, searching all of %s\n", index, log_name);
+    if (index_fd != -1)
+        close(index_fd);
+
+    long long day_ns = entry_count ? entries[0].first_ns : (long long)statbuf.st_mtime * 1000000000LL;
+    if ((from && (from_ns = parse_time(from, day_ns)) < 0) ||
+        (to && (to_ns = parse_time(to, day_ns)) < 0)) {
+        fprintf(stderr, "logger_query: can't read the time %s\n", from_ns < 0 ? from : to);
+        return 2;
+    }
+
+    /* the wanted blocks, neighbours read in one go, and whatever the
+     * index doesn't cover */
+    unsigned long long covered = 0, size = statbuf.st_size;
+    unsigned long long range_start = 0, range_length = 0;
+    long found = 0, blocks = 0;
+    for (long i = 0; i <= entry_count; i++) {
+        unsigned long long offset = i < entry_count ? entries[i].offset : size;
+        unsigned long long length = i < entry_count ? entries[i].length : 0;
+        if (offset > size)
+            offset = size;
+        if (offset + length > size)
+            length = size - offset;
+        int wanted = i < entry_count && block_wanted(&entries[i]);
+        blocks += wanted;
+
+        if (offset > covered) {   /* a gap before this block */
+            if (range_length && range_start + range_length != covered) {
+                found += search_range(fd, range_start, range_length);
+                range_length = 0;
+            }
+            if (!range_length)
+                range_start = covered;
+            range_length += offset - covered;
+        }
+        if (wanted) {
+            if (range_length && range_start + range_length != offset) {
+                found += search_range(fd, range_start, range_length);
+                range_length = 0;
+            }
+            if (!range_length)
+                range_start = offset;
+            range_length += length;
+        }
+        if (offset + length > covered)
+            covered = offset + length;
+    }
+    found += search_range(fd, range_start, range_length);
+
+    if (verbose)
+        fprintf(stderr, "logger_query: %ld messages, %ld of %ld blocks, read %lld of %llu bytes\n",
+                found, blocks, entry_count, bytes_read, size);
+    close(fd);
+    free(entries);
+    return 0;
+}
@@ -0,0 +1,538 @@
+// This file is part of the logger project:
+//    (https://github.com/GabrielaBarbara/logger)
+//
+// The copyright for this software is held by
+//    Gabriela Gibson <gabriela.gibson@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* logger_scan -- search text log files on all cores
+ *
+ * Usage: logger_scan [-l levels] [-s source] [-e text] [-j threads] [-c] [-X] file|dir ...
+ *
+ *   -l levels   ERROR,WARN,NOTICE,DEBUG,INFO, level numbers or the
+ *               names of your own levels
+ *   -s source   messages from this source file, with or without its path
+ *   -e text     messages holding this text, prefix or contents
+ *   -j threads  how many threads search, all cores by default
+ *   -c          only count the messages found
+ *   -X          no SIMD, for comparison
+ *
+ * A directory stands for the log files in it that are named the way
+ * log_file_init names them, progname[.hostname].YYYYmmdd-HHMMSS[.N],
+ * oldest first.  The files are mapped and cut into chunks at message
+ * boundaries; the threads search the chunks and the messages found are
+ * printed whole, in the order of the files.  The rarest thing looked for
+ * (the text, a single level name or the source file) is searched for
+ * with SSE2 or AVX2, whatever matches is then checked message by
+ * message.  Compressed and binary log files aren't searched.
+ *
+ * As with grep, the exit code is 0 if a message was found, 1 if none
+ * was and 2 on errors.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+#include "logger.h"
+
+#define CHUNK_BYTES (4 << 20)
+#define LEVELS_MAX 32
+#define AHEAD 4     /* chunks per thread searched ahead of the output */
+
+static const char *level_names[] = {
+    [LOG_ERR] = "ERROR", [LOG_WARN] = "WARN", [LOG_NOTICE] = "NOTICE",
+    [LOG_DEBUG] = "DEBUG", [LOG_INFO] = "INFO",
+};
+#define LEVEL_NAME_COUNT ((int)(sizeof(level_names) / sizeof(level_names[0])))
+
+/* What to look for */
+static const char *names[LEVELS_MAX];
+static int name_count = 0;
+static const char *source = NULL;
+static size_t source_len = 0;
+static const char *text = NULL;
+static size_t text_len = 0;
+static int count_only = 0;
+
+/* The needle searched for, every message it is found in is checked */
+static char needle[PATH_MAX + 2];
+static size_t needle_len = 0;
+
+/****  searching ****/
+
+typedef const char *(*find_func)(const char *p, const char *end, const char *what, size_t len);
+
+static const char *find_scalar(const char *p, const char *end, const char *what, size_t len)
+{
+    return p < end ? memmem(p, end - p, what, len) : NULL;
+}
+
+#ifdef SCAN_X86
+/* Compare 16 or 32 positions at once with the first and the last byte
+ * of what is looked for; only where both are right is it compared in
+ * full.
+ */
+static const char *find_sse2(const char *p, const char *end, const char *what, size_t len)
+{
+    const __m128i first = _mm_set1_epi8(what[0]);
+    const __m128i last = _mm_set1_epi8(what[len - 1]);
+
+    for (; end - p >= (long)(len - 1 + 16); p += 16) {
+        __m128i at_first = _mm_loadu_si128((const __m128i *)p);
+        __m128i at_last = _mm_loadu_si128((const __m128i *)(p + len - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(at_first, first),
+                                                        _mm_cmpeq_epi8(at_last, last)));
+        for (; mask; mask &= mask - 1) {
+            const char *candidate = p + __builtin_ctz(mask);
+            if (!memcmp(candidate, what, len))
+                return candidate;
+        }
+    }
+    return find_scalar(p, end, what, len);
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *p, const char *end, const char *what, size_t len)
+{
+    const __m256i first = _mm256_set1_epi8(what[0]);
+    const __m256i last = _mm256_set1_epi8(what[len - 1]);
+
+    for (; end - p >= (long)(len - 1 + 32); p += 32) {
+        __m256i at_first = _mm256_loadu_si256((const __m256i *)p);
+        __m256i at_last = _mm256_loadu_si256((const __m256i *)(p + len - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(at_first, first),
+                                                              _mm256_cmpeq_epi8(at_last, last)));
+        for (; mask; mask &= mask - 1) {
+            const char *candidate = p + __builtin_ctz(mask);
+            if (!memcmp(candidate, what, len))
+                return candidate;
+        }
+    }
+    return find_sse2(p, end, what, len);
+}
+#endif
+
+static find_func find = find_scalar;
+
+/* The start of the line after the one p is in, end if none.  Lines
+ * are short, the vectorised memchr of the C library does best here.
+ */
+static const char *next_line(const char *p, const char *end)
+{
+    const char *nl = memchr(p, '\n', end - p);
+    return nl ? nl + 1 : end;
+}
+
+/* Does a message start here?  Its prefix ends in "function() " */
+static int is_prefix(const char *line, const char *end)
+{
+    const char *nl = memchr(line, '\n', end - line);
+    const char *line_end = nl ? nl : end;
+
+    return line_end - line >= 3 && line[0] != ' ' && line[0] != '\n' &&
+           !memcmp(line_end - 3, "() ", 3);
+}
+
+/* The first message at or after p, p being at the start of a line */
+static const char *message_at(const char *p, const char *end)
+{
+    while (p < end && !is_prefix(p, end))
+        p = next_line(p, end);
+    return p;
+}
+
+/* The message p is in, not before start */
+static const char *message_before(const char *p, const char *start, const char *end)
+{
+    for (;;) {
+        while (p > start && p[-1] != '\n')
+            p--;
+        if (p == start || is_prefix(p, end))
+            return p;
+        p--;
+    }
+}
+
+static const char *base_name(const char *path, size_t *len)
+{
+    const char *end = path + *len;
+    const char *p = end;
+
+    while (p > path && p[-1] != '/')
+        p--;
+    *len = end - p;
+    return p;
+}
+
+/* Check the message message[0..len) */
+static int message_matches(const char *message, size_t len)
+{
+    const char *end = memchr(message, '\n', len);
+    const char *p = message;
+
+    if (!end)
+        end = message + len;
+
+    /* LOG_TIMESTAMP_WALL 2026-10-18 02:47:12.123456, then LOG_TIMESTAMP_MONOTONIC */
+    if (end - p > 27 && p[4] == '-' && p[10] == ' ' && p[19] == '.')
+        p += 27;
+    if (p < end && p[0] >= '0' && p[0] <= '9') {
+        while (p < end && *p != ' ')
+            p++;
+        p++;
+    }
+
+    if (name_count) {
+        const char *name = p;
+        while (p < end && *p != ' ')
+            p++;
+        size_t name_len = p - name;
+        int found = 0;
+        for (int i = 0; i < name_count && !found; i++)
+            found = strlen(names[i]) == name_len && !memcmp(names[i], name, name_len);
+        if (!found)
+            return 0;
+    }
+
+    if (source) {
+        /* file:line is the word in front of "function() " */
+        const char *q = end - 3;
+        while (q > p && *q != ' ')
+            q--;
+        const char *word_end = q;
+        while (q > p && q[-1] != ' ')
+            q--;
+        const char *colon = word_end;
+        while (colon > q && *colon != ':')
+            colon--;
+        size_t file_len = colon - q;
+        const char *file = base_name(q, &file_len);
+        if (file_len != source_len || memcmp(file, source, file_len))
+            return 0;
+    }
+
+    return !text || find(message, message + len, text, text_len);
+}
+
+/****  chunks of the files ****/
+
+struct chunk {
+    const char *start, *end;
+    char *out;            /* the messages found */
+    size_t out_len, out_room;
+    long found;
+    int done;
+};
+
+static struct chunk *chunks = NULL;
+static long chunk_count = 0, chunk_room = 0;
+static long next_chunk = 0;        /* the next one to search */
+static long printed = 0;           /* chunks printed so far */
+static long ahead = 0;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t searched = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t written = PTHREAD_COND_INITIALIZER;
+
+static void keep(struct chunk *chunk, const char *message, size_t len)
+{
+    chunk->found++;
+    if (count_only)
+        return;
+    /* one more for the newline of a message a crash cut short */
+    if (chunk->out_len + len + 1 > chunk->out_room) {
+        size_t room = chunk->out_room ? chunk->out_room : 64 << 10;
+        while (room < chunk->out_len + len + 1)
+            room *= 2;
+        char *more = realloc(chunk->out, room);
+        if (!more) {
+            fprintf(stderr, "logger_scan: out of memory\n");
+            exit(1);
+        }
+        chunk->out = more;
+        chunk->out_room = room;
+    }
+    memcpy(chunk->out + chunk->out_len, message, len);
+    chunk->out_len += len;
+    if (len && message[len - 1] != '\n')
+        chunk->out[chunk->out_len++] = '\n';
+}
+
+/* Keep the message message[0..end) if it matches.  A memory mapped log
+ * file ends in zeros after a crash, and more messages follow them once
+ * the program runs again: the zeros end the message, and what comes
+ * after them is looked at on its own. */
+static void consider(struct chunk *chunk, const char *message, const char *end)
+{
+    const char *nul = memchr(message, '\0', end - message);
+    const char *stop = nul ? nul : end;
+
+    if (stop > message && message_matches(message, stop - message))
+        keep(chunk, message, stop - message);
+    if (!nul)
+        return;
+    while (nul < end && !*nul)
+        nul++;
+    for (const char *p = message_at(nul, end); p < end; ) {
+        const char *next = message_at(next_line(p, end), end);
+        consider(chunk, p, next);
+        p = next;
+    }
+}
+
+static void search_chunk(struct chunk *chunk)
+{
+    const char *p = chunk->start, *end = chunk->end;
+
+    unsigned long page = (unsigned long)p & ~(sysconf(_SC_PAGESIZE) - 1);
+    madvise((void *)page, (unsigned long)end - page, MADV_WILLNEED);
+
+    if (!needle_len) {
+        /* nothing rare to look for, every message is checked */
+        while (p < end) {
+            const char *next = message_at(next_line(p, end), end);
+            consider(chunk, p, next);
+            p = next;
+        }
+        return;
+    }
+    for (const char *hit; p < end && (hit = find(p, end, needle, needle_len)); ) {
+        const char *message = message_before(hit, chunk->start, end);
+        const char *next = message_at(next_line(hit, end), end);
+        consider(chunk, message, next);
+        p = next;
+    }
+}
+
+static void *searcher(void *unused)
+{
+    (void)unused;
+    pthread_mutex_lock(&mutex);
+    for (;;) {
+        while (next_chunk < chunk_count && next_chunk >= printed + ahead)
+            pthread_cond_wait(&written, &mutex);
+        if (next_chunk == chunk_count)
+            break;
+        struct chunk *chunk = &chunks[next_chunk++];
+        pthread_mutex_unlock(&mutex);
+
+        search_chunk(chunk);
+
+        pthread_mutex_lock(&mutex);
+        chunk->done = 1;
+        pthread_cond_signal(&searched);
+    }
+    pthread_mutex_unlock(&mutex);
+    return NULL;
+}
+
+/* Cut a mapped file into chunks that start with a message */
+static int add_file(const char *name)
+{
+    int fd = open(name, O_RDONLY);
+    struct stat statbuf;
+
+    if (fd == -1 || fstat(fd, &statbuf)) {
+        perror(name);
+        if (fd != -1)
+            close(fd);
+        return 1;
+    }
+    if (statbuf.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    const char *base = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror(name);
+        return 1;
+    }
+    madvise((void *)base, statbuf.st_size, MADV_SEQUENTIAL);
+
+    const char *end = base + statbuf.st_size;
+    for (const char *p = base; p < end; ) {
+        const char *cut = end - p > CHUNK_BYTES ? p + CHUNK_BYTES : end;
+        if (cut < end)
+            cut = message_at(next_line(cut, end), end);
+        if (chunk_count == chunk_room) {
+            long room = chunk_room ? 2 * chunk_room : 256;
+            struct chunk *more = realloc(chunks, room * sizeof(*chunks));
+            if (!more) {
+                fprintf(stderr, "logger_scan: out of memory\n");
+                return 1;
+            }
+            chunks = more;
+            chunk_room = room;
+        }
+        chunks[chunk_count++] = (struct chunk){ .start = p, .end = cut };
+        p = cut;
+    }
+    return 0;
+}
+
+/* scandir filter: progname[.hostname].YYYYmmdd-HHMMSS[.N] */
+static int is_log_file(const struct dirent *entry)
+{
+    const char *dot = strchr(entry->d_name, '.');
+
+    for (; dot; dot = strchr(dot + 1, '.')) {
+        const char *p = dot + 1;
+        int i;
+        for (i = 0; i < 15; i++, p++)
+            if (i == 8 ? *p != '-' : (*p < '0' || *p > '9'))
+                break;
+        if (i < 15)
+            continue;
+        if (*p == '.' && p[1])
+            for (p++; *p >= '0' && *p <= '9'; p++)
+                ;
+        if (*p == '\0')
+            return 1;
+    }
+    return 0;
+}
+
+static int add_path(const char *path)
+{
+    struct stat statbuf;
+    struct dirent **entries;
+    char name[PATH_MAX];
+    int failed = 0;
+
+    if (stat(path, &statbuf) || !S_ISDIR(statbuf.st_mode))
+        return add_file(path);
+
+    int count = scandir(path, &entries, is_log_file, versionsort);
+    if (count < 0) {
+        perror(path);
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "%s/%s", path, entries[i]->d_name);
+        failed |= add_file(name);
+        free(entries[i]);
+    }
+    free(entries);
+    return failed;
+}
+
+static void add_level(const char *level)
+{
+    char *end;
+    long number = strtol(level, &end, 10);
+
+    if (name_count == LEVELS_MAX)
+        return;
+    if (*level && !*end && number > 0 && number < LEVEL_NAME_COUNT && level_names[number])
+        level = level_names[number];
+    names[name_count++] = level;
+}
+
+static int usage(void)
+{
+    fprintf(stderr, "Usage: logger_scan [-l levels] [-s source] [-e text] [-j threads] "
+                    "[-c] [-X] file|dir ...\n");
+    return 2;
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int simd = 1, failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:s:e:j:cX")) != -1) {
+        switch (opt) {
+            case 'l':
+                for (char *level = strtok(optarg, ","); level; level = strtok(NULL, ","))
+                    add_level(level);
+                break;
+            case 's': source = optarg; break;
+            case 'e': text = optarg; break;
+            case 'j': threads = atoi(optarg); break;
+            case 'c': count_only = 1; break;
+            case 'X': simd = 0; break;
+            default: return usage();
+        }
+    }
+    if (optind == argc || threads < 1)
+        return usage();
+
+#ifdef SCAN_X86
+    if (simd)
+        find = __builtin_cpu_supports("avx2") ? find_avx2 : find_sse2;
+#endif
+    if (source) {
+        source_len = strlen(source);
+        source = base_name(source, &source_len);
+    }
+
+    /* the needle: the text, the name of the one level, or the file */
+    if (text && *text)
+        needle_len = snprintf(needle, sizeof(needle), "%s", text);
+    else if (name_count == 1)
+        needle_len = snprintf(needle, sizeof(needle), "%-10s ", names[0]);
+    else if (source && source_len)
+        needle_len = snprintf(needle, sizeof(needle), "%.*s:", (int)source_len, source);
+    if (needle_len >= sizeof(needle))
+        needle_len = sizeof(needle) - 1;
+    if (text && !*text)
+        text = NULL;
+    else if (text)
+        text_len = strlen(text);
+
+    for (int i = optind; i < argc; i++)
+        failed |= add_path(argv[i]);
+
+    pthread_t searchers[threads];
+    ahead = (long)AHEAD * threads;
+    for (int i = 0; i < threads; i++)
+        pthread_create(&searchers[i], NULL, searcher, NULL);
+
+    /* print the chunks in order, as they are done */
+    long found = 0;
+    for (long i = 0; i < chunk_count; i++) {
+        pthread_mutex_lock(&mutex);
+        while (!chunks[i].done)
+            pthread_cond_wait(&searched, &mutex);
+        pthread_mutex_unlock(&mutex);
+
+        fwrite(chunks[i].out, 1, chunks[i].out_len, stdout);
+        free(chunks[i].out);
+        found += chunks[i].found;
+
+        pthread_mutex_lock(&mutex);
+        printed = i + 1;
+        pthread_cond_broadcast(&written);
+        pthread_mutex_unlock(&mutex);
+    }
+    for (int i = 0; i < threads; i++)
+        pthread_join(searchers[i], NULL);
+
+    if (count_only)
+        printf("%ld\n", found);
+    free(chunks);
+    return failed ? 2 : found ? 0 : 1;
+}